@@ -20,6 +20,8 @@
 #include <ucontext.h>
 #include <unistd.h>
 
+#include "backtrace.hpp"
+
 typedef struct _sigcontext_64 {
 	uint64_t r8;
 	uint64_t r9;
@@ -142,12 +144,39 @@ void crit_err_hdlr(int sig_num, siginfo_t * info, void * ucontext)
     exit(EXIT_FAILURE);
 }
 
+static FaultHandler faultHandler = nullptr;
+
+void setFaultHandler(FaultHandler handler)
+{
+	faultHandler = handler;
+}
+
+// Faults are expected when fastmem code touches an unmapped page, the
+// fault handler then redirects the access to its slow path
+void segv_hdlr(int sig_num, siginfo_t * info, void * ucontext)
+{
+	sig_ucontext_t * uc = (sig_ucontext_t *)ucontext;
+
+	if (faultHandler)
+	{
+		void *resume = faultHandler((void *)uc->uc_mcontext.ip);
+		if (resume)
+		{
+			uc->uc_mcontext.ip = (uint64_t)resume;
+			return;
+		}
+	}
+
+	crit_err_hdlr(sig_num, info, ucontext);
+}
+
 void setupSigAct()
 {
 	struct sigaction sigact;
 
-	sigact.sa_sigaction = crit_err_hdlr;
+	sigact.sa_sigaction = segv_hdlr;
 	sigact.sa_flags = SA_RESTART | SA_SIGINFO;
+	sigemptyset(&sigact.sa_mask);
 
 	if (sigaction(SIGSEGV, &sigact, (struct sigaction *)NULL) != 0)
 	{
@@ -157,7 +186,14 @@ void setupSigAct()
 	}
 }
 #else
+#include "backtrace.hpp"
+
 void setupSigAct()
 {
 }
+
+void setFaultHandler(FaultHandler handler)
+{
+	(void)handler;
+}
 #endif
@@ -0,0 +1,154 @@
+#include <batch.hpp>
+#include <bus.hpp>
+#include <savestate.hpp>
+#include <gpu/software/renderer.hpp>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+namespace batch {
+
+ThreadPool::ThreadPool(uint32_t threads) :
+	mPending(0),
+	mStopping(false)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (uint32_t i = 0; i < threads; i++)
+		mThreads.emplace_back(&ThreadPool::run, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+
+	mWork.notify_all();
+
+	for (std::thread &thread : mThreads)
+		thread.join();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mTasks.push_back(std::move(task));
+		mPending++;
+	}
+
+	mWork.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mIdle.wait(lock, [this] { return mPending == 0; });
+}
+
+void ThreadPool::run()
+{
+	for (;;)
+	{
+		std::function<void()> task;
+
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWork.wait(lock, [this] { return mStopping || !mTasks.empty(); });
+
+			if (mTasks.empty())
+				return;
+
+			task = std::move(mTasks.front());
+			mTasks.pop_front();
+		}
+
+		task();
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (--mPending == 0)
+			mIdle.notify_all();
+	}
+}
+
+// Run a copy of `bus` restored from `machine`, `savedRam` and
+// `savedVram`, drawing with the software renderer if there's a VRAM
+static Result runInstance(bus::Bus &bus, const std::string &biosPath, bool fastmem,
+						  const std::vector<uint8_t> &machine, const std::vector<uint8_t> &savedRam,
+						  const std::vector<uint8_t> &savedVram, uint64_t frames)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	// Too big for the stack of a worker
+	auto instance = std::make_unique<bus::Bus>(biosPath);
+	cpu::Cpu &cpu = instance->mCpu;
+
+	cpu.mExecutionMode = bus.mCpu.mExecutionMode;
+	cpu.mIdleSkipping = bus.mCpu.mIdleSkipping;
+	cpu.mHle.enableSame(bus.mCpu.mHle);
+
+	if (fastmem && !instance->enableFastmem())
+		panic("Fastmem isn't supported on this host");
+
+	// The renderer has to be there before the machine state, which
+	// sets it up
+	if (!savedVram.empty())
+	{
+		instance->mGpu.setRenderer(std::make_unique<gpu::software::Renderer>());
+		savestate::restoreVram(*instance, savedVram.data());
+	}
+
+	savestate::restoreRam(*instance, savedRam.data());
+	savestate::loadMachine(*instance, machine.data());
+
+	Result result = {};
+	uint64_t startCycles = cpu.mCycles;
+	uint32_t lastIp = cpu.mIp;
+
+	for (uint64_t frame = 0; frame < frames; frame++)
+	{
+		instance->runFrame();
+		result.mInstructions += (uint32_t)(cpu.mIp - lastIp);
+		lastIp = cpu.mIp;
+	}
+
+	result.mFrames = frames;
+	result.mCycles = cpu.mCycles - startCycles;
+	if (!savedVram.empty())
+		result.mFrameHash = ((gpu::software::Renderer *)instance->mGpu.mRenderer.get())->mFrameHash;
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	result.mSeconds = elapsed.count();
+
+	return result;
+}
+
+std::vector<Result> run(ThreadPool &pool, bus::Bus &bus, const std::string &biosPath, bool fastmem,
+						uint32_t instances, uint64_t frames)
+{
+	std::vector<uint8_t> machine;
+	savestate::saveMachine(bus, machine);
+	std::vector<uint8_t> savedRam(bus.mRam.data(), bus.mRam.data() + ram::RAM_SIZE);
+	// Only the software renderer keeps a VRAM, the copies use it too
+	std::vector<uint8_t> savedVram;
+	if (gpu::Vram *vram = bus.mGpu.mRenderer->vram())
+		savedVram.assign(vram->data(), vram->data() + gpu::VRAM_SIZE);
+
+	std::vector<Result> results(instances);
+
+	for (uint32_t i = 0; i < instances; i++)
+	{
+		pool.submit([&, i] {
+			results[i] = runInstance(bus, biosPath, fastmem, machine, savedRam, savedVram, frames);
+		});
+	}
+
+	pool.wait();
+
+	return results;
+}
+
+} // namespace batch
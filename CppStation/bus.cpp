@@ -1,55 +1,200 @@
 #include <bus.hpp>
+#include <algorithm>
 #include "helpers.hpp"
 
 namespace bus {
 
-Bus::Bus()
+Bus::Bus(const std::string &biosPath)
 {
-	std::string path("roms/SCPH1001.BIN");
-	uint64_t res = mBios.loadFromFile(path).check();
-	(void)res;
+	// Without a path the BIOS stays zeroed, the benchmarks don't need
+	// it
+	if (!biosPath.empty())
+	{
+		uint64_t res = mBios.loadFromFile(biosPath).check();
+		(void)res;
+	}
 
 	mRam.connectBus(this);
 	mCpu.connectBus(this);
 	mBios.connectBus(this);
 	mDma.connectBus(this);
 	mGpu.connectBus(this);
+
+	mapMemory();
+	updateLoadDelays();
+
+	mGpu.setupEvents();
 }
 
 Bus::~Bus()
 {
 }
 
-uint32_t Bus::load32(uint32_t addr)
+void Bus::mapMemory()
 {
-	uint32_t abs_addr = map::maskRegion(addr);
-	int32_t offset = map::contains(abs_addr, mMap.mRAM.mEnd, mMap.mRAM.mBase);
-	if (offset != -1)
-		return mRam.load32(offset);
+	// The RAM mirrors are in the page table too, so every execution
+	// mode sees RAM over the whole first 8MB like the fastmem arena,
+	// not just the recompiler
+	for (uint32_t mirror = 0; mirror < ram::RAM_MIRRORS; mirror++)
+		mPageTable.map(mMap.mRAM.mBase + mirror * mMap.mRAM.mSize, mMap.mRAM.mSize, mRam.data(), true);
 
-	offset = map::contains(abs_addr, mMap.mBIOS.mEnd, mMap.mBIOS.mBase);
-	if (offset != -1)
-		return mBios.load32(offset);
+	mPageTable.map(mMap.mBIOS.mBase, mMap.mBIOS.mSize, (uint8_t *)mBios.mBuffer, false);
+}
 
-	offset = map::contains(abs_addr, mMap.mIRQ_CONTROL.mEnd, mMap.mIRQ_CONTROL.mBase);
+void Bus::runUntil(uint64_t end)
+{
+	for (;;)
+	{
+		{
+			profiler::Scope scope(mProfiler, profiler::Events);
+			mScheduler.runDue(mCpu.mCycles);
+		}
+
+		if (mCpu.mCycles >= end)
+			break;
+
+		// Everything due has run so the next deadline is ahead
+		mCpu.run(std::min(end, mScheduler.nextDeadline()) - mCpu.mCycles);
+	}
+}
+
+void Bus::runFrame()
+{
+	uint64_t frame = mGpu.mFrames;
+
+	while (mGpu.mFrames == frame)
+		runUntil(mScheduler.nextDeadline());
+}
+
+bool Bus::bootKernel(uint64_t maxCycles)
+{
+	uint64_t end = mCpu.mCycles + maxCycles;
+
+	// One instruction at a time so that we stop right at the jump
+	while (mCpu.mPc != SHELL_ENTRY)
+	{
+		if (mCpu.mCycles >= end)
+			return false;
+
+		mScheduler.runDue(mCpu.mCycles);
+		mCpu.runNextInstruction();
+	}
+
+	return true;
+}
+
+void Bus::sideload(const exe::Exe &exe)
+{
+	uint32_t text = map::maskRegion(exe.mTextAddr);
+	uint32_t fill = map::maskRegion(exe.mFillAddr);
+
+	// In 64 bits, the sizes come from the file and can be anything
+	if ((uint64_t)text + exe.mText.size() > ram::RAM_SIZE)
+		panic("EXE text segment at {:08x} doesn't fit in RAM", exe.mTextAddr);
+	if (exe.mFillSize && (uint64_t)fill + exe.mFillSize > ram::RAM_SIZE)
+		panic("EXE fill area at {:08x} doesn't fit in RAM", exe.mFillAddr);
+
+	memcpy(mRam.data() + text, exe.mText.data(), exe.mText.size());
+	memset(mRam.data() + fill, 0, exe.mFillSize);
+	mRam.markDirty(text, exe.mText.size());
+	mRam.markDirty(fill, exe.mFillSize);
+
+	// Whatever code was cached may have been overwritten
+	mCpu.mBlockCache.clear();
+	mCpu.mRecompiler.reset();
+
+	mCpu.mPc = exe.mPc;
+	mCpu.mNextPc = exe.mPc + 4;
+	mCpu.mBranch = false;
+	mCpu.mLoadRegIdx.val = 0;
+	mCpu.mLoadReg = 0;
+	mCpu.mRegs[28] = exe.mGp;
+	if (exe.mSpBase != 0)
+	{
+		mCpu.mRegs[29] = exe.mSpBase + exe.mSpOffset;
+		mCpu.mRegs[30] = exe.mSpBase + exe.mSpOffset;
+	}
+}
+
+uint32_t Bus::ioLoadDelay(uint32_t abs_addr, uint8_t width)
+{
+	if (map::contains(abs_addr, mMap.mSPU.mEnd, mMap.mSPU.mBase) != -1)
+		return mMemControl.accessTime(memcontrol::Spu, width);
+
+	if (map::contains(abs_addr, mMap.mEXPANSION_2.mEnd, mMap.mEXPANSION_2.mBase) != -1)
+		return mMemControl.accessTime(memcontrol::Expansion2, width);
+
+	return IO_LOAD_DELAY;
+}
+
+void Bus::updateLoadDelays()
+{
+	for (uint8_t width = 1; width <= 4; width <<= 1)
+	{
+		uint8_t *delays = mCpu.mLoadDelay[width >> 1];
+
+		// Unmapped zones raise bus errors, the value doesn't matter
+		memset(delays, IO_LOAD_DELAY, cpu::DELAY_ZONES);
+
+		for (uint32_t mirror = 0; mirror < ram::RAM_MIRRORS; mirror++)
+			delays[cpu::delayZone(mMap.mRAM.mBase + mirror * mMap.mRAM.mSize)] = RAM_LOAD_DELAY;
+
+		delays[cpu::delayZone(mMap.mEXPANSION_1.mBase)] = mMemControl.accessTime(memcontrol::Expansion1, width);
+		delays[cpu::delayZone(mMap.mBIOS.mBase)] = mMemControl.accessTime(memcontrol::Bios, width);
+		// The scratchpad is as fast as the data cache it's made of
+		delays[cpu::IO_DELAY_ZONE] = 0;
+	}
+}
+
+bool Bus::enableFastmem()
+{
+	if (!cpu::jit::AVAILABLE || !mFastmem.init(mBios.fd()))
+		return false;
+
+	mRam.setData(mFastmem.mRam);
+	// A BIOS image file is mapped as is, the zeroed BIOS has to be
+	// copied
+	if (mBios.fd() == -1)
+		mBios.setBuffer(mFastmem.mBios);
+	mCpu.mScratchpad.setData(mFastmem.mScratchpad);
+	mapMemory();
+
+	mCpu.mRecompiler.enableFastmem(mFastmem.mBase);
+
+	return true;
+}
+
+template<>
+uint32_t Bus::ioLoad<uint32_t>(uint32_t addr)
+{
+	uint32_t abs_addr = map::maskRegion(addr);
+	int32_t offset = map::contains(abs_addr, mMap.mIRQ_CONTROL.mEnd, mMap.mIRQ_CONTROL.mBase);
 	if (offset != -1)
 	{
-		println("IRQ control read {:x}", offset);
+		LOG_DEBUG(Bus, "IRQ control read {:x}", offset);
 		return 0;
 	}
 
+	offset = map::contains(abs_addr, mMap.mMEM_CONTROL.mEnd, mMap.mMEM_CONTROL.mBase);
+	if (offset != -1)
+		return mMemControl.load32(offset);
+
+	offset = map::contains(abs_addr, mMap.mCACHE_CONTROL.mEnd, mMap.mCACHE_CONTROL.mBase);
+	if (offset != -1)
+		return mCpu.mICache.mControl;
+
 	offset = map::contains(abs_addr, mMap.mDMA.mEnd, mMap.mDMA.mBase);
 	if (offset != -1)
 	{
 		uint32_t res = dmaReg(offset);
-		println("DMA read: {:08x} ==> {:08x}", abs_addr, res);
+		LOG_TRACE(Dma, "DMA read: {:08x} ==> {:08x}", abs_addr, res);
 		return res;
 	}
 
 	offset = map::contains(abs_addr, mMap.mGPU.mEnd, mMap.mGPU.mBase);
 	if (offset != -1)
 	{
-		println("GPU read: {}", offset);
+		LOG_TRACE(Gpu, "GPU read: {}", offset);
 		switch (offset)
 		{
 		case 0:
@@ -65,67 +210,53 @@ uint32_t Bus::load32(uint32_t addr)
 	offset = map::contains(abs_addr, mMap.mTIMERS.mEnd, mMap.mTIMERS.mBase);
 	if (offset != -1)
 	{
-		println("Unhandled read from timer register {:x}", offset);
+		LOG_DEBUG(Bus, "Unhandled read from timer register {:x}", offset);
 		return 0;
 	}
 
 	panic("{}: Unhandled load32 at address {:08x}", __func__, abs_addr);
 }
 
-void Bus::store32(uint32_t addr, uint32_t val)
+template<>
+void Bus::ioStore<uint32_t>(uint32_t addr, uint32_t val)
 {
 	uint32_t abs_addr = map::maskRegion(addr);
-	int32_t offset = map::contains(abs_addr, mMap.mRAM.mEnd, mMap.mRAM.mBase);
+	int32_t offset = map::contains(abs_addr, mMap.mMEM_CONTROL.mEnd, mMap.mMEM_CONTROL.mBase);
 	if (offset != -1) {
-		mRam.store32(offset, val);
-		return;
-	}
-
-	offset = map::contains(abs_addr, mMap.mMEM_CONTROL.mEnd, mMap.mMEM_CONTROL.mBase);
-	if (offset != -1) {
-		switch (offset)
-		{
-		case 0: // Expansion 1 base address
-			if (val != 0x1f000000)
-				panic("Bad expansion 1 base address: 0x{:08x}", val);
-			break;
-		case 4: // Expansion 2 base address
-			if (val != 0x1f802000)
-				panic("Bad expansion 2 base address: 0x{:08x}", val);
-			break;
-		default:
-			println("Unhandled write to MEM_CONTROL register");
-		}
+		mMemControl.store32(offset, val);
+		updateLoadDelays();
 		return;
 	}
 
 	offset = map::contains(abs_addr, mMap.mRAM_SIZE.mEnd, mMap.mRAM_SIZE.mBase);
 	if (offset != -1) {
-		println("Unhandled write to RAM_SIZE register");
+		LOG_DEBUG(Bus, "Unhandled write to RAM_SIZE register");
 		return;
 	}
 
 	offset = map::contains(abs_addr, mMap.mCACHE_CONTROL.mEnd, mMap.mCACHE_CONTROL.mBase);
 	if (offset != -1) {
-		println("Unhandled write to CACHE_CONTROL register");
+		mCpu.mICache.mControl = val;
 		return;
 	}
 
 	offset = map::contains(abs_addr, mMap.mIRQ_CONTROL.mEnd, mMap.mIRQ_CONTROL.mBase);
 	if (offset != -1) {
-		println("IRQ control: {:x} <- {:08x}", offset, val);
+		LOG_DEBUG(Bus, "IRQ control: {:x} <- {:08x}", offset, val);
 		return;
 	}
 
 	offset = map::contains(abs_addr, mMap.mDMA.mEnd, mMap.mDMA.mBase);
 	if (offset != -1) {
-		println("DMA write: {:08x} {:08x}", abs_addr, val);
+		LOG_TRACE(Dma, "DMA write: {:08x} {:08x}", abs_addr, val);
 		setDmaReg(offset, val);
 		return;
 	}
 
 	offset = map::contains(abs_addr, mMap.mGPU.mEnd, mMap.mGPU.mBase);
 	if (offset != -1) {
+		profiler::Scope scope(mProfiler, profiler::Gpu);
+
 		switch (offset)
 		{
 		case 0:
@@ -142,85 +273,67 @@ void Bus::store32(uint32_t addr, uint32_t val)
 
 	offset = map::contains(abs_addr, mMap.mTIMERS.mEnd, mMap.mTIMERS.mBase);
 	if (offset != -1) {
-		println("Unhandled write to timer register {:x}: {:08x}", offset, val);
+		LOG_DEBUG(Bus, "Unhandled write to timer register {:x}: {:08x}", offset, val);
 		return;
 	}
 
 	panic("unhandled store32 into address {:08x}", abs_addr);
 }
 
-uint16_t Bus::load16(uint32_t addr)
+template<>
+uint16_t Bus::ioLoad<uint16_t>(uint32_t addr)
 {
 	uint32_t abs_addr = map::maskRegion(addr);
 
-	int32_t offset = map::contains(abs_addr, mMap.mRAM.mEnd, mMap.mRAM.mBase);
-	if (offset != -1)
-		return mRam.load16(offset);
-
-	offset = map::contains(abs_addr, mMap.mSPU.mEnd, mMap.mSPU.mBase);
+	int32_t offset = map::contains(abs_addr, mMap.mSPU.mEnd, mMap.mSPU.mBase);
 	if (offset != -1)
 	{
-		println("Unhandled read from SPU register {:08x}", abs_addr);
+		LOG_DEBUG(Bus, "Unhandled read from SPU register {:08x}", abs_addr);
 		return 0;
 	}
 
 	offset = map::contains(abs_addr, mMap.mIRQ_CONTROL.mEnd, mMap.mIRQ_CONTROL.mBase);
 	if (offset != -1)
 	{
-		println("IRQ control read {:x}", offset);
+		LOG_DEBUG(Bus, "IRQ control read {:x}", offset);
 		return 0;
 	}
 
 	panic("unhandled load16 at address {:08x}", addr);
 }
 
-void Bus::store16(uint32_t addr, uint16_t val)
+template<>
+void Bus::ioStore<uint16_t>(uint32_t addr, uint16_t val)
 {
 	uint32_t abs_addr = map::maskRegion(addr);
-	int32_t offset = map::contains(abs_addr, mMap.mRAM.mEnd, mMap.mRAM.mBase);
-	if (offset != -1) {
-		mRam.store16(offset, val);
-		return;
-	}
-
-	offset = map::contains(abs_addr, mMap.mSPU.mEnd, mMap.mSPU.mBase);
+	int32_t offset = map::contains(abs_addr, mMap.mSPU.mEnd, mMap.mSPU.mBase);
 	if (offset != -1)
 	{
-		println("Unhandled write to SPU register {:08x}: {:04x}",
+		LOG_DEBUG(Bus, "Unhandled write to SPU register {:08x}: {:04x}",
 				 abs_addr, val);
 		return;
 	}
 
 	offset = map::contains(abs_addr, mMap.mTIMERS.mEnd, mMap.mTIMERS.mBase);
 	if (offset != -1) {
-		println("Unhandled write to timer register {:x}", offset);
+		LOG_DEBUG(Bus, "Unhandled write to timer register {:x}", offset);
 		return;
 	}
 
 	offset = map::contains(abs_addr, mMap.mIRQ_CONTROL.mEnd, mMap.mIRQ_CONTROL.mBase);
 	if (offset != -1) {
-		println("IRQ control write {:x}, {:04x}", offset, val);
+		LOG_DEBUG(Bus, "IRQ control write {:x}, {:04x}", offset, val);
 		return;
 	}
 
 	panic("unhandled store16 into address {:08x}", addr);
 }
 
-uint8_t Bus::load8(uint32_t addr)
+template<>
+uint8_t Bus::ioLoad<uint8_t>(uint32_t addr)
 {
 	uint32_t abs_addr = map::maskRegion(addr);
-	int32_t offset = map::contains(abs_addr, mMap.mRAM.mEnd, mMap.mRAM.mBase);
-	if (offset != -1)
-	{
-		return mRam.load8(offset);
-	}
-	offset = map::contains(abs_addr, mMap.mBIOS.mEnd, mMap.mBIOS.mBase);
-	if (offset != -1)
-	{
-		return mBios.load8(offset);
-	}
-
-	offset = map::contains(abs_addr, mMap.mEXPANSION_1.mEnd, mMap.mEXPANSION_1.mBase);
+	int32_t offset = map::contains(abs_addr, mMap.mEXPANSION_1.mEnd, mMap.mEXPANSION_1.mBase);
 	if (offset != -1)
 	{
 		// No expansion implemented
@@ -230,19 +343,14 @@ uint8_t Bus::load8(uint32_t addr)
 	panic("unhandled load8 at address {:08x}", addr);
 }
 
-void Bus::store8(uint32_t addr, uint8_t val)
+template<>
+void Bus::ioStore<uint8_t>(uint32_t addr, uint8_t val)
 {
 	uint32_t abs_addr = map::maskRegion(addr);
-	int32_t offset = map::contains(abs_addr, mMap.mRAM.mEnd, mMap.mRAM.mBase);
+	int32_t offset = map::contains(abs_addr, mMap.mEXPANSION_2.mEnd, mMap.mEXPANSION_2.mBase);
 	if (offset != -1)
 	{
-		mRam.store8(offset, val);
-		return;
-	}
-	offset = map::contains(abs_addr, mMap.mEXPANSION_2.mEnd, mMap.mEXPANSION_2.mBase);
-	if (offset != -1)
-	{
-		println("Unhandled write to expansion 2 register {:08x}: {:02x}", abs_addr, val);
+		LOG_DEBUG(Bus, "Unhandled write to expansion 2 register {:08x}: {:02x}", abs_addr, val);
 		return;
 	}
 
@@ -363,6 +471,8 @@ void Bus::doDma(dma::Port port)
 	// process everything in one pass (i.e. no
 	// chopping or priority handling)
 
+	profiler::Scope scope(mProfiler, profiler::Dma);
+
 	switch (mDma.channel(port)->sync())
 	{
 	case dma::Sync::LinkedList:
@@ -392,18 +502,18 @@ void Bus::doDmaLinkedList(dma::Port port)
 		// In linked list mode, each entry starts with a "header"
 		// word. The high byte contains the number of words in the
 		// "packet" (not counting the header word)
-		auto header = mRam.load32(addr);
+		auto header = mRam.load<uint32_t>(addr);
 
 		auto remsz = header >> 24;
 
 		if (remsz > 0)
-			println("linked list packet size: {}", remsz);
+			LOG_TRACE(Dma, "linked list packet size: {}", remsz);
 
 		while (remsz > 0)
 		{
 			addr = (addr + 4) & 0x1ffffc;
 
-			auto command = mRam.load32(addr);
+			auto command = mRam.load<uint32_t>(addr);
 
 			mGpu.gp0(command);
 
@@ -417,7 +527,7 @@ void Bus::doDmaLinkedList(dma::Port port)
 		// that at some point...
 		if (header & 0x800000 != 0)
 		{
-			println("End of table");
+			LOG_TRACE(Dma, "End of table");
 			break;
 		}
 
@@ -467,7 +577,7 @@ void Bus::doDmaBlock(dma::Port port)
 
 		if (dir == dma::Direction::FromRam)
 		{
-			src_word = mRam.load32(cur_addr);
+			src_word = mRam.load<uint32_t>(cur_addr);
 
 			switch (port)
 			{
@@ -496,7 +606,8 @@ void Bus::doDmaBlock(dma::Port port)
 					panic("Unhandled DMA source port {}", (uint8_t)port);
 			};
 
-			mRam.store32(cur_addr, src_word);
+			mRam.store<uint32_t>(cur_addr, src_word);
+			mCpu.mBlockCache.invalidate(cur_addr);
 		}
 
 		addr += increment;
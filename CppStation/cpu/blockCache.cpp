@@ -0,0 +1,341 @@
+#include <cpu/blockCache.hpp>
+#include <cpu/cpu.hpp>
+#include <bus.hpp>
+
+namespace cpu {
+
+// Return true if `instruction` is a jump or a branch, i.e. if the
+// next instruction is in a delay slot.
+static bool isBranch(uint32_t instruction)
+{
+	switch (Instruction::function(instruction))
+	{
+	case 0b000000:
+		switch (Instruction::subfunction(instruction))
+		{
+		case 0b001000: // JR
+		case 0b001001: // JALR
+			return true;
+		default:
+			return false;
+		}
+	case 0b000001: // BGEZ, BLTZ, BGEZAL, BLTZAL
+	case 0b000010: // J
+	case 0b000011: // JAL
+	case 0b000100: // BEQ
+	case 0b000101: // BNE
+	case 0b000110: // BLEZ
+	case 0b000111: // BGTZ
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Registers read and written by an instruction allowed in an idle
+// loop. Returns false for anything else, including anything with a
+// side effect.
+static bool idleLoopRegisters(uint32_t instruction, uint32_t &reads, uint32_t &writes, bool &load)
+{
+	uint32_t s = 1 << Instruction::s(instruction).val;
+	uint32_t t = 1 << Instruction::t(instruction).val;
+	uint32_t d = 1 << Instruction::d(instruction).val;
+
+	load = false;
+
+	switch (Instruction::function(instruction))
+	{
+	case 0b000000:
+		switch (Instruction::subfunction(instruction))
+		{
+		case 0b000000: // SLL
+		case 0b000010: // SRL
+		case 0b000011: // SRA
+			reads = t;
+			writes = d;
+			return true;
+		case 0b000100: // SLLV
+		case 0b000110: // SRLV
+		case 0b000111: // SRAV
+		case 0b100001: // ADDU
+		case 0b100011: // SUBU
+		case 0b100100: // AND
+		case 0b100101: // OR
+		case 0b100110: // XOR
+		case 0b100111: // NOR
+		case 0b101010: // SLT
+		case 0b101011: // SLTU
+			reads = s | t;
+			writes = d;
+			return true;
+		case 0b010000: // MFHI
+		case 0b010010: // MFLO
+			reads = 0;
+			writes = d;
+			return true;
+		default:
+			return false;
+		}
+	case 0b001001: // ADDIU
+	case 0b001010: // SLTI
+	case 0b001011: // SLTIU
+	case 0b001100: // ANDI
+	case 0b001101: // ORI
+	case 0b001110: // XORI
+		reads = s;
+		writes = t;
+		return true;
+	case 0b001111: // LUI
+		reads = 0;
+		writes = t;
+		return true;
+	case 0b100000: // LB
+	case 0b100001: // LH
+	case 0b100011: // LW
+	case 0b100100: // LBU
+	case 0b100101: // LHU
+		reads = s;
+		writes = t;
+		load = true;
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Return true if `block`, starting at `pc`, is an idle loop: it ends
+// with a branch back to its start (without link) and its body only
+// computes registers from loads and from registers it doesn't modify.
+// Nothing is carried over from one iteration to the next, so the
+// iterations can only differ if the memory they read changes.
+static bool isIdleLoop(const Block *block, uint32_t pc)
+{
+	size_t len = block->mOps.size();
+	if (len < 2)
+		return false;
+
+	uint32_t branchPc = pc + 4 * (len - 2);
+	uint32_t branch = block->mOps[len - 2].instruction;
+	uint32_t target;
+	uint32_t branchReads;
+
+	switch (Instruction::function(branch))
+	{
+	case 0b000001: // BLTZ, BGEZ
+		if (Instruction::t(branch).val > 1)
+			return false;
+		// Fallthrough
+	case 0b000110: // BLEZ
+	case 0b000111: // BGTZ
+		target = branchPc + 4 + (Instruction::imm_se(branch) << 2);
+		branchReads = 1 << Instruction::s(branch).val;
+		break;
+	case 0b000100: // BEQ
+	case 0b000101: // BNE
+		target = branchPc + 4 + (Instruction::imm_se(branch) << 2);
+		branchReads = (1 << Instruction::s(branch).val) | (1 << Instruction::t(branch).val);
+		break;
+	case 0b000010: // J
+		target = ((branchPc + 4) & 0xf0000000) | (Instruction::imm_jump(branch) << 2);
+		branchReads = 0;
+		break;
+	default:
+		return false;
+	}
+
+	if (target != pc)
+		return false;
+
+	uint32_t reads[BLOCK_MAX_LEN];
+	uint32_t writes[BLOCK_MAX_LEN];
+	bool loads[BLOCK_MAX_LEN];
+	uint32_t modified = 0;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		if (i == len - 2)
+		{
+			reads[i] = branchReads;
+			writes[i] = 0;
+			loads[i] = false;
+		}
+		else if (!idleLoopRegisters(block->mOps[i].instruction, reads[i], writes[i], loads[i]))
+			return false;
+
+		modified |= writes[i];
+	}
+
+	// R0 is always 0
+	modified &= ~1u;
+
+	// Every register the loop modifies must be written before it's
+	// read in the same iteration. Loads only land after their delay
+	// slot.
+	uint32_t defined = 0;
+	uint32_t landing = 0;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		if ((reads[i] & modified & ~defined) != 0)
+			return false;
+
+		defined |= landing;
+		landing = 0;
+
+		if (loads[i])
+			landing = writes[i];
+		else
+			defined |= writes[i];
+	}
+
+	return true;
+}
+
+BlockCache::BlockCache() :
+	mCompiled(0),
+	mInvalidated(0),
+	mRamBlocks(ram::RAM_SIZE / 4, nullptr),
+	mBiosBlocks(bios::BIOS_SIZE / 4, nullptr)
+{
+	memset(mRamCodePages, 0, sizeof(mRamCodePages));
+}
+
+BlockCache::~BlockCache()
+{
+	clear();
+}
+
+Block **BlockCache::slot(uint32_t addr)
+{
+	int32_t offset = map::contains(addr, mMap.mRAM.mEnd, mMap.mRAM.mBase);
+	if (offset != -1)
+		return &mRamBlocks[offset >> 2];
+
+	offset = map::contains(addr, mMap.mBIOS.mEnd, mMap.mBIOS.mBase);
+	if (offset != -1)
+		return &mBiosBlocks[offset >> 2];
+
+	return nullptr;
+}
+
+Block *BlockCache::get(uint32_t pc, bus::Bus *bus)
+{
+	for (Block *block : mGraveyard)
+		delete block;
+	mGraveyard.clear();
+
+	uint32_t addr = map::maskRegion(pc);
+	Block **s = slot(addr);
+	if (!s)
+		return nullptr;
+
+	if (!*s)
+		*s = compile(pc, addr, bus);
+
+	return *s;
+}
+
+Block *BlockCache::compile(uint32_t pc, uint32_t addr, bus::Bus *bus)
+{
+	Block *block = new Block();
+	block->mAddr = addr;
+	block->mValid = true;
+	block->mCode = nullptr;
+	block->mIdleLoop = false;
+
+	// Don't let the block run past the end of the region it starts in
+	uint32_t end = (addr < mMap.mRAM.mEnd) ? mMap.mRAM.mEnd : mMap.mBIOS.mEnd;
+	bool delaySlot = false;
+
+	while (block->mOps.size() < BLOCK_MAX_LEN && addr + 4 * block->mOps.size() < end)
+	{
+		uint32_t instruction = bus->load<uint32_t>(pc + 4 * block->mOps.size());
+
+		block->mOps.push_back({Cpu::decode(instruction), instruction});
+
+		// The block ends with the delay slot of the first branch
+		if (delaySlot)
+			break;
+
+		delaySlot = isBranch(instruction);
+	}
+
+	block->mIdleLoop = isIdleLoop(block, pc);
+
+	if (addr < mMap.mRAM.mEnd)
+	{
+		uint32_t last = addr + 4 * (block->mOps.size() - 1);
+		for (uint32_t page = addr >> BLOCK_PAGE_SHIFT; page <= (last >> BLOCK_PAGE_SHIFT); page++)
+		{
+			mRamPages[page].push_back(block);
+			mRamCodePages[page] = 1;
+		}
+	}
+
+	mCompiled++;
+
+	return block;
+}
+
+void BlockCache::invalidatePage(uint32_t page)
+{
+	// Move the list out first: removing a block from the pages it
+	// spans would otherwise modify the list we iterate on
+	std::vector<Block *> blocks;
+	blocks.swap(mRamPages[page]);
+	mRamCodePages[page] = 0;
+
+	for (Block *block : blocks)
+	{
+		if (!block->mValid)
+			continue;
+
+		block->mValid = false;
+		*slot(block->mAddr) = nullptr;
+
+		uint32_t last = block->mAddr + 4 * (block->mOps.size() - 1);
+		for (uint32_t p = block->mAddr >> BLOCK_PAGE_SHIFT; p <= (last >> BLOCK_PAGE_SHIFT); p++)
+		{
+			auto &list = mRamPages[p];
+			for (size_t i = 0; i < list.size(); i++)
+			{
+				if (list[i] == block)
+				{
+					list[i] = list.back();
+					list.pop_back();
+					if (list.empty())
+						mRamCodePages[p] = 0;
+					break;
+				}
+			}
+		}
+
+		mGraveyard.push_back(block);
+		mInvalidated++;
+	}
+}
+
+void BlockCache::clear()
+{
+	for (Block *&block : mRamBlocks)
+	{
+		delete block;
+		block = nullptr;
+	}
+
+	for (Block *&block : mBiosBlocks)
+	{
+		delete block;
+		block = nullptr;
+	}
+
+	for (auto &list : mRamPages)
+		list.clear();
+	memset(mRamCodePages, 0, sizeof(mRamCodePages));
+
+	for (Block *block : mGraveyard)
+		delete block;
+	mGraveyard.clear();
+}
+
+} // namespace cpu
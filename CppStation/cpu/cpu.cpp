@@ -1,6 +1,8 @@
 #include <cpu/cpu.hpp>
 #include <bus.hpp>
 #include <limits.h>
+#include <algorithm>
+#include <array>
 
 inline static constexpr bool AddOverflow(uint32_t old_value, uint32_t add_value, uint32_t new_value)
 {
@@ -21,23 +23,34 @@ Cpu::Cpu() :
 	mCurrentPc(0),
 	mLoadRegIdx({0}),
 	mLoadReg(0),
+	mPendingLoadRegIdx({0}),
+	mPendingLoadReg(0),
 	mSr(0),
 	mCause(0),
 	mEpc(0),
 	mHi(0xdeadc0de),
 	mLo(0xdeadc0de),
 	mBranch(false),
-	mDelaySlot(false)
-{
+	mDelaySlot(false),
+	mCycles(0),
+	mMultDivDone(0),
+	mGteDone(0),
+	mInstructionCycles(1),
+	mExecutionMode(ExecutionMode::Interpreter),
+	mIdleSkipping(true),
+	mIdleBlock(nullptr),
+	mIdleLoopsSkipped(0),
+	mIdleCyclesSkipped(0)
+{
+	memset(mLoadDelay, 0, sizeof(mLoadDelay));
+
 	mLoadRegIdx.val = 0;
 	for (int i = 1; i < 32; i++)
 	{
 		mRegs[i] = 0xdeadc0de;
-		mOutRegs[i] = mRegs[i];
 	}
 
 	mRegs[0] = 0;
-	mOutRegs[0] = 0;
 }
 
 Cpu::~Cpu()
@@ -51,276 +64,280 @@ uint32_t Cpu::reg(RegisterIndex index)
 
 void Cpu::setReg(RegisterIndex index, uint32_t val)
 {
-	mOutRegs[index.val] = val;
+	mRegs[index.val] = val;
 	// R0 is always set to 0
-	mOutRegs[0] = 0;
+	mRegs[0] = 0;
+
+	// The instruction's own write takes precedence over the load
+	// initiated by the previous instruction
+	if (mPendingLoadRegIdx.val == index.val)
+		mPendingLoadRegIdx.val = 0;
 }
 
-uint32_t Cpu::load32(uint32_t addr)
+uint32_t Cpu::regWithPendingLoad(RegisterIndex index)
 {
-	return mBus->load32(addr);
+	if (index.val != 0 && mPendingLoadRegIdx.val == index.val)
+		return mPendingLoadReg;
+
+	return mRegs[index.val];
 }
 
-void Cpu::store32(uint32_t addr, uint32_t val)
+template<typename T>
+T Cpu::load(uint32_t addr)
 {
-	if ((mSr & 0x10000) != 0) {
-		// Cache is isolated, ignore write
-		println("Ignoring store while cache is isolated");
-		return;
-	}
+	mCycles += loadDelay(addr, sizeof(T));
+
+	if (mLockstep.active())
+		return mLockstep.load(this, addr, sizeof(T));
 
-	mBus->store32(addr, val);
+	return loadDirect<T>(addr);
 }
 
-uint16_t Cpu::load16(uint32_t addr)
+uint32_t Cpu::loadDelay(uint32_t addr, uint8_t width)
 {
-	return mBus->load16(addr);
+	if (scratchpad::contains(addr))
+		return 0;
+
+	uint32_t abs_addr = map::maskRegion(addr);
+	uint32_t zone = delayZone(abs_addr);
+
+	// The I/O registers (and KSEG2) need a finer lookup
+	if (zone == IO_DELAY_ZONE || abs_addr >= map::PHYSICAL_SIZE)
+		return mBus->ioLoadDelay(abs_addr, width);
+
+	return mLoadDelay[width >> 1][zone];
 }
 
-void Cpu::store16(uint32_t addr, uint16_t val)
+void Cpu::startMultDiv(uint32_t cycles)
 {
-	if ((mSr & 0x10000) != 0) {
-		// Cache is isolated, ignore write
-		println("Ignoring store while cache is isolated");
-		return;
-	}
-
-	mBus->store16(addr, val);
+	// A new operation waits for the previous one to complete
+	waitMultDiv();
+	mMultDivDone = mCycles + cycles;
 }
 
-uint8_t Cpu::load8(uint32_t addr)
+template<typename T>
+T Cpu::loadDirect(uint32_t addr)
 {
-	return mBus->load8(addr);
+	if (scratchpad::contains(addr))
+		return mScratchpad.load<T>(addr);
+
+	return mBus->load<T>(addr);
 }
 
-void Cpu::store8(uint32_t addr, uint8_t val)
+// The lockstep checker makes the loads of the recompiled code
+template uint32_t Cpu::loadDirect<uint32_t>(uint32_t addr);
+template uint16_t Cpu::loadDirect<uint16_t>(uint32_t addr);
+template uint8_t Cpu::loadDirect<uint8_t>(uint32_t addr);
+
+template<typename T>
+void Cpu::store(uint32_t addr, T val)
 {
+	// Cache is isolated, the store goes to the instruction cache. The
+	// BIOS does this once per line to flush it, keep it cheap.
 	if ((mSr & 0x10000) != 0)
 	{
-		// Cache is isolated, ignore write
-		println("Ignoring store while cache is isolated");
+		mICache.isolatedStore(addr);
+		return;
+	}
+
+	if (mLockstep.active() && !mLockstep.store(addr, val, sizeof(T)))
+		return;
+
+	if (scratchpad::contains(addr))
+	{
+		mScratchpad.store<T>(addr, val);
 		return;
 	}
-	mBus->store8(addr, val);
+
+	mBus->store<T>(addr, val);
+}
+
+// Opcodes are dispatched through 64-entry tables (32 for the 5 bit
+// REGIMM and COP0 fields) built at compile time, unknown opcodes map to
+// opIllegal.
+typedef std::array<OpHandler, 64> OpTable;
+typedef std::array<OpHandler, 32> SubOpTable;
+
+template<typename Table>
+static constexpr Table makeTable(OpHandler fallback)
+{
+	Table t{};
+
+	for (auto &handler : t)
+		handler = fallback;
+
+	return t;
+}
+
+// Indexed by bits [31:26]
+static constexpr OpTable makePrimaryTable()
+{
+	OpTable t = makeTable<OpTable>(&Cpu::opIllegal);
+
+	t[0b000000] = &Cpu::opSpecial;
+	t[0b000001] = &Cpu::opBxx;
+	t[0b000010] = &Cpu::opJ;
+	t[0b000011] = &Cpu::opJal;
+	t[0b000100] = &Cpu::opBeq;
+	t[0b000101] = &Cpu::opBne;
+	t[0b000110] = &Cpu::opBlez;
+	t[0b000111] = &Cpu::opBgtz;
+	t[0b001000] = &Cpu::opAddi;
+	t[0b001001] = &Cpu::opAddiu;
+	t[0b001010] = &Cpu::opSlti;
+	t[0b001011] = &Cpu::opSltiu;
+	t[0b001100] = &Cpu::opAndi;
+	t[0b001101] = &Cpu::opOri;
+	t[0b001110] = &Cpu::opXori;
+	t[0b001111] = &Cpu::opLui;
+	t[0b010000] = &Cpu::opCop0;
+	t[0b010001] = &Cpu::opCop1;
+	t[0b010010] = &Cpu::opCop2;
+	t[0b010011] = &Cpu::opCop3;
+	t[0b100000] = &Cpu::opLb;
+	t[0b100001] = &Cpu::opLh;
+	t[0b100010] = &Cpu::opLwl;
+	t[0b100011] = &Cpu::opLw;
+	t[0b100100] = &Cpu::opLbu;
+	t[0b100101] = &Cpu::opLhu;
+	t[0b100110] = &Cpu::opLwr;
+	t[0b101000] = &Cpu::opSb;
+	t[0b101001] = &Cpu::opSh;
+	t[0b101010] = &Cpu::opSwl;
+	t[0b101011] = &Cpu::opSw;
+	t[0b101110] = &Cpu::opSwr;
+	t[0b110000] = &Cpu::opLwc0;
+	t[0b110001] = &Cpu::opLwc1;
+	t[0b110010] = &Cpu::opLwc2;
+	t[0b110011] = &Cpu::opLwc3;
+	t[0b111000] = &Cpu::opSwc0;
+	t[0b111001] = &Cpu::opSwc1;
+	t[0b111010] = &Cpu::opSwc2;
+	t[0b111011] = &Cpu::opSwc3;
+
+	return t;
+}
+
+// SPECIAL opcodes, indexed by bits [5:0]
+static constexpr OpTable makeSpecialTable()
+{
+	OpTable t = makeTable<OpTable>(&Cpu::opIllegal);
+
+	t[0b000000] = &Cpu::opSll;
+	t[0b000010] = &Cpu::opSrl;
+	t[0b000011] = &Cpu::opSra;
+	t[0b000100] = &Cpu::opSllv;
+	t[0b000110] = &Cpu::opSrlv;
+	t[0b000111] = &Cpu::opSrav;
+	t[0b001000] = &Cpu::opJr;
+	t[0b001001] = &Cpu::opJalr;
+	t[0b001100] = &Cpu::opSyscall;
+	t[0b001101] = &Cpu::opBreak;
+	t[0b010000] = &Cpu::opMfhi;
+	t[0b010001] = &Cpu::opMthi;
+	t[0b010010] = &Cpu::opMflo;
+	t[0b010011] = &Cpu::opMtlo;
+	t[0b011000] = &Cpu::opMult;
+	t[0b011001] = &Cpu::opMultu;
+	t[0b011010] = &Cpu::opDiv;
+	t[0b011011] = &Cpu::opDivu;
+	t[0b100000] = &Cpu::opAdd;
+	t[0b100001] = &Cpu::opAddu;
+	t[0b100010] = &Cpu::opSub;
+	t[0b100011] = &Cpu::opSubu;
+	t[0b100100] = &Cpu::opAnd;
+	t[0b100101] = &Cpu::opOr;
+	t[0b100110] = &Cpu::opXor;
+	t[0b100111] = &Cpu::opNor;
+	t[0b101010] = &Cpu::opSlt;
+	t[0b101011] = &Cpu::opSltu;
+
+	return t;
+}
+
+// REGIMM opcodes, indexed by bits [20:16]. Only bit 16 (BGEZ/BLTZ) is
+// decoded, the link variants need bits [20:17] to be 0b1000.
+static constexpr SubOpTable makeRegimmTable()
+{
+	SubOpTable t{};
+
+	for (uint32_t i = 0; i < 32; i++)
+	{
+		bool is_bgez = i & 1;
+		bool is_link = (i >> 1) == 8;
+
+		if (is_link)
+			t[i] = is_bgez ? &Cpu::opBgezal : &Cpu::opBltzal;
+		else
+			t[i] = is_bgez ? &Cpu::opBgez : &Cpu::opBltz;
+	}
+
+	return t;
 }
 
-void Cpu::decodeAndExecute(uint32_t instruction)
+// COP0 opcodes, indexed by bits [25:21]
+static constexpr SubOpTable makeCop0Table()
+{
+	SubOpTable t = makeTable<SubOpTable>(&Cpu::opCop0Unhandled);
+
+	t[0b00000] = &Cpu::opMfc0;
+	t[0b00100] = &Cpu::opMtc0;
+	t[0b10000] = &Cpu::opRfe;
+
+	return t;
+}
+
+// COP2 opcodes, indexed by bits [25:21]. Bit 25 set means a GTE
+// command.
+static constexpr SubOpTable makeCop2Table()
 {
+	SubOpTable t = makeTable<SubOpTable>(&Cpu::opCop2Unhandled);
+
+	t[0b00000] = &Cpu::opMfc2;
+	t[0b00010] = &Cpu::opCfc2;
+	t[0b00100] = &Cpu::opMtc2;
+	t[0b00110] = &Cpu::opCtc2;
+	for (uint32_t i = 0b10000; i < 32; i++)
+		t[i] = &Cpu::opGteCommand;
+
+	return t;
+}
+
+static constexpr OpTable PRIMARY_TABLE = makePrimaryTable();
+static constexpr OpTable SPECIAL_TABLE = makeSpecialTable();
+static constexpr SubOpTable REGIMM_TABLE = makeRegimmTable();
+static constexpr SubOpTable COP0_TABLE = makeCop0Table();
+static constexpr SubOpTable COP2_TABLE = makeCop2Table();
+
+OpHandler Cpu::decode(uint32_t instruction)
+{
+	// The secondary tables are looked up right away so that
+	// pre-decoded instructions don't have to go through them again
 	switch (Instruction::function(instruction))
 	{
 	case 0b000000:
-		switch (Instruction::subfunction(instruction))
-		{
-		case 0b000000:
-			opSll(instruction);
-			break;
-		case 0b100101:
-			opOr(instruction);
-			break;
-		case 0b101011:
-			opSltu(instruction);
-			break;
-		case 0b100001:
-			opAddu(instruction);
-			break;
-		case 0b001000:
-			opJr(instruction);
-			break;
-		case 0b100100:
-			opAnd(instruction);
-			break;
-		case 0b100000:
-			opAdd(instruction);
-			break;
-		case 0b001001:
-			opJalr(instruction);
-			break;
-		case 0b100011:
-			opSubu(instruction);
-			break;
-		case 0b000011:
-			opSra(instruction);
-			break;
-		case 0b011010:
-			opDiv(instruction);
-			break;
-		case 0b010010:
-			opMflo(instruction);
-			break;
-		case 0b000010:
-			opSrl(instruction);
-			break;
-		case 0b011011:
-			opDivu(instruction);
-			break;
-		case 0b010000:
-			opMfhi(instruction);
-			break;
-		case 0b101010:
-			opSlt(instruction);
-			break;
-		case 0b001100:
-			opSyscall(instruction);
-			break;
-		case 0b010001:
-			opMthi(instruction);
-			break;
-		case 0b010011:
-			opMtlo(instruction);
-			break;
-		case 0b000100:
-			opSllv(instruction);
-			break;
-		case 0b100111:
-			opNor(instruction);
-			break;
-		case 0b000111:
-			opSrav(instruction);
-			break;
-		case 0b000110:
-			opSrlv(instruction);
-			break;
-		case 0b011001:
-			opMultu(instruction);
-			break;
-		case 0b100110:
-			opXor(instruction);
-			break;
-		case 0b001101:
-			opBreak(instruction);
-			break;
-		case 0b011000:
-			opMult(instruction);
-			break;
-		case 0b100010:
-			opSub(instruction);
-			break;
-		default:
-			opIllegal(instruction);
-		}
-		break;
-	case 0b001111:
-		opLui(instruction);
-		break;
-	case 0b001101:
-		opOri(instruction);
-		break;
-	case 0b101011:
-		opSw(instruction);
-		break;
-	case 0b001001:
-		opAddiu(instruction);
-		break;
-	case 0b000010:
-		opJ(instruction);
-		break;
-	case 0b010000:
-		opCop0(instruction);
-		break;
-	case 0b000101:
-		opBne(instruction);
-		break;
-	case 0b001000:
-		opAddi(instruction);
-		break;
-	case 0b100011:
-		opLw(instruction);
-		break;
-	case 0b101001:
-		opSh(instruction);
-		break;
-	case 0b000011:
-		opJal(instruction);
-		break;
-	case 0b001100:
-		opAndi(instruction);
-		break;
-	case 0b101000:
-		opSb(instruction);
-		break;
-	case 0b100000:
-		opLb(instruction);
-		break;
-	case 0b000100:
-		opBeq(instruction);
-		break;
-	case 0b000110:
-		opBlez(instruction);
-		break;
-	case 0b000111:
-		opBgtz(instruction);
-		break;
-	case 0b100100:
-		opLbu(instruction);
-		break;
+		return SPECIAL_TABLE[Instruction::subfunction(instruction)];
 	case 0b000001:
-		opBxx(instruction);
-		break;
-	case 0b001010:
-		opSlti(instruction);
-		break;
-	case 0b001011:
-		opSltiu(instruction);
-		break;
-	case 0b100101:
-		opLhu(instruction);
-		break;
-	case 0b100001:
-		opLh(instruction);
-		break;
-	case 0b001110:
-		opXori(instruction);
-		break;
-	case 0b010001:
-		opCop1(instruction);
-		break;
+		return REGIMM_TABLE[Instruction::t(instruction).val];
+	case 0b010000:
+		return COP0_TABLE[Instruction::copOpcode(instruction)];
 	case 0b010010:
-		opCop2(instruction);
-		break;
-	case 0b010011:
-		opCop3(instruction);
-		break;
-	case 0b100010:
-		opLwl(instruction);
-		break;
-	case 0b100110:
-		opLwr(instruction);
-		break;
-	case 0b101010:
-		opSwl(instruction);
-		break;
-	case 0b101110:
-		opSwr(instruction);
-		break;
-	case 0b110000:
-		opLwc0(instruction);
-		break;
-	case 0b110001:
-		opLwc1(instruction);
-		break;
-	case 0b110010:
-		opLwc2(instruction);
-		break;
-	case 0b110011:
-		opLwc3(instruction);
-		break;
-	case 0b111000:
-		opSwc0(instruction);
-		break;
-	case 0b111001:
-		opSwc1(instruction);
-		break;
-	case 0b111010:
-		opSwc2(instruction);
-		break;
-	case 0b111011:
-		opSwc3(instruction);
-		break;
+		return COP2_TABLE[Instruction::copOpcode(instruction)];
 	default:
-		opIllegal(instruction);
+		return PRIMARY_TABLE[Instruction::function(instruction)];
 	}
 }
 
+void Cpu::opSpecial(uint32_t instruction)
+{
+	(this->*SPECIAL_TABLE[Instruction::subfunction(instruction)])(instruction);
+}
+
+void Cpu::decodeAndExecute(uint32_t instruction)
+{
+	(this->*decode(instruction))(instruction);
+}
+
 void Cpu::runNextInstruction()
 {
 	// Save the address of the current instruction to save in
@@ -334,13 +351,22 @@ void Cpu::runNextInstruction()
 		return;
 	}
 
-	// Fetch instruction at PC
-	uint32_t instruction = load32(mPc);
+	if (mHle.isEntry(mPc) && runHle())
+		return;
+
+	// Fetch instruction at PC. Its timing is part of the
+	// instruction's own.
+	uint32_t instruction = loadDirect<uint32_t>(mPc);
 #ifdef DEBUG
 	if (mIp >= 2695640)
-		println("{} instruction: {:08x} pc={:08x} mNextPc={:08x} mCurrentPc={:08x}", mIp, instruction, mPc, mNextPc, mCurrentPc);
+		LOG_TRACE(Cpu, "{} instruction: {:08x} pc={:08x} mNextPc={:08x} mCurrentPc={:08x}", mIp, instruction, mPc, mNextPc, mCurrentPc);
 #endif
 
+	executeInstruction(decode(instruction), instruction);
+}
+
+void Cpu::executeInstruction(OpHandler handler, uint32_t instruction)
+{
 	// Increment PC to point to the next instruction. and
 	// `next_pc` to the one after that. Both values can be
 	// modified by individual instructions (`next_pc` in case of a
@@ -348,13 +374,13 @@ void Cpu::runNextInstruction()
 	mPc		= mNextPc;
 	mNextPc	= mPc + 4;
 
-	// Execute the pending load (if any, otherwise it will load
-	// `R0` which is a NOP). `set_reg` works only on `out_regs`
-	// so this operation won't be visible by the next
-	// instruction.
-	RegisterIndex reg = mLoadRegIdx;
-	uint32_t val = mLoadReg;
-	setReg(reg, val);
+	mCycles += instructionCycles(mCurrentPc);
+
+	// The load initiated by the previous instruction (if any,
+	// otherwise it targets `R0` which is a NOP) must not be
+	// visible to this instruction, it's applied once it's done
+	mPendingLoadRegIdx = mLoadRegIdx;
+	mPendingLoadReg = mLoadReg;
 
 	// We reset the load to target register 0 for the next
 	// instruction
@@ -366,15 +392,265 @@ void Cpu::runNextInstruction()
 	mDelaySlot    = mBranch;
 	mBranch       = false;
 
-	decodeAndExecute(instruction);
+	(this->*handler)(instruction);
+
+	// Now the pending load can land
+	mRegs[mPendingLoadRegIdx.val] = mPendingLoadReg;
+	mRegs[0] = 0;
+	mPendingLoadRegIdx.val = 0;
+	mIp++;
+}
+
+uint32_t Cpu::runNextBlock(uint64_t end)
+{
+	Block *block = nullptr;
 
-	// Copy the output registers as input for the
-	// next instruction
-	for (int i = 0; i < 32; i++)
+	// Kernel calls jump to the start of a block
+	if (mHle.isEntry(mPc) && runHle())
+		return 0;
+
+	if (mPc % 4 == 0)
+		block = mBlockCache.get(mPc, mBus);
+
+	if (!block)
 	{
-		mRegs[i] = mOutRegs[i];
+		// Not cacheable (or misaligned PC), let the interpreter
+		// deal with it
+		runNextInstruction();
+		return 1;
 	}
-	mIp++;
+
+	uint32_t pc = mPc;
+	uint64_t startCycles = mCycles;
+	uint32_t executed = 0;
+
+	for (const CachedInstruction &op : block->mOps)
+	{
+		mCurrentPc = mPc;
+
+		executeInstruction(op.handler, op.instruction);
+		executed++;
+
+		// Branches only modify `mNextPc` and the block ends with
+		// the delay slot, so if `mPc` isn't sequential anymore
+		// we've taken an exception. We also have to stop if the
+		// block has just overwritten its own code.
+		if (mPc != mCurrentPc + 4 || !block->mValid)
+			break;
+	}
+
+	checkIdleLoop(block, pc, startCycles, executed, end);
+
+	return executed;
+}
+
+uint32_t Cpu::runRecompiledBlock(bool lockstep, uint64_t end)
+{
+	Block *block = nullptr;
+
+	if (mHle.isEntry(mPc) && runHle())
+		return 0;
+
+	if (mPc % 4 == 0)
+		block = mBlockCache.get(mPc, mBus);
+
+	if (!block)
+	{
+		runNextInstruction();
+		return 1;
+	}
+
+	if (!block->mCode && !mRecompiler.compile(*this, block))
+	{
+		// Code buffer is full, start over from scratch. This drops
+		// `block` so we interpret it this time around.
+		mBlockCache.clear();
+		mRecompiler.reset();
+		return runNextBlock(end);
+	}
+
+	// Same timing for the whole block, it can't cross regions
+	mInstructionCycles = instructionCycles(mPc);
+
+	uint32_t pc = mPc;
+	uint64_t startCycles = mCycles;
+	uint32_t executed;
+
+	if (lockstep)
+		executed = mLockstep.run(*this, block);
+	else
+		executed = mRecompiler.run(*this, block);
+
+	checkIdleLoop(block, pc, startCycles, executed, end);
+
+	return executed;
+}
+
+void Cpu::checkIdleLoop(Block *block, uint32_t pc, uint64_t startCycles, uint32_t executed, uint64_t end)
+{
+	// Only complete iterations branching back to the start count
+	if (!block->mIdleLoop || executed != block->mOps.size() || mPc != pc)
+	{
+		mIdleBlock = nullptr;
+		return;
+	}
+
+	// The first iteration can depend on the state the loop was
+	// entered with, the following ones are all identical
+	if (mIdleBlock != block)
+	{
+		mIdleBlock = block;
+		return;
+	}
+
+	// Not past the end of the slice either, the caller expects to
+	// get control back there
+	uint64_t limit = std::min(end, mBus->mScheduler.nextDeadline());
+	if (!mIdleSkipping || limit <= mCycles)
+		return;
+
+	// Nothing the loop reads can change before the next event, run
+	// the iterations that fit in the meantime all at once
+	uint64_t iterationCycles = mCycles - startCycles;
+	uint64_t iterations = (limit - mCycles) / iterationCycles;
+
+	mCycles += iterations * iterationCycles;
+	mIp += iterations * executed;
+	mIdleLoopsSkipped++;
+	mIdleCyclesSkipped += iterations * iterationCycles;
+}
+
+bool Cpu::runHle()
+{
+	// Only a call, the entry point can't be in a delay slot
+	if (mNextPc != mPc + 4)
+		return false;
+
+	// The load started in the delay slot of the call (often an
+	// argument) lands before the kernel reads the registers. The
+	// entry point code doesn't use them so this doesn't change
+	// anything if the BIOS runs the call after all.
+	mRegs[mLoadRegIdx.val] = mLoadReg;
+	mRegs[0] = 0;
+	mLoadRegIdx.val = 0;
+	mLoadReg = 0;
+
+	uint32_t ret;
+	uint64_t cycles;
+
+	if (!mHle.call(*this, mPc, ret, cycles))
+		return false;
+
+	// Return to the caller like the BIOS' `jr ra`
+	mRegs[2] = ret;
+	mPc = mRegs[31];
+	mNextPc = mPc + 4;
+	mDelaySlot = false;
+	mBranch = false;
+
+	return true;
+}
+
+void Cpu::run(uint64_t cycles)
+{
+	uint64_t end = mCycles + cycles;
+
+	// Events may have run since the last time, the next iteration
+	// of an idle loop has to be checked again
+	mIdleBlock = nullptr;
+
+	switch (mExecutionMode)
+	{
+	case ExecutionMode::Interpreter:
+		while (mCycles < end)
+			runNextInstruction();
+		break;
+	case ExecutionMode::ThreadedInterpreter:
+		runThreaded(cycles);
+		break;
+	case ExecutionMode::CachedInterpreter:
+		while (mCycles < end)
+			runNextBlock(end);
+		break;
+	case ExecutionMode::Recompiler:
+		while (mCycles < end)
+			runRecompiledBlock(false, end);
+		break;
+	case ExecutionMode::RecompilerLockstep:
+		while (mCycles < end)
+			runRecompiledBlock(true, end);
+		break;
+	}
+}
+
+void Cpu::runThreaded(uint64_t cycles)
+{
+	uint64_t end = mCycles + cycles;
+
+#ifdef CPU_COMPUTED_GOTO
+	// One label per primary opcode, each ending with its own
+	// indirect jump to the next instruction. This gives the host
+	// branch predictor a separate history per opcode instead of a
+	// single, mostly unpredictable, dispatch jump.
+	static void *const labels[64] = {
+		&&op0, &&op1, &&op2, &&op3, &&op4, &&op5, &&op6, &&op7,
+		&&op8, &&op9, &&op10, &&op11, &&op12, &&op13, &&op14, &&op15,
+		&&op16, &&op17, &&op18, &&op19, &&op20, &&op21, &&op22, &&op23,
+		&&op24, &&op25, &&op26, &&op27, &&op28, &&op29, &&op30, &&op31,
+		&&op32, &&op33, &&op34, &&op35, &&op36, &&op37, &&op38, &&op39,
+		&&op40, &&op41, &&op42, &&op43, &&op44, &&op45, &&op46, &&op47,
+		&&op48, &&op49, &&op50, &&op51, &&op52, &&op53, &&op54, &&op55,
+		&&op56, &&op57, &&op58, &&op59, &&op60, &&op61, &&op62, &&op63
+	};
+
+	uint32_t instruction;
+
+#define DISPATCH()												\
+	do {														\
+		if (mCycles >= end)										\
+			return;												\
+		mCurrentPc = mPc;										\
+		if (mCurrentPc % 4 != 0)								\
+			goto misaligned;									\
+		if (mHle.isEntry(mCurrentPc))							\
+			goto hle;											\
+		instruction = loadDirect<uint32_t>(mPc);				\
+		goto *labels[Instruction::function(instruction)];		\
+	} while (0)
+
+#define OPCODE(n)												\
+	op##n:														\
+		executeInstruction(PRIMARY_TABLE[n], instruction);		\
+		DISPATCH();
+
+	DISPATCH();
+
+	OPCODE(0) OPCODE(1) OPCODE(2) OPCODE(3) OPCODE(4) OPCODE(5) OPCODE(6) OPCODE(7)
+	OPCODE(8) OPCODE(9) OPCODE(10) OPCODE(11) OPCODE(12) OPCODE(13) OPCODE(14) OPCODE(15)
+	OPCODE(16) OPCODE(17) OPCODE(18) OPCODE(19) OPCODE(20) OPCODE(21) OPCODE(22) OPCODE(23)
+	OPCODE(24) OPCODE(25) OPCODE(26) OPCODE(27) OPCODE(28) OPCODE(29) OPCODE(30) OPCODE(31)
+	OPCODE(32) OPCODE(33) OPCODE(34) OPCODE(35) OPCODE(36) OPCODE(37) OPCODE(38) OPCODE(39)
+	OPCODE(40) OPCODE(41) OPCODE(42) OPCODE(43) OPCODE(44) OPCODE(45) OPCODE(46) OPCODE(47)
+	OPCODE(48) OPCODE(49) OPCODE(50) OPCODE(51) OPCODE(52) OPCODE(53) OPCODE(54) OPCODE(55)
+	OPCODE(56) OPCODE(57) OPCODE(58) OPCODE(59) OPCODE(60) OPCODE(61) OPCODE(62) OPCODE(63)
+
+misaligned:
+	// PC is not correctly aligned!
+	exception(exception::LoadAddressError);
+	DISPATCH();
+
+hle:
+	if (runHle())
+		DISPATCH();
+	instruction = loadDirect<uint32_t>(mPc);
+	goto *labels[Instruction::function(instruction)];
+
+#undef OPCODE
+#undef DISPATCH
+#else
+	while (mCycles < end)
+		runNextInstruction();
+#endif
 }
 
 void Cpu::exception(enum exception::Exception cause)
@@ -445,12 +721,6 @@ void Cpu::opOri(uint32_t instruction)
 
 void Cpu::opSw(uint32_t instruction)
 {
-	if ((mSr & 0x10000) != 0) {
-		// Cache is isolated, ignore write
-		println("Ignoring store while cache is isolated");
-		return;
-	}
-
 	auto i = Instruction::imm_se(instruction);
 	auto t = Instruction::t(instruction);
 	auto s = Instruction::s(instruction);
@@ -460,7 +730,7 @@ void Cpu::opSw(uint32_t instruction)
 
 	// Address must be 32bit aligned
 	if (addr % 4 == 0)
-		store32(addr, v);
+		store<uint32_t>(addr, v);
 	else
 		exception(exception::StoreAddressError);
 }
@@ -508,19 +778,12 @@ void Cpu::opOr(uint32_t instruction)
 
 void Cpu::opCop0(uint32_t instruction)
 {
-	switch (Instruction::copOpcode(instruction)) {
-	case 0b00000:
-		opMfc0(instruction);
-		break;
-	case 0b00100:
-		opMtc0(instruction);
-		break;
-	case 0b10000:
-		opRfe(instruction);
-		break;
-	default:
-		panic("unhandled cop0 instruction {:08x}", instruction);
-	}
+	(this->*COP0_TABLE[Instruction::copOpcode(instruction)])(instruction);
+}
+
+void Cpu::opCop0Unhandled(uint32_t instruction)
+{
+	panic("unhandled cop0 instruction {:08x}", instruction);
 }
 
 void Cpu::opMtc0(uint32_t instruction)
@@ -596,7 +859,7 @@ void Cpu::opLw(uint32_t instruction) {
 	if ((mSr & 0x10000) != 0)
 	{
 		// Cache is isolated, ignore write
-		println("Ignoring load while cache is isolated");
+		LOG_TRACE(Cpu, "Ignoring load while cache is isolated");
 		return;
 	}
 
@@ -606,7 +869,7 @@ void Cpu::opLw(uint32_t instruction) {
 
 	uint32_t addr = reg(s) + i;
 
-	auto v = load32(addr);
+	auto v = load<uint32_t>(addr);
 
 	// Put the load in the delay slot
 	mLoadRegIdx.val = t.val;
@@ -646,7 +909,7 @@ void Cpu::opSh(uint32_t instruction)
 
 	// Address must be 16bit aligned
 	if (addr % 2 == 0)
-		store16(addr, v);
+		store<uint16_t>(addr, v);
 	else
 		exception(exception::StoreAddressError);
 }
@@ -685,7 +948,7 @@ void Cpu::opSb(uint32_t instruction)
 	uint32_t addr = reg(s) + i;
 	auto v = reg(t);
 
-	store8(addr, v);
+	store<uint8_t>(addr, v);
 }
 
 void Cpu::opJr(uint32_t instruction)
@@ -707,7 +970,7 @@ void Cpu::opLb(uint32_t instruction)
 	uint32_t addr = reg(s) + i;
 
 	// Cast as i8 to force sign extension
-	int8_t v = (int8_t)load8(addr);
+	int8_t v = (int8_t)load<uint8_t>(addr);
 
 	// Put the load in the delay slot
 	mLoadRegIdx.val = t.val;
@@ -809,7 +1072,7 @@ void Cpu::opLbu(uint32_t instruction) {
 
 	uint32_t addr = reg(s) + i;
 
-	auto v = load8(addr);
+	auto v = load<uint8_t>(addr);
 
 	// Put the load in the delay slot
 	mLoadRegIdx.val = t.val;
@@ -823,22 +1086,26 @@ void Cpu::opJalr(uint32_t instruction)
 
 	uint32_t ra = mNextPc;
 
+	// `s` must be read before `d` is written since they can be the
+	// same register
+	mNextPc = reg(s);
+
 	// Store return address in `d`
 	setReg(d, ra);
 
-	mNextPc = reg(s);
-
 	mBranch = true;
 }
 
 void Cpu::opBxx(uint32_t instruction)
+{
+	(this->*REGIMM_TABLE[Instruction::t(instruction).val])(instruction);
+}
+
+void Cpu::branchCompareZero(uint32_t instruction, bool is_bgez, bool is_link)
 {
 	auto i = Instruction::imm_se(instruction);
 	auto s = Instruction::s(instruction);
 
-	bool is_bgez = (instruction >> 16) & 1;
-	bool is_link = ((instruction >> 17) & 0xf) == 8;
-
 	int32_t v = reg(s);
 
 	// Test "less than zero"
@@ -861,6 +1128,26 @@ void Cpu::opBxx(uint32_t instruction)
 		branch(i);
 }
 
+void Cpu::opBltz(uint32_t instruction)
+{
+	branchCompareZero(instruction, false, false);
+}
+
+void Cpu::opBgez(uint32_t instruction)
+{
+	branchCompareZero(instruction, true, false);
+}
+
+void Cpu::opBltzal(uint32_t instruction)
+{
+	branchCompareZero(instruction, false, true);
+}
+
+void Cpu::opBgezal(uint32_t instruction)
+{
+	branchCompareZero(instruction, true, true);
+}
+
 void Cpu::opSlti(uint32_t instruction)
 {
 	int32_t i = Instruction::imm_se(instruction);
@@ -902,6 +1189,8 @@ void Cpu::opDiv(uint32_t instruction)
 	int32_t n = reg(s);
 	int32_t d = reg(t);
 
+	startMultDiv(DIV_CYCLES);
+
 	if (d == 0)
 	{
 		// Division by zero, results are bogus
@@ -926,6 +1215,7 @@ void Cpu::opMflo(uint32_t instruction)
 {
 	auto d = Instruction::d(instruction);
 
+	waitMultDiv();
 	setReg(d, mLo);
 }
 
@@ -960,6 +1250,8 @@ void Cpu::opDivu(uint32_t instruction)
 	auto n = reg(s);
 	auto d = reg(t);
 
+	startMultDiv(DIV_CYCLES);
+
 	if (d == 0)
 	{
 		// Division by zero, results are bogus
@@ -975,6 +1267,7 @@ void Cpu::opMfhi(uint32_t instruction)
 {
 	auto d = Instruction::d(instruction);
 
+	waitMultDiv();
 	setReg(d, mHi);
 }
 
@@ -1018,7 +1311,7 @@ void Cpu::opLhu(uint32_t instruction)
 	// Address must be 16bit aligned
 	if (addr % 2 == 0)
 	{
-		auto v = load16(addr);
+		auto v = load<uint16_t>(addr);
 
 		// Put the load in the delay slot
 		mLoadRegIdx.val = t.val;
@@ -1065,7 +1358,7 @@ void Cpu::opLh(uint32_t instruction)
 	uint32_t addr = reg(s) + i;
 
 	// Cast as i16 to force sign extension
-	int16_t v = (int16_t)load16(addr);
+	int16_t v = (int16_t)load<uint16_t>(addr);
 
 	// Put the load in the delay slot
 	mLoadRegIdx.val = t.val;
@@ -1115,6 +1408,15 @@ void Cpu::opMultu(uint32_t instruction)
 	uint64_t a = reg(s);
 	uint64_t b = reg(t);
 
+	// The multiplier is faster when the first operand has fewer
+	// significant bits
+	if (a < 0x800)
+		startMultDiv(MULT_CYCLES_SHORT);
+	else if (a < 0x100000)
+		startMultDiv(MULT_CYCLES_MEDIUM);
+	else
+		startMultDiv(MULT_CYCLES_LONG);
+
 	auto v = a * b;
 
 	mHi = (uint32_t)(v >> 32);
@@ -1145,6 +1447,15 @@ void Cpu::opMult(uint32_t instruction)
 	int64_t a = ((int32_t)reg(s));
 	int64_t b = ((int32_t)reg(t));
 
+	// Same thing as MULTU, ignoring the sign bits
+	uint32_t bits = a < 0 ? ~(uint32_t)a : (uint32_t)a;
+	if (bits < 0x800)
+		startMultDiv(MULT_CYCLES_SHORT);
+	else if (bits < 0x100000)
+		startMultDiv(MULT_CYCLES_MEDIUM);
+	else
+		startMultDiv(MULT_CYCLES_LONG);
+
 	uint64_t v = (uint64_t)(a * b);
 
 	mHi = (uint32_t)(v >> 32);
@@ -1186,7 +1497,60 @@ void Cpu::opCop1(uint32_t instruction)
 
 void Cpu::opCop2(uint32_t instruction)
 {
-	panic("unhandled GTE instruction: {}", instruction);
+	(this->*COP2_TABLE[Instruction::copOpcode(instruction)])(instruction);
+}
+
+void Cpu::opCop2Unhandled(uint32_t instruction)
+{
+	panic("unhandled cop2 instruction {:08x}", instruction);
+}
+
+void Cpu::opMfc2(uint32_t instruction)
+{
+	auto cpuR = Instruction::t(instruction);
+	auto copR = Instruction::d(instruction).val;
+
+	waitGte();
+
+	mLoadRegIdx.val = cpuR.val;
+	mLoadReg = mGte.data(copR);
+}
+
+void Cpu::opCfc2(uint32_t instruction)
+{
+	auto cpuR = Instruction::t(instruction);
+	auto copR = Instruction::d(instruction).val;
+
+	waitGte();
+
+	mLoadRegIdx.val = cpuR.val;
+	mLoadReg = mGte.control(copR);
+}
+
+void Cpu::opMtc2(uint32_t instruction)
+{
+	auto cpuR = Instruction::t(instruction);
+	auto copR = Instruction::d(instruction).val;
+
+	waitGte();
+	mGte.setData(copR, reg(cpuR));
+}
+
+void Cpu::opCtc2(uint32_t instruction)
+{
+	auto cpuR = Instruction::t(instruction);
+	auto copR = Instruction::d(instruction).val;
+
+	waitGte();
+	mGte.setControl(copR, reg(cpuR));
+}
+
+void Cpu::opGteCommand(uint32_t instruction)
+{
+	// The CPU keeps going while the GTE works, it only stalls when
+	// it accesses the GTE again before the command is done
+	waitGte();
+	mGteDone = mCycles + mGte.command(instruction & 0x1ffffff);
 }
 
 void Cpu::opCop3(uint32_t instruction)
@@ -1206,12 +1570,12 @@ void Cpu::opLwl(uint32_t instruction)
 	// This instruction bypasses the load delay restriction: this
 	// instruction will merge the new contents with the value
 	// currently being loaded if need be.
-	auto cur_v = mOutRegs[t.val];
+	auto cur_v = regWithPendingLoad(t);
 
 	// Next we load the *aligned* word containing the first
 	// addressed byte
 	auto aligned_addr = addr & ~UINT32_C(3);
-	auto aligned_word = load32(aligned_addr);
+	auto aligned_word = load<uint32_t>(aligned_addr);
 
 	// Depending on the address alignment we fetch the 1, 2, 3 or
 	// 4 *most* significant bytes and put them in the target
@@ -1252,12 +1616,12 @@ void Cpu::opLwr(uint32_t instruction)
 	// This instruction bypasses the load delay restriction: this
 	// instruction will merge the new contents with the value
 	// currently being loaded if need be.
-	auto cur_v = mOutRegs[t.val];
+	auto cur_v = regWithPendingLoad(t);
 
 	// Next we load the *aligned* word containing the first
 	// addressed byte
 	auto aligned_addr = addr & ~UINT32_C(3);
-	auto aligned_word = load32(aligned_addr);
+	auto aligned_word = load<uint32_t>(aligned_addr);
 
 	// Depending on the address alignment we fetch the 1, 2, 3 or
 	// 4 *least* significant bytes and put them in the target
@@ -1299,7 +1663,7 @@ void Cpu::opSwl(uint32_t instruction)
 	auto aligned_addr = addr & ~UINT32_C(3);
 	// Load the current value for the aligned word at the target
 	// address
-	auto cur_mem = load32(aligned_addr);
+	auto cur_mem = load<uint32_t>(aligned_addr);
 
 	uint32_t mem;
 	switch (addr & 3)
@@ -1320,7 +1684,7 @@ void Cpu::opSwl(uint32_t instruction)
 		panic("unreachable");
 	};
 
-	store32(aligned_addr, mem);
+	store<uint32_t>(aligned_addr, mem);
 }
 
 void Cpu::opSwr(uint32_t instruction)
@@ -1336,7 +1700,7 @@ void Cpu::opSwr(uint32_t instruction)
 	auto aligned_addr = addr & ~UINT32_C(3);
 	// Load the current value for the aligned word at the target
 	// address
-	auto cur_mem = load32(aligned_addr);
+	auto cur_mem = load<uint32_t>(aligned_addr);
 
 	uint32_t mem;
 	switch (addr & 3)
@@ -1357,7 +1721,7 @@ void Cpu::opSwr(uint32_t instruction)
 		panic("unreachable");
 	};
 
-	store32(aligned_addr, mem);
+	store<uint32_t>(aligned_addr, mem);
 }
 
 void Cpu::opLwc0(uint32_t instruction)
@@ -1374,7 +1738,22 @@ void Cpu::opLwc1(uint32_t instruction)
 
 void Cpu::opLwc2(uint32_t instruction)
 {
-	panic("unhandled GTE LWC: {}", instruction);
+	auto i = Instruction::imm_se(instruction);
+	auto t = Instruction::t(instruction);
+	auto s = Instruction::s(instruction);
+
+	uint32_t addr = reg(s) + i;
+
+	// Address must be 32bit aligned
+	if (addr % 4 == 0)
+	{
+		auto v = load<uint32_t>(addr);
+
+		waitGte();
+		mGte.setData(t.val, v);
+	} else {
+		exception(exception::LoadAddressError);
+	}
 }
 
 void Cpu::opLwc3(uint32_t instruction)
@@ -1397,7 +1776,20 @@ void Cpu::opSwc1(uint32_t instruction)
 
 void Cpu::opSwc2(uint32_t instruction)
 {
-	panic("unhandled GTE SWC: {}", instruction);
+	auto i = Instruction::imm_se(instruction);
+	auto t = Instruction::t(instruction);
+	auto s = Instruction::s(instruction);
+
+	uint32_t addr = reg(s) + i;
+
+	waitGte();
+	auto v = mGte.data(t.val);
+
+	// Address must be 32bit aligned
+	if (addr % 4 == 0)
+		store<uint32_t>(addr, v);
+	else
+		exception(exception::StoreAddressError);
 }
 
 void Cpu::opSwc3(uint32_t instruction)
@@ -1408,7 +1800,7 @@ void Cpu::opSwc3(uint32_t instruction)
 
 void Cpu::opIllegal(uint32_t instruction)
 {
-	println("Illegal instruction {}!", instruction);
+	LOG_WARN(Cpu, "Illegal instruction {}!", instruction);
 	exception(exception::IllegalInstruction);
 }
 
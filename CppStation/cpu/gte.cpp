@@ -0,0 +1,1001 @@
+#include <cpu/gte.hpp>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include "helpers.hpp"
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+namespace cpu {
+namespace gte {
+
+// FLAG register bits. MAC1-3, IR1-3 and the colors have one bit per
+// component.
+const uint32_t FLAG_ERROR = 1u << 31;
+inline constexpr uint32_t macPositive(uint32_t index) { return 1u << (31 - index); }
+inline constexpr uint32_t macNegative(uint32_t index) { return 1u << (28 - index); }
+inline constexpr uint32_t irSaturated(uint32_t index) { return 1u << (25 - index); }
+inline constexpr uint32_t colorSaturated(uint32_t index) { return 1u << (22 - index); }
+const uint32_t FLAG_SZ_SATURATED = 1 << 18;
+const uint32_t FLAG_DIVIDE_OVERFLOW = 1 << 17;
+const uint32_t FLAG_MAC0_POSITIVE = 1 << 16;
+const uint32_t FLAG_MAC0_NEGATIVE = 1 << 15;
+const uint32_t FLAG_SX2_SATURATED = 1 << 14;
+const uint32_t FLAG_SY2_SATURATED = 1 << 13;
+const uint32_t FLAG_IR0_SATURATED = 1 << 12;
+// Bits ORed together into FLAG_ERROR
+const uint32_t FLAG_ERROR_MASK = 0x7f87e000;
+
+// Initial approximations of the reciprocals used by the divider, for
+// divisors normalized to [0x8000, 0xffff]
+static constexpr std::array<uint8_t, 0x101> makeUnrTable()
+{
+	std::array<uint8_t, 0x101> t{};
+
+	for (int32_t i = 0; i < 0x101; i++)
+	{
+		int32_t v = (0x40000 / (i + 0x100) + 1) / 2 - 0x101;
+		t[i] = v > 0 ? v : 0;
+	}
+
+	return t;
+}
+
+static constexpr std::array<uint8_t, 0x101> UNR_TABLE = makeUnrTable();
+
+static uint32_t leadingZeros(uint32_t v)
+{
+	if (v == 0)
+		return 32;
+
+#if defined(__GNUC__)
+	return __builtin_clz(v);
+#else
+	uint32_t n = 0;
+	while ((v & 0x80000000) == 0)
+	{
+		v <<= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+// Wrap `val` to the 44 bits of the MAC adders
+static inline int64_t wrap44(int64_t val)
+{
+	return (int64_t)((uint64_t)val << 20) >> 20;
+}
+
+// Turn per row overflow masks into FLAG bits
+static inline uint32_t macFlags(uint32_t positive, uint32_t negative)
+{
+	uint32_t flags = 0;
+
+	for (uint32_t row = 0; row < 3; row++)
+	{
+		if (positive & (1 << row))
+			flags |= macPositive(row + 1);
+		if (negative & (1 << row))
+			flags |= macNegative(row + 1);
+	}
+
+	return flags;
+}
+
+// Reference version of the matrix kernel. The rows are accumulated in
+// 64 bits and wrapped to 44 bits after each addition but the last one,
+// which is checked when it's stored in a MAC register.
+static uint32_t transformScalar(const int32_t columns[3][4], const int32_t vector[4], const int16_t v[3], int64_t res[4])
+{
+	uint32_t positive = 0;
+	uint32_t negative = 0;
+
+	for (uint32_t row = 0; row < 3; row++)
+	{
+		int64_t acc = (int64_t)vector[row] << 12;
+
+		for (uint32_t col = 0; col < 3; col++)
+		{
+			acc += columns[col][row] * v[col];
+			if (col == 2)
+				break;
+
+			int64_t wrapped = wrap44(acc);
+			if (wrapped != acc)
+			{
+				if (acc < 0)
+					negative |= 1 << row;
+				else
+					positive |= 1 << row;
+			}
+			acc = wrapped;
+		}
+
+		res[row] = acc;
+	}
+
+	res[3] = 0;
+
+	return macFlags(positive, negative);
+}
+
+#if defined(__AVX2__)
+
+static inline __m256i wrap44(__m256i val)
+{
+	const __m256i mask = _mm256_set1_epi64x((INT64_C(1) << 44) - 1);
+	const __m256i sign = _mm256_set1_epi64x(INT64_C(1) << 43);
+
+	// No 64 bit arithmetic shift before AVX-512, sign extend by hand
+	return _mm256_sub_epi64(_mm256_xor_si256(_mm256_and_si256(val, mask), sign), sign);
+}
+
+// Same as `transformScalar` with the three rows in the lanes of a
+// single register. The 16 bit products fit in 32 bits so a column is
+// multiplied at once and only the sums are widened. Intermediate
+// overflows are very rare, the scalar version works out the flags
+// when there's one.
+static uint32_t transformSimd(const int32_t columns[3][4], const int32_t vector[4], const int16_t v[3], int64_t res[4])
+{
+	__m256i acc = _mm256_slli_epi64(_mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)vector)), 12);
+	__m256i overflow = _mm256_setzero_si256();
+
+	for (uint32_t col = 0; col < 3; col++)
+	{
+		__m128i products = _mm_mullo_epi32(_mm_loadu_si128((const __m128i *)columns[col]), _mm_set1_epi32(v[col]));
+		acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(products));
+		if (col == 2)
+			break;
+
+		__m256i wrapped = wrap44(acc);
+		overflow = _mm256_or_si256(overflow, _mm256_xor_si256(wrapped, acc));
+		acc = wrapped;
+	}
+
+	if (!_mm256_testz_si256(overflow, overflow))
+		return transformScalar(columns, vector, v, res);
+
+	_mm256_storeu_si256((__m256i *)res, acc);
+
+	return 0;
+}
+
+#elif defined(__SSE4_1__)
+
+static inline __m128i wrap44(__m128i val)
+{
+	const __m128i mask = _mm_set1_epi64x((INT64_C(1) << 44) - 1);
+	const __m128i sign = _mm_set1_epi64x(INT64_C(1) << 43);
+
+	return _mm_sub_epi64(_mm_xor_si128(_mm_and_si128(val, mask), sign), sign);
+}
+
+// Same as `transformScalar` with rows 0 and 1 in one register and row
+// 2 in another. Intermediate overflows are very rare, the scalar
+// version works out the flags when there's one.
+static uint32_t transformSimd(const int32_t columns[3][4], const int32_t vector[4], const int16_t v[3], int64_t res[4])
+{
+	__m128i t = _mm_loadu_si128((const __m128i *)vector);
+	__m128i lo = _mm_slli_epi64(_mm_cvtepi32_epi64(t), 12);
+	__m128i hi = _mm_slli_epi64(_mm_cvtepi32_epi64(_mm_srli_si128(t, 8)), 12);
+	__m128i overflow = _mm_setzero_si128();
+
+	for (uint32_t col = 0; col < 3; col++)
+	{
+		__m128i products = _mm_mullo_epi32(_mm_loadu_si128((const __m128i *)columns[col]), _mm_set1_epi32(v[col]));
+		lo = _mm_add_epi64(lo, _mm_cvtepi32_epi64(products));
+		hi = _mm_add_epi64(hi, _mm_cvtepi32_epi64(_mm_srli_si128(products, 8)));
+		if (col == 2)
+			break;
+
+		__m128i wrappedLo = wrap44(lo);
+		__m128i wrappedHi = wrap44(hi);
+		overflow = _mm_or_si128(overflow, _mm_xor_si128(wrappedLo, lo));
+		overflow = _mm_or_si128(overflow, _mm_xor_si128(wrappedHi, hi));
+		lo = wrappedLo;
+		hi = wrappedHi;
+	}
+
+	if (!_mm_testz_si128(overflow, overflow))
+		return transformScalar(columns, vector, v, res);
+
+	_mm_storeu_si128((__m128i *)res, lo);
+	_mm_storeu_si128((__m128i *)(res + 2), hi);
+
+	return 0;
+}
+
+#endif
+
+// Unsigned Newton-Raphson division of H by SZ3 as done by the
+// hardware, the result is a 1.16 fixed-point value
+static uint32_t divide(uint16_t h, uint16_t sz3, uint32_t &flag)
+{
+	if (h >= sz3 * 2)
+	{
+		flag |= FLAG_DIVIDE_OVERFLOW;
+		return 0x1ffff;
+	}
+
+	// Normalize the divisor to [0x8000, 0xffff]
+	uint32_t z = leadingZeros(sz3) - 16;
+	uint64_t n = (uint64_t)h << z;
+	uint32_t d = (uint32_t)sz3 << z;
+
+	uint32_t u = UNR_TABLE[(d - 0x7fc0) >> 7] + 0x101;
+	d = (0x2000080 - d * u) >> 8;
+	d = (0x0000080 + d * u) >> 8;
+
+	return std::min<uint64_t>(0x1ffff, (n * d + 0x8000) >> 16);
+}
+
+static inline uint32_t packColor(const uint8_t color[4])
+{
+	return color[0] | (color[1] << 8) | (color[2] << 16) | ((uint32_t)color[3] << 24);
+}
+
+static inline void unpackColor(uint8_t color[4], uint32_t val)
+{
+	color[0] = val;
+	color[1] = val >> 8;
+	color[2] = val >> 16;
+	color[3] = val >> 24;
+}
+
+static inline uint32_t packXy(const int16_t xy[2])
+{
+	return (uint16_t)xy[0] | ((uint32_t)(uint16_t)xy[1] << 16);
+}
+
+static inline void unpackXy(int16_t xy[2], uint32_t val)
+{
+	xy[0] = val;
+	xy[1] = val >> 16;
+}
+
+Gte::Gte() :
+	mSimd(SIMD_AVAILABLE),
+	mV{},
+	mRgbc{},
+	mOtz(0),
+	mIr{},
+	mSxy{},
+	mSz{},
+	mRgb{},
+	mRes1(0),
+	mMac{},
+	mLzcs(0),
+	mLzcr(32),
+	mMatrices{},
+	mVectors{},
+	mOfx(0),
+	mOfy(0),
+	mH(0),
+	mDqa(0),
+	mDqb(0),
+	mZsf3(0),
+	mZsf4(0),
+	mFlag(0)
+{
+}
+
+uint32_t Gte::data(uint32_t reg) const
+{
+	switch (reg)
+	{
+	case 0:
+	case 2:
+	case 4:
+		return packXy(mV[reg >> 1]);
+	case 1:
+	case 3:
+	case 5:
+		return (int32_t)mV[reg >> 1][2];
+	case 6:
+		return packColor(mRgbc);
+	case 7:
+		return mOtz;
+	case 8:
+	case 9:
+	case 10:
+	case 11:
+		return (int32_t)mIr[reg - 8];
+	case 12:
+	case 13:
+	case 14:
+		return packXy(mSxy[reg - 12]);
+	case 15: // SXYP mirrors SXY2 when read
+		return packXy(mSxy[2]);
+	case 16:
+	case 17:
+	case 18:
+	case 19:
+		return mSz[reg - 16];
+	case 20:
+	case 21:
+	case 22:
+		return packColor(mRgb[reg - 20]);
+	case 23:
+		return mRes1;
+	case 24:
+	case 25:
+	case 26:
+	case 27:
+		return mMac[reg - 24];
+	case 28: // IRGB and ORGB both read IR1-3 as 5 bit colors
+	case 29:
+	{
+		auto component = [](int16_t ir) { return (uint32_t)std::clamp(ir >> 7, 0, 0x1f); };
+
+		return component(mIr[1]) | (component(mIr[2]) << 5) | (component(mIr[3]) << 10);
+	}
+	case 30:
+		return mLzcs;
+	default:
+		return mLzcr;
+	}
+}
+
+void Gte::setData(uint32_t reg, uint32_t val)
+{
+	switch (reg)
+	{
+	case 0:
+	case 2:
+	case 4:
+		unpackXy(mV[reg >> 1], val);
+		break;
+	case 1:
+	case 3:
+	case 5:
+		mV[reg >> 1][2] = val;
+		break;
+	case 6:
+		unpackColor(mRgbc, val);
+		break;
+	case 7:
+		mOtz = val;
+		break;
+	case 8:
+	case 9:
+	case 10:
+	case 11:
+		mIr[reg - 8] = val;
+		break;
+	case 12:
+	case 13:
+	case 14:
+		unpackXy(mSxy[reg - 12], val);
+		break;
+	case 15: // SXYP pushes to the FIFO
+		memmove(&mSxy[0], &mSxy[1], 2 * sizeof(mSxy[0]));
+		unpackXy(mSxy[2], val);
+		break;
+	case 16:
+	case 17:
+	case 18:
+	case 19:
+		mSz[reg - 16] = val;
+		break;
+	case 20:
+	case 21:
+	case 22:
+		unpackColor(mRgb[reg - 20], val);
+		break;
+	case 23:
+		mRes1 = val;
+		break;
+	case 24:
+	case 25:
+	case 26:
+	case 27:
+		mMac[reg - 24] = val;
+		break;
+	case 28: // IRGB expands the 5 bit colors to IR1-3
+		mIr[1] = (val & 0x1f) << 7;
+		mIr[2] = ((val >> 5) & 0x1f) << 7;
+		mIr[3] = ((val >> 10) & 0x1f) << 7;
+		break;
+	case 30: // Count the leading zeros, or ones if negative
+		mLzcs = val;
+		mLzcr = leadingZeros((int32_t)val < 0 ? ~val : val);
+		break;
+	default: // ORGB and LZCR are read only
+		break;
+	}
+}
+
+uint32_t Gte::control(uint32_t reg) const
+{
+	// Each matrix is followed by its vector
+	if (reg < 24)
+	{
+		const int32_t (*columns)[4] = mMatrices[reg >> 3];
+		uint32_t k = reg & 7;
+
+		// Matrix elements are packed two per register in row-major
+		// order, the last one is sign extended
+		if (k < 4)
+		{
+			uint32_t i = 2 * k;
+
+			return (uint16_t)columns[i % 3][i / 3] | ((uint32_t)(uint16_t)columns[(i + 1) % 3][(i + 1) / 3] << 16);
+		}
+		if (k == 4)
+			return columns[2][2];
+
+		return mVectors[reg >> 3][k - 5];
+	}
+
+	switch (reg)
+	{
+	case 24:
+		return mOfx;
+	case 25:
+		return mOfy;
+	case 26: // H is unsigned but sign extended when read
+		return (int32_t)(int16_t)mH;
+	case 27:
+		return (int32_t)mDqa;
+	case 28:
+		return mDqb;
+	case 29:
+		return (int32_t)mZsf3;
+	case 30:
+		return (int32_t)mZsf4;
+	default:
+		return mFlag;
+	}
+}
+
+void Gte::setControl(uint32_t reg, uint32_t val)
+{
+	if (reg < 24)
+	{
+		int32_t (*columns)[4] = mMatrices[reg >> 3];
+		uint32_t k = reg & 7;
+
+		if (k < 4)
+		{
+			uint32_t i = 2 * k;
+
+			columns[i % 3][i / 3] = (int16_t)val;
+			columns[(i + 1) % 3][(i + 1) / 3] = (int16_t)(val >> 16);
+		}
+		else if (k == 4)
+			columns[2][2] = (int16_t)val;
+		else
+			mVectors[reg >> 3][k - 5] = val;
+
+		return;
+	}
+
+	switch (reg)
+	{
+	case 24:
+		mOfx = val;
+		break;
+	case 25:
+		mOfy = val;
+		break;
+	case 26:
+		mH = val;
+		break;
+	case 27:
+		mDqa = val;
+		break;
+	case 28:
+		mDqb = val;
+		break;
+	case 29:
+		mZsf3 = val;
+		break;
+	case 30:
+		mZsf4 = val;
+		break;
+	default:
+		mFlag = val & 0x7ffff000;
+		if ((mFlag & FLAG_ERROR_MASK) != 0)
+			mFlag |= FLAG_ERROR;
+	}
+}
+
+uint32_t Gte::command(uint32_t cmd)
+{
+	// Fractional results are shifted right by 12 when `sf` is set,
+	// `lm` saturates the IR registers to 0 instead of -0x8000
+	uint32_t shift = (cmd & (1 << 19)) ? 12 : 0;
+	bool lm = (cmd & (1 << 10)) != 0;
+	uint32_t cycles;
+
+	mFlag = 0;
+
+	switch (cmd & 0x3f)
+	{
+	case 0x01: // RTPS
+	{
+		int64_t res[3];
+		transform(mMatrices[Rotation], mVectors[Translation], mV[0], res);
+		project(res, shift, lm, true);
+		cycles = 15;
+		break;
+	}
+	case 0x06: // NCLIP
+		nclip();
+		cycles = 8;
+		break;
+	case 0x0c: // OP
+		op(shift, lm);
+		cycles = 6;
+		break;
+	case 0x10: // DPCS
+		dpcs(mRgbc, shift, lm);
+		cycles = 8;
+		break;
+	case 0x11: // INTPL
+		intpl(shift, lm);
+		cycles = 8;
+		break;
+	case 0x12: // MVMVA
+		mvmva(cmd, shift, lm);
+		cycles = 8;
+		break;
+	case 0x13: // NCDS
+		ncds(0, shift, lm);
+		cycles = 19;
+		break;
+	case 0x14: // CDP
+		lightColor(shift, lm);
+		depthCue(shift, lm);
+		pushColor();
+		cycles = 13;
+		break;
+	case 0x16: // NCDT
+		for (uint32_t v = 0; v < 3; v++)
+			ncds(v, shift, lm);
+		cycles = 44;
+		break;
+	case 0x1b: // NCCS
+		nccs(0, shift, lm);
+		cycles = 17;
+		break;
+	case 0x1c: // CC
+		lightColor(shift, lm);
+		colorProduct(shift, lm);
+		pushColor();
+		cycles = 11;
+		break;
+	case 0x1e: // NCS
+		ncs(0, shift, lm);
+		cycles = 14;
+		break;
+	case 0x20: // NCT
+		for (uint32_t v = 0; v < 3; v++)
+			ncs(v, shift, lm);
+		cycles = 30;
+		break;
+	case 0x28: // SQR
+		sqr(shift, lm);
+		cycles = 5;
+		break;
+	case 0x29: // DCPL
+		depthCue(shift, lm);
+		pushColor();
+		cycles = 8;
+		break;
+	case 0x2a: // DPCT, always on the oldest color of the FIFO
+		for (uint32_t i = 0; i < 3; i++)
+			dpcs(mRgb[0], shift, lm);
+		cycles = 17;
+		break;
+	case 0x2d: // AVSZ3
+		avsz3();
+		cycles = 5;
+		break;
+	case 0x2e: // AVSZ4
+		avsz4();
+		cycles = 6;
+		break;
+	case 0x30: // RTPT
+	{
+		// The transformations don't depend on each other, doing them
+		// first lets the host overlap them
+		int64_t res[3][3];
+		for (uint32_t v = 0; v < 3; v++)
+			transform(mMatrices[Rotation], mVectors[Translation], mV[v], res[v]);
+		for (uint32_t v = 0; v < 3; v++)
+			project(res[v], shift, lm, v == 2);
+		cycles = 23;
+		break;
+	}
+	case 0x3d: // GPF
+		gpf(shift, lm);
+		cycles = 5;
+		break;
+	case 0x3e: // GPL
+		gpl(shift, lm);
+		cycles = 5;
+		break;
+	case 0x3f: // NCCT
+		for (uint32_t v = 0; v < 3; v++)
+			nccs(v, shift, lm);
+		cycles = 39;
+		break;
+	default:
+		panic("Unhandled GTE command 0x{:02x}", cmd & 0x3f);
+	}
+
+	if ((mFlag & FLAG_ERROR_MASK) != 0)
+		mFlag |= FLAG_ERROR;
+
+	return cycles;
+}
+
+void Gte::project(const int64_t res[3], uint32_t shift, bool lm, bool last)
+{
+	setMac(1, res[0], shift);
+	setMac(2, res[1], shift);
+	setMac(3, res[2], shift);
+	setIr(1, mMac[1], lm);
+	setIr(2, mMac[2], lm);
+
+	// IR3 saturation is flagged on Z >> 12 whatever `sf` is
+	int32_t z = (int32_t)(res[2] >> 12);
+	if (z < -0x8000 || z > 0x7fff)
+		mFlag |= irSaturated(3);
+	mIr[3] = std::clamp(mMac[3], lm ? 0 : -0x8000, 0x7fff);
+
+	pushSz(z);
+
+	// Perspective projection
+	int64_t scale = divide(mH, mSz[3], mFlag);
+	int64_t x = scale * mIr[1] + mOfx;
+	int64_t y = scale * mIr[2] + mOfy;
+	setMac0(x);
+	setMac0(y);
+	pushSxy((int32_t)(x >> 16), (int32_t)(y >> 16));
+
+	if (last)
+	{
+		int64_t depth = scale * mDqa + mDqb;
+		setMac0(depth);
+		setIr0((int32_t)(depth >> 12));
+	}
+}
+
+void Gte::nclip()
+{
+	// Z of the cross product of the triangle's edges
+	int64_t val = (int64_t)mSxy[0][0] * mSxy[1][1] + (int64_t)mSxy[1][0] * mSxy[2][1] +
+		(int64_t)mSxy[2][0] * mSxy[0][1] - (int64_t)mSxy[0][0] * mSxy[2][1] -
+		(int64_t)mSxy[1][0] * mSxy[0][1] - (int64_t)mSxy[2][0] * mSxy[1][1];
+
+	setMac0(val);
+}
+
+void Gte::op(uint32_t shift, bool lm)
+{
+	// Cross product of IR with the rotation matrix diagonal
+	int64_t d1 = mMatrices[Rotation][0][0];
+	int64_t d2 = mMatrices[Rotation][1][1];
+	int64_t d3 = mMatrices[Rotation][2][2];
+
+	setMacIr(1, mIr[3] * d2 - mIr[2] * d3, shift, lm);
+	setMacIr(2, mIr[1] * d3 - mIr[3] * d1, shift, lm);
+	setMacIr(3, mIr[2] * d1 - mIr[1] * d2, shift, lm);
+}
+
+void Gte::dpcs(const uint8_t color[4], uint32_t shift, bool lm)
+{
+	interpolate((int64_t)color[0] << 16, (int64_t)color[1] << 16, (int64_t)color[2] << 16, shift, lm);
+	pushColor();
+}
+
+void Gte::intpl(uint32_t shift, bool lm)
+{
+	interpolate((int64_t)mIr[1] << 12, (int64_t)mIr[2] << 12, (int64_t)mIr[3] << 12, shift, lm);
+	pushColor();
+}
+
+void Gte::mvmva(uint32_t cmd, uint32_t shift, bool lm)
+{
+	uint32_t mx = (cmd >> 17) & 3;
+	uint32_t v = (cmd >> 15) & 3;
+	uint32_t cv = (cmd >> 13) & 3;
+
+	const int16_t *vec = (v == 3) ? &mIr[1] : mV[v];
+	const int32_t (*columns)[4] = mMatrices[mx];
+	int32_t garbage[3][4];
+
+	if (mx == 3)
+	{
+		// Not a real matrix, the hardware ends up mixing the color
+		// with IR0 and two elements of the rotation matrix
+		int32_t r = mRgbc[0] << 4;
+		int32_t r13 = mMatrices[Rotation][2][0];
+		int32_t r22 = mMatrices[Rotation][1][1];
+		int32_t rows[3][3] = {{-r, r, mIr[0]}, {r13, r13, r13}, {r22, r22, r22}};
+
+		for (uint32_t col = 0; col < 3; col++)
+		{
+			for (uint32_t row = 0; row < 3; row++)
+			{
+				garbage[col][row] = rows[row][col];
+			}
+			garbage[col][3] = 0;
+		}
+
+		columns = garbage;
+	}
+
+	if (cv != FarColor)
+	{
+		mulMatVec(columns, mVectors[cv], vec, shift, lm);
+		return;
+	}
+
+	// The far color is broken: it only goes into the first column,
+	// whose sum only affects the flags
+	for (uint32_t row = 0; row < 3; row++)
+	{
+		int64_t first = extendMac(row + 1, ((int64_t)mVectors[FarColor][row] << 12) + columns[0][row] * vec[0]);
+		setIr(row + 1, (int32_t)(first >> shift), false);
+	}
+
+	for (uint32_t row = 0; row < 3; row++)
+	{
+		int64_t val = extendMac(row + 1, columns[1][row] * vec[1]) + columns[2][row] * vec[2];
+		setMacIr(row + 1, val, shift, lm);
+	}
+}
+
+void Gte::ncds(uint32_t v, uint32_t shift, bool lm)
+{
+	lightVector(v, shift, lm);
+	lightColor(shift, lm);
+	depthCue(shift, lm);
+	pushColor();
+}
+
+void Gte::nccs(uint32_t v, uint32_t shift, bool lm)
+{
+	lightVector(v, shift, lm);
+	lightColor(shift, lm);
+	colorProduct(shift, lm);
+	pushColor();
+}
+
+void Gte::ncs(uint32_t v, uint32_t shift, bool lm)
+{
+	lightVector(v, shift, lm);
+	lightColor(shift, lm);
+	pushColor();
+}
+
+void Gte::sqr(uint32_t shift, bool lm)
+{
+	for (uint32_t i = 1; i <= 3; i++)
+		setMacIr(i, (int64_t)mIr[i] * mIr[i], shift, lm);
+}
+
+void Gte::avsz3()
+{
+	int64_t val = (int64_t)mZsf3 * (mSz[1] + mSz[2] + mSz[3]);
+
+	setMac0(val);
+	setOtz((int32_t)(val >> 12));
+}
+
+void Gte::avsz4()
+{
+	int64_t val = (int64_t)mZsf4 * (mSz[0] + mSz[1] + mSz[2] + mSz[3]);
+
+	setMac0(val);
+	setOtz((int32_t)(val >> 12));
+}
+
+void Gte::gpf(uint32_t shift, bool lm)
+{
+	for (uint32_t i = 1; i <= 3; i++)
+		setMacIr(i, (int64_t)mIr[i] * mIr[0], shift, lm);
+
+	pushColor();
+}
+
+void Gte::gpl(uint32_t shift, bool lm)
+{
+	for (uint32_t i = 1; i <= 3; i++)
+		setMacIr(i, ((int64_t)mMac[i] << shift) + (int64_t)mIr[i] * mIr[0], shift, lm);
+
+	pushColor();
+}
+
+void Gte::lightVector(uint32_t v, uint32_t shift, bool lm)
+{
+	mulMatVec(mMatrices[Light], mVectors[Zero], mV[v], shift, lm);
+}
+
+void Gte::lightColor(uint32_t shift, bool lm)
+{
+	mulMatVec(mMatrices[LightColor], mVectors[BackgroundColor], &mIr[1], shift, lm);
+}
+
+void Gte::colorProduct(uint32_t shift, bool lm)
+{
+	for (uint32_t i = 1; i <= 3; i++)
+		setMacIr(i, ((int64_t)mRgbc[i - 1] * mIr[i]) << 4, shift, lm);
+}
+
+void Gte::depthCue(uint32_t shift, bool lm)
+{
+	interpolate(((int64_t)mRgbc[0] * mIr[1]) << 4, ((int64_t)mRgbc[1] * mIr[2]) << 4,
+				((int64_t)mRgbc[2] * mIr[3]) << 4, shift, lm);
+}
+
+void Gte::interpolate(int64_t mac1, int64_t mac2, int64_t mac3, uint32_t shift, bool lm)
+{
+	int64_t in[3] = {mac1, mac2, mac3};
+
+	// IR = FC - in, always saturated to signed values
+	for (uint32_t i = 1; i <= 3; i++)
+		setMacIr(i, ((int64_t)mVectors[FarColor][i - 1] << 12) - in[i - 1], shift, false);
+
+	for (uint32_t i = 1; i <= 3; i++)
+		setMacIr(i, (int64_t)mIr[i] * mIr[0] + in[i - 1], shift, lm);
+}
+
+void Gte::transform(const int32_t columns[3][4], const int32_t vector[4], const int16_t v[3], int64_t res[3])
+{
+	int64_t rows[4];
+
+#ifdef GTE_SIMD
+	mFlag |= mSimd ? transformSimd(columns, vector, v, rows) : transformScalar(columns, vector, v, rows);
+#else
+	mFlag |= transformScalar(columns, vector, v, rows);
+#endif
+
+	res[0] = rows[0];
+	res[1] = rows[1];
+	res[2] = rows[2];
+}
+
+void Gte::mulMatVec(const int32_t columns[3][4], const int32_t vector[4], const int16_t v[3], uint32_t shift, bool lm)
+{
+	int64_t res[3];
+	transform(columns, vector, v, res);
+
+	for (uint32_t i = 1; i <= 3; i++)
+		setMacIr(i, res[i - 1], shift, lm);
+}
+
+int64_t Gte::checkMac(uint32_t index, int64_t val)
+{
+	if (val > INT64_C(0x7ffffffffff))
+		mFlag |= macPositive(index);
+	else if (val < -INT64_C(0x80000000000))
+		mFlag |= macNegative(index);
+
+	return val;
+}
+
+int64_t Gte::extendMac(uint32_t index, int64_t val)
+{
+	return wrap44(checkMac(index, val));
+}
+
+void Gte::setMac(uint32_t index, int64_t val, uint32_t shift)
+{
+	checkMac(index, val);
+	mMac[index] = (int32_t)(val >> shift);
+}
+
+void Gte::setMac0(int64_t val)
+{
+	if (val > INT32_MAX)
+		mFlag |= FLAG_MAC0_POSITIVE;
+	else if (val < INT32_MIN)
+		mFlag |= FLAG_MAC0_NEGATIVE;
+
+	mMac[0] = (int32_t)val;
+}
+
+void Gte::setIr(uint32_t index, int32_t val, bool lm)
+{
+	int32_t min = lm ? 0 : -0x8000;
+
+	if (val < min || val > 0x7fff)
+	{
+		mFlag |= irSaturated(index);
+		val = std::clamp(val, min, 0x7fff);
+	}
+
+	mIr[index] = val;
+}
+
+void Gte::setIr0(int32_t val)
+{
+	if (val < 0 || val > 0x1000)
+	{
+		mFlag |= FLAG_IR0_SATURATED;
+		val = std::clamp(val, 0, 0x1000);
+	}
+
+	mIr[0] = val;
+}
+
+void Gte::setMacIr(uint32_t index, int64_t val, uint32_t shift, bool lm)
+{
+	setMac(index, val, shift);
+	setIr(index, mMac[index], lm);
+}
+
+void Gte::setOtz(int32_t val)
+{
+	if (val < 0 || val > 0xffff)
+	{
+		mFlag |= FLAG_SZ_SATURATED;
+		val = std::clamp(val, 0, 0xffff);
+	}
+
+	mOtz = val;
+}
+
+void Gte::pushSz(int32_t val)
+{
+	if (val < 0 || val > 0xffff)
+	{
+		mFlag |= FLAG_SZ_SATURATED;
+		val = std::clamp(val, 0, 0xffff);
+	}
+
+	mSz[0] = mSz[1];
+	mSz[1] = mSz[2];
+	mSz[2] = mSz[3];
+	mSz[3] = val;
+}
+
+void Gte::pushSxy(int32_t x, int32_t y)
+{
+	if (x < -0x400 || x > 0x3ff)
+	{
+		mFlag |= FLAG_SX2_SATURATED;
+		x = std::clamp(x, -0x400, 0x3ff);
+	}
+	if (y < -0x400 || y > 0x3ff)
+	{
+		mFlag |= FLAG_SY2_SATURATED;
+		y = std::clamp(y, -0x400, 0x3ff);
+	}
+
+	memmove(&mSxy[0], &mSxy[1], 2 * sizeof(mSxy[0]));
+	mSxy[2][0] = x;
+	mSxy[2][1] = y;
+}
+
+void Gte::pushColor()
+{
+	uint8_t color[4];
+
+	for (uint32_t i = 1; i <= 3; i++)
+	{
+		int32_t c = mMac[i] >> 4;
+
+		if (c < 0 || c > 0xff)
+		{
+			mFlag |= colorSaturated(i);
+			c = std::clamp(c, 0, 0xff);
+		}
+
+		color[i - 1] = c;
+	}
+	color[3] = mRgbc[3];
+
+	memmove(&mRgb[0], &mRgb[1], 2 * sizeof(mRgb[0]));
+	std::copy(color, color + 4, mRgb[2]);
+}
+
+} // namespace gte
+} // namespace cpu
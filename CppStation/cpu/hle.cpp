@@ -0,0 +1,371 @@
+#include <cpu/hle.hpp>
+#include <cpu/cpu.hpp>
+#include <bus.hpp>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include "helpers.hpp"
+
+namespace cpu {
+namespace hle {
+
+static const char *TABLE_NAMES[TABLE_COUNT] = { "A0", "B0", "C0" };
+
+// Argument and return registers
+const uint32_t REG_V0 = 2;
+const uint32_t REG_A0 = 4;
+const uint32_t REG_T1 = 9;
+
+Hle::Hle() :
+	mCalls(0),
+	mCyclesSaved(0),
+	mActive(false),
+	mCpu(nullptr)
+{
+	for (uint32_t table = 0; table < TABLE_COUNT; table++)
+		for (uint32_t function = 0; function < FUNCTION_COUNT; function++)
+			mFunctions[table][function] = { nullptr, nullptr, 0, 0, false, 0, 0 };
+
+	// The costs are those of the BIOS loops, which copy and scan a
+	// byte at a time
+	add(A0, 0x15, "strcat", &Hle::strcat, 20, 6);
+	add(A0, 0x19, "strcpy", &Hle::strcpy, 14, 6);
+	add(A0, 0x1b, "strlen", &Hle::strlen, 14, 4);
+	add(A0, 0x28, "bzero", &Hle::bzero, 14, 5);
+	add(A0, 0x2a, "memcpy", &Hle::memcpy, 14, 6);
+	add(A0, 0x2b, "memset", &Hle::memset, 14, 5);
+	// The BIOS isolates the cache and stores to each of the 256 tags
+	// then to each of the 1024 words, with the loops unrolled
+	add(A0, 0x44, "FlushCache", &Hle::flushCache, 1500, 0);
+}
+
+void Hle::add(Table table, uint32_t function, const char *name, Handler handler,
+			  uint32_t baseInstructions, uint32_t byteInstructions)
+{
+	mFunctions[table][function] = { name, handler, baseInstructions, byteInstructions, false, 0, 0 };
+}
+
+bool Hle::call(Cpu &cpu, uint32_t pc, uint32_t &ret, uint64_t &cycles)
+{
+	uint32_t table = ((pc & 0x1fffffff) - 0xa0) >> 4;
+	uint32_t number = cpu.mRegs[REG_T1];
+
+	if (number >= FUNCTION_COUNT)
+		return false;
+
+	Function &function = mFunctions[table][number];
+	if (!function.mEnabled)
+		return false;
+
+	// The stores go to the instruction cache while it's isolated, only
+	// the BIOS knows what it's doing then
+	if ((cpu.mSr & 0x10000) != 0)
+		return false;
+
+	uint32_t bytes = 0;
+
+	mCpu = &cpu;
+	bool handled = (this->*function.mHandler)(ret, bytes);
+	mCpu = nullptr;
+
+	if (!handled)
+		return false;
+
+	// The kernel runs from RAM like the caller
+	uint64_t instructions = function.mBaseInstructions + (uint64_t)function.mByteInstructions * bytes;
+	cycles = instructions * cpu.instructionCycles(pc);
+
+	function.mCalls++;
+	function.mCyclesSaved += cycles;
+	mCalls++;
+	mCyclesSaved += cycles;
+
+	return true;
+}
+
+bool Hle::enable(Table table, uint32_t function, bool enabled)
+{
+	if (table >= TABLE_COUNT || function >= FUNCTION_COUNT || !mFunctions[table][function].mHandler)
+		return false;
+
+	mFunctions[table][function].mEnabled = enabled;
+
+	mActive = false;
+	for (uint32_t t = 0; t < TABLE_COUNT; t++)
+		for (uint32_t f = 0; f < FUNCTION_COUNT; f++)
+			mActive |= mFunctions[t][f].mEnabled;
+
+	return true;
+}
+
+void Hle::enableAll()
+{
+	for (uint32_t table = 0; table < TABLE_COUNT; table++)
+		for (uint32_t function = 0; function < FUNCTION_COUNT; function++)
+			if (mFunctions[table][function].mHandler)
+				enable((Table)table, function, true);
+}
+
+void Hle::enableSame(const Hle &other)
+{
+	for (uint32_t table = 0; table < TABLE_COUNT; table++)
+		for (uint32_t function = 0; function < FUNCTION_COUNT; function++)
+			mFunctions[table][function].mEnabled = other.mFunctions[table][function].mEnabled;
+
+	mActive = other.mActive;
+}
+
+bool Hle::enableList(const std::string &list)
+{
+	size_t start = 0;
+
+	while (start <= list.size())
+	{
+		size_t end = list.find(',', start);
+		if (end == std::string::npos)
+			end = list.size();
+
+		std::string entry = list.substr(start, end - start);
+		size_t colon = entry.find(':');
+		if (colon == std::string::npos)
+			return false;
+
+		std::string tableName = entry.substr(0, colon);
+		for (char &c : tableName)
+			c = toupper(c);
+
+		uint32_t table = 0;
+		while (table < TABLE_COUNT && tableName != TABLE_NAMES[table])
+			table++;
+
+		const char *number = entry.c_str() + colon + 1;
+		char *numberEnd;
+		uint32_t function = strtoul(number, &numberEnd, 16);
+
+		if (table == TABLE_COUNT || *number == '\0' || *numberEnd != '\0' ||
+			!enable((Table)table, function, true))
+			return false;
+
+		start = end + 1;
+	}
+
+	return true;
+}
+
+void Hle::printStats() const
+{
+	for (uint32_t table = 0; table < TABLE_COUNT; table++)
+	{
+		for (uint32_t number = 0; number < FUNCTION_COUNT; number++)
+		{
+			const Function &function = mFunctions[table][number];
+
+			if (function.mCalls)
+				println("HLE {}:{:02X} {}: {} calls, {} cycles saved", TABLE_NAMES[table], number,
+						function.mName, function.mCalls, function.mCyclesSaved);
+		}
+	}
+
+	println("HLE: {} calls, {} cycles saved", mCalls, mCyclesSaved);
+}
+
+uint8_t *Hle::ram(uint32_t addr, uint32_t len) const
+{
+	uint32_t abs_addr = map::maskRegion(addr);
+
+	if (abs_addr >= ram::RAM_SIZE * ram::RAM_MIRRORS)
+		return nullptr;
+
+	// Don't wrap around the end of a mirror
+	uint32_t offset = abs_addr & (ram::RAM_SIZE - 1);
+	if (len > ram::RAM_SIZE - offset)
+		return nullptr;
+
+	return mCpu->mBus->mRam.data() + offset;
+}
+
+int32_t Hle::stringLength(uint32_t addr) const
+{
+	const uint8_t *p = ram(addr, 1);
+	if (!p)
+		return -1;
+
+	uint32_t offset = map::maskRegion(addr) & (ram::RAM_SIZE - 1);
+	const void *end = ::memchr(p, 0, ram::RAM_SIZE - offset);
+
+	return end ? (const uint8_t *)end - p : -1;
+}
+
+void Hle::written(uint32_t addr, uint32_t len)
+{
+	uint32_t offset = map::maskRegion(addr) & (ram::RAM_SIZE - 1);
+	uint32_t page_size = 1 << BLOCK_PAGE_SHIFT;
+
+	// One check per page is enough
+	for (uint32_t page = offset & ~(page_size - 1); page < offset + len; page += page_size)
+		mCpu->mBlockCache.invalidate(page);
+
+	mCpu->mBus->mRam.markDirty(offset, len);
+}
+
+// The BIOS copies don't expect the destination to overlap the
+// source, leave these cases to it
+static bool overlap(const uint8_t *d, const uint8_t *s, uint32_t len)
+{
+	return d < s + len && s < d + len;
+}
+
+uint32_t Hle::arg(uint32_t index) const
+{
+	return mCpu->mRegs[REG_A0 + index];
+}
+
+// strcat(dst, src): append `src` to `dst`, returns `dst`
+bool Hle::strcat(uint32_t &ret, uint32_t &bytes)
+{
+	uint32_t dst = arg(0);
+	uint32_t src = arg(1);
+
+	if (dst == 0 || src == 0)
+		return false;
+
+	int32_t dstLen = stringLength(dst);
+	int32_t srcLen = stringLength(src);
+	if (dstLen < 0 || srcLen < 0)
+		return false;
+
+	uint8_t *d = ram(dst, dstLen + srcLen + 1);
+	const uint8_t *s = ram(src, srcLen + 1);
+	if (!d || overlap(d + dstLen, s, srcLen + 1))
+		return false;
+
+	::memcpy(d + dstLen, s, srcLen + 1);
+	written(dst + dstLen, srcLen + 1);
+
+	ret = dst;
+	bytes = dstLen + srcLen + 1;
+	return true;
+}
+
+// strcpy(dst, src): copy `src` with its terminator, returns `dst`
+bool Hle::strcpy(uint32_t &ret, uint32_t &bytes)
+{
+	uint32_t dst = arg(0);
+	uint32_t src = arg(1);
+
+	if (dst == 0 || src == 0)
+		return false;
+
+	int32_t len = stringLength(src);
+	if (len < 0)
+		return false;
+
+	uint8_t *d = ram(dst, len + 1);
+	const uint8_t *s = ram(src, len + 1);
+	if (!d || overlap(d, s, len + 1))
+		return false;
+
+	::memcpy(d, s, len + 1);
+	written(dst, len + 1);
+
+	ret = dst;
+	bytes = len + 1;
+	return true;
+}
+
+// strlen(src): returns the length of `src`
+bool Hle::strlen(uint32_t &ret, uint32_t &bytes)
+{
+	uint32_t src = arg(0);
+
+	if (src == 0)
+		return false;
+
+	int32_t len = stringLength(src);
+	if (len < 0)
+		return false;
+
+	ret = len;
+	bytes = len + 1;
+	return true;
+}
+
+// bzero(dst, len): fill `dst` with zeroes, returns `dst`
+bool Hle::bzero(uint32_t &ret, uint32_t &bytes)
+{
+	uint32_t dst = arg(0);
+	int32_t len = arg(1);
+
+	if (dst == 0 || len <= 0)
+		return false;
+
+	uint8_t *d = ram(dst, len);
+	if (!d)
+		return false;
+
+	::memset(d, 0, len);
+	written(dst, len);
+
+	ret = dst;
+	bytes = len;
+	return true;
+}
+
+// memcpy(dst, src, len): returns `dst`
+bool Hle::memcpy(uint32_t &ret, uint32_t &bytes)
+{
+	uint32_t dst = arg(0);
+	uint32_t src = arg(1);
+	int32_t len = arg(2);
+
+	if (dst == 0 || src == 0 || len <= 0)
+		return false;
+
+	uint8_t *d = ram(dst, len);
+	const uint8_t *s = ram(src, len);
+	if (!d || !s || overlap(d, s, len))
+		return false;
+
+	::memcpy(d, s, len);
+	written(dst, len);
+
+	ret = dst;
+	bytes = len;
+	return true;
+}
+
+// memset(dst, val, len): fill `dst` with byte `val`, returns `dst`
+bool Hle::memset(uint32_t &ret, uint32_t &bytes)
+{
+	uint32_t dst = arg(0);
+	uint8_t val = arg(1);
+	int32_t len = arg(2);
+
+	if (dst == 0 || len <= 0)
+		return false;
+
+	uint8_t *d = ram(dst, len);
+	if (!d)
+		return false;
+
+	::memset(d, val, len);
+	written(dst, len);
+
+	ret = dst;
+	bytes = len;
+	return true;
+}
+
+// FlushCache(): invalidates the whole instruction cache, returns
+// nothing
+bool Hle::flushCache(uint32_t &ret, uint32_t &bytes)
+{
+	mCpu->mICache.invalidateAll();
+
+	ret = mCpu->mRegs[REG_V0];
+	bytes = 0;
+	return true;
+}
+
+} // namespace hle
+} // namespace cpu
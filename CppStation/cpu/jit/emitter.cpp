@@ -0,0 +1,422 @@
+#include <cpu/jit/emitter.hpp>
+#include "helpers.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace cpu {
+namespace jit {
+
+CodeBuffer::CodeBuffer(size_t size) :
+	mSize(size),
+	mUsed(0)
+{
+#ifdef _WIN32
+	mBase = (uint8_t *)VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+	if (!mBase)
+		panic("Can't allocate {} bytes of executable memory", size);
+#else
+	void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE | PROT_EXEC,
+					 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		panic("Can't allocate {} bytes of executable memory: {}", size, std::strerror(errno));
+	mBase = (uint8_t *)mem;
+#endif
+}
+
+CodeBuffer::~CodeBuffer()
+{
+#ifdef _WIN32
+	VirtualFree(mBase, 0, MEM_RELEASE);
+#else
+	munmap(mBase, mSize);
+#endif
+}
+
+Emitter::Emitter(CodeBuffer &buffer) :
+	mBuffer(buffer)
+{
+	mCode.reserve(4096);
+}
+
+uint8_t *Emitter::finish()
+{
+	if (!mBuffer.hasRoom(mCode.size()))
+		return nullptr;
+
+	uint8_t *entry = mBuffer.current();
+	memcpy(entry, mCode.data(), mCode.size());
+	mBuffer.mUsed += mCode.size();
+
+	return entry;
+}
+
+void Emitter::emit8(uint8_t v)
+{
+	mCode.push_back(v);
+}
+
+void Emitter::emit32(uint32_t v)
+{
+	for (int i = 0; i < 4; i++)
+		emit8((uint8_t)(v >> (i * 8)));
+}
+
+void Emitter::emit64(uint64_t v)
+{
+	emit32((uint32_t)v);
+	emit32((uint32_t)(v >> 32));
+}
+
+void Emitter::rex(bool w, uint8_t reg, uint8_t index, uint8_t base, bool force)
+{
+	uint8_t r = 0x40;
+
+	r |= w << 3;
+	r |= ((reg >> 3) & 1) << 2;
+	r |= ((index >> 3) & 1) << 1;
+	r |= (base >> 3) & 1;
+
+	if (r != 0x40 || force)
+		emit8(r);
+}
+
+void Emitter::modrmMem(uint8_t reg, Reg base, int32_t disp, int index, uint8_t scale)
+{
+	// We never use mod 0b00 so that RBP/R13 don't need special
+	// casing
+	bool disp8 = disp >= -128 && disp <= 127;
+	uint8_t mod = disp8 ? 0b01 : 0b10;
+
+	if (index >= 0 || (base & 7) == RSP)
+	{
+		// SIB byte required
+		uint8_t idx = index >= 0 ? (index & 7) : 0b100;
+		uint8_t ss = 0;
+
+		if (index >= 0)
+		{
+			while ((1 << ss) < scale)
+				ss++;
+		}
+
+		emit8((mod << 6) | ((reg & 7) << 3) | 0b100);
+		emit8((ss << 6) | (idx << 3) | (base & 7));
+	} else {
+		emit8((mod << 6) | ((reg & 7) << 3) | (base & 7));
+	}
+
+	if (disp8)
+		emit8((uint8_t)disp);
+	else
+		emit32((uint32_t)disp);
+}
+
+void Emitter::opMem(uint8_t opcode, uint8_t reg, Reg base, int32_t disp, int index,
+					bool w, bool byteReg, uint8_t scale)
+{
+	rex(w, reg, index >= 0 ? index : 0, base, byteReg && reg >= 4 && reg < 8);
+	emit8(opcode);
+	modrmMem(reg, base, disp, index, scale);
+}
+
+void Emitter::movRegMem(Reg dst, Reg base, int32_t disp)
+{
+	opMem(0x8b, dst, base, disp);
+}
+
+void Emitter::movRegMemIndex(Reg dst, Reg base, Reg index, int32_t disp)
+{
+	opMem(0x8b, dst, base, disp, index);
+}
+
+void Emitter::movMemReg(Reg base, int32_t disp, Reg src)
+{
+	opMem(0x89, src, base, disp);
+}
+
+void Emitter::movMemIndexReg(Reg base, Reg index, int32_t disp, Reg src)
+{
+	opMem(0x89, src, base, disp, index);
+}
+
+void Emitter::movMemImm(Reg base, int32_t disp, uint32_t imm)
+{
+	opMem(0xc7, 0, base, disp);
+	emit32(imm);
+}
+
+void Emitter::movRegMem8(Reg dst, Reg base, int32_t disp)
+{
+	opMem(0x8a, dst, base, disp, -1, false, true);
+}
+
+void Emitter::movMemReg8(Reg base, int32_t disp, Reg src)
+{
+	opMem(0x88, src, base, disp, -1, false, true);
+}
+
+void Emitter::movMemImm8(Reg base, int32_t disp, uint8_t imm)
+{
+	opMem(0xc6, 0, base, disp);
+	emit8(imm);
+}
+
+void Emitter::movRegImm(Reg dst, uint32_t imm)
+{
+	rex(false, 0, 0, dst);
+	emit8(0xb8 + (dst & 7));
+	emit32(imm);
+}
+
+void Emitter::movRegImm64(Reg dst, uint64_t imm)
+{
+	rex(true, 0, 0, dst);
+	emit8(0xb8 + (dst & 7));
+	emit64(imm);
+}
+
+void Emitter::movReg64(Reg dst, Reg src)
+{
+	rex(true, src, 0, dst);
+	emit8(0x89);
+	emit8(0xc0 | ((src & 7) << 3) | (dst & 7));
+}
+
+void Emitter::movRegMem64(Reg dst, Reg base, int32_t disp)
+{
+	opMem(0x8b, dst, base, disp, -1, true);
+}
+
+void Emitter::movMemReg64(Reg base, int32_t disp, Reg src)
+{
+	opMem(0x89, src, base, disp, -1, true);
+}
+
+void Emitter::movzxRegMemIndex8(Reg dst, Reg base, Reg index, int32_t disp)
+{
+	rex(false, dst, index, base);
+	emit8(0x0f);
+	emit8(0xb6);
+	modrmMem(dst, base, disp, index, 1);
+}
+
+void Emitter::aluRegMem(Alu op, Reg dst, Reg base, int32_t disp)
+{
+	opMem(((uint8_t)op << 3) | 0x03, dst, base, disp);
+}
+
+void Emitter::aluRegImm(Alu op, Reg dst, uint32_t imm)
+{
+	rex(false, 0, 0, dst);
+	emit8(0x81);
+	emit8(0xc0 | ((uint8_t)op << 3) | (dst & 7));
+	emit32(imm);
+}
+
+void Emitter::aluMemImm(Alu op, Reg base, int32_t disp, uint32_t imm)
+{
+	opMem(0x81, (uint8_t)op, base, disp);
+	emit32(imm);
+}
+
+void Emitter::aluRegMem64(Alu op, Reg dst, Reg base, int32_t disp)
+{
+	opMem(((uint8_t)op << 3) | 0x03, dst, base, disp, -1, true);
+}
+
+void Emitter::aluMemReg64(Alu op, Reg base, int32_t disp, Reg src)
+{
+	opMem(((uint8_t)op << 3) | 0x01, src, base, disp, -1, true);
+}
+
+void Emitter::cmpMemImm8(Reg base, int32_t disp, uint8_t imm)
+{
+	opMem(0x80, (uint8_t)Alu::Cmp, base, disp);
+	emit8(imm);
+}
+
+void Emitter::shiftRegImm(Shift op, Reg dst, uint8_t imm)
+{
+	rex(false, 0, 0, dst);
+	emit8(0xc1);
+	emit8(0xc0 | ((uint8_t)op << 3) | (dst & 7));
+	emit8(imm);
+}
+
+void Emitter::shiftRegCl(Shift op, Reg dst)
+{
+	rex(false, 0, 0, dst);
+	emit8(0xd3);
+	emit8(0xc0 | ((uint8_t)op << 3) | (dst & 7));
+}
+
+void Emitter::notReg(Reg dst)
+{
+	rex(false, 0, 0, dst);
+	emit8(0xf7);
+	emit8(0xc0 | (2 << 3) | (dst & 7));
+}
+
+void Emitter::setcc(Cond cond, Reg dst)
+{
+	rex(false, 0, 0, dst, dst >= 4 && dst < 8);
+	emit8(0x0f);
+	emit8(0x90 | cond);
+	emit8(0xc0 | (dst & 7));
+
+	// movzx r32, r8
+	rex(false, dst, 0, dst, dst >= 4 && dst < 8);
+	emit8(0x0f);
+	emit8(0xb6);
+	emit8(0xc0 | ((dst & 7) << 3) | (dst & 7));
+}
+
+void Emitter::testRegImm(Reg dst, uint32_t imm)
+{
+	rex(false, 0, 0, dst);
+	emit8(0xf7);
+	emit8(0xc0 | (dst & 7));
+	emit32(imm);
+}
+
+void Emitter::testMemImm(Reg base, int32_t disp, uint32_t imm)
+{
+	opMem(0xf7, 0, base, disp);
+	emit32(imm);
+}
+
+void Emitter::cmpMemIndexImm8(Reg base, Reg index, int32_t disp, uint8_t imm)
+{
+	opMem(0x80, (uint8_t)Alu::Cmp, base, disp, index, false, false, 1);
+	emit8(imm);
+}
+
+void Emitter::movMemIndexImm8(Reg base, Reg index, int32_t disp, uint8_t imm)
+{
+	opMem(0xc6, 0, base, disp, index, false, false, 1);
+	emit8(imm);
+}
+
+void Emitter::loadHost(Reg dst, Reg base, Reg index, uint8_t size, bool sign)
+{
+	if (size == 4)
+	{
+		opMem(0x8b, dst, base, 0, index, false, false, 1);
+		return;
+	}
+
+	// movzx/movsx r32, r/m8 or r/m16
+	rex(false, dst, index, base);
+	emit8(0x0f);
+	if (size == 2)
+		emit8(sign ? 0xbf : 0xb7);
+	else
+		emit8(sign ? 0xbe : 0xb6);
+	modrmMem(dst, base, 0, index, 1);
+}
+
+void Emitter::storeHost(Reg base, Reg index, Reg src, uint8_t size)
+{
+	switch (size)
+	{
+	case 4:
+		opMem(0x89, src, base, 0, index, false, false, 1);
+		break;
+	case 2:
+		// Operand size prefix
+		emit8(0x66);
+		opMem(0x89, src, base, 0, index, false, false, 1);
+		break;
+	default:
+		opMem(0x88, src, base, 0, index, false, true, 1);
+	}
+}
+
+void Emitter::push(Reg reg)
+{
+	rex(false, 0, 0, reg);
+	emit8(0x50 + (reg & 7));
+}
+
+void Emitter::pop(Reg reg)
+{
+	rex(false, 0, 0, reg);
+	emit8(0x58 + (reg & 7));
+}
+
+void Emitter::subRsp(uint8_t imm)
+{
+	emit8(0x48);
+	emit8(0x83);
+	emit8(0xec);
+	emit8(imm);
+}
+
+void Emitter::addRsp(uint8_t imm)
+{
+	emit8(0x48);
+	emit8(0x83);
+	emit8(0xc4);
+	emit8(imm);
+}
+
+void Emitter::call(const void *target)
+{
+	movRegImm64(RAX, (uint64_t)target);
+	// call rax
+	emit8(0xff);
+	emit8(0xd0);
+}
+
+void Emitter::ret()
+{
+	emit8(0xc3);
+}
+
+void Emitter::jcc(Cond cond, Label &label)
+{
+	emit8(0x0f);
+	emit8(0x80 | cond);
+	emitTarget(label);
+}
+
+void Emitter::jmp(Label &label)
+{
+	emit8(0xe9);
+	emitTarget(label);
+}
+
+void Emitter::emitTarget(Label &label)
+{
+	if (label.mPos != Label::UNBOUND)
+	{
+		// Backward jump
+		emit32((uint32_t)(label.mPos - (mCode.size() + 4)));
+		return;
+	}
+
+	label.mFixups.push_back(mCode.size());
+	emit32(0);
+}
+
+void Emitter::bind(Label &label)
+{
+	label.mPos = mCode.size();
+
+	for (size_t pos : label.mFixups)
+	{
+		uint32_t rel = (uint32_t)(mCode.size() - (pos + 4));
+
+		for (int i = 0; i < 4; i++)
+			mCode[pos + i] = (uint8_t)(rel >> (i * 8));
+	}
+
+	label.mFixups.clear();
+}
+
+} // namespace jit
+} // namespace cpu
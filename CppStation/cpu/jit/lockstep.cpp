@@ -0,0 +1,208 @@
+#include <cpu/jit/lockstep.hpp>
+#include <cpu/jit/recompiler.hpp>
+#include <cpu/cpu.hpp>
+#include <bus.hpp>
+
+namespace cpu {
+namespace jit {
+
+void CpuState::save(const Cpu &cpu)
+{
+	mPc = cpu.mPc;
+	mNextPc = cpu.mNextPc;
+	mCurrentPc = cpu.mCurrentPc;
+	mIp = cpu.mIp;
+	for (int i = 0; i < 32; i++)
+	{
+		mRegs[i] = cpu.mRegs[i];
+	}
+	mLoadRegIdx = cpu.mLoadRegIdx.val;
+	mLoadReg = cpu.mLoadReg;
+	mSr = cpu.mSr;
+	mCause = cpu.mCause;
+	mEpc = cpu.mEpc;
+	mHi = cpu.mHi;
+	mLo = cpu.mLo;
+	mBranch = cpu.mBranch;
+	mDelaySlot = cpu.mDelaySlot;
+	mCycles = cpu.mCycles;
+	mMultDivDone = cpu.mMultDivDone;
+	mGteDone = cpu.mGteDone;
+	mGte = cpu.mGte;
+}
+
+void CpuState::restore(Cpu &cpu) const
+{
+	cpu.mPc = mPc;
+	cpu.mNextPc = mNextPc;
+	cpu.mCurrentPc = mCurrentPc;
+	cpu.mIp = mIp;
+	for (int i = 0; i < 32; i++)
+	{
+		cpu.mRegs[i] = mRegs[i];
+	}
+	cpu.mLoadRegIdx.val = mLoadRegIdx;
+	cpu.mLoadReg = mLoadReg;
+	cpu.mSr = mSr;
+	cpu.mCause = mCause;
+	cpu.mEpc = mEpc;
+	cpu.mHi = mHi;
+	cpu.mLo = mLo;
+	cpu.mBranch = mBranch;
+	cpu.mDelaySlot = mDelaySlot;
+	cpu.mCycles = mCycles;
+	cpu.mMultDivDone = mMultDivDone;
+	cpu.mGteDone = mGteDone;
+	cpu.mGte = mGte;
+}
+
+std::string CpuState::diff(const CpuState &other) const
+{
+	std::string res;
+
+	auto check = [&](const char *name, uint64_t a, uint64_t b) {
+		if (a != b)
+			res += fmt::format(" {}: {:08x} != {:08x}", name, a, b);
+	};
+
+	check("pc", mPc, other.mPc);
+	check("next_pc", mNextPc, other.mNextPc);
+	check("current_pc", mCurrentPc, other.mCurrentPc);
+	check("ip", mIp, other.mIp);
+	for (int i = 0; i < 32; i++)
+	{
+		check(fmt::format("r{}", i).c_str(), mRegs[i], other.mRegs[i]);
+	}
+	check("load_reg_idx", mLoadRegIdx, other.mLoadRegIdx);
+	check("load_reg", mLoadReg, other.mLoadReg);
+	check("sr", mSr, other.mSr);
+	check("cause", mCause, other.mCause);
+	check("epc", mEpc, other.mEpc);
+	check("hi", mHi, other.mHi);
+	check("lo", mLo, other.mLo);
+	check("branch", mBranch, other.mBranch);
+	check("delay_slot", mDelaySlot, other.mDelaySlot);
+	check("cycles", mCycles, other.mCycles);
+	check("mult_div_done", mMultDivDone, other.mMultDivDone);
+	check("gte_done", mGteDone, other.mGteDone);
+	for (uint32_t i = 0; i < 32; i++)
+	{
+		check(fmt::format("gte_data{}", i).c_str(), mGte.data(i), other.mGte.data(i));
+		check(fmt::format("gte_control{}", i).c_str(), mGte.control(i), other.mGte.control(i));
+	}
+
+	return res;
+}
+
+Lockstep::Lockstep() :
+	mBlocksChecked(0),
+	mMode(Mode::Off),
+	mReplayPos(0),
+	mBlockPc(0)
+{
+}
+
+uint32_t Lockstep::run(Cpu &cpu, Block *block)
+{
+	CpuState before;
+	CpuState recompiled;
+	CpuState interpreted;
+
+	mBlockPc = cpu.mPc;
+	before.save(cpu);
+
+	// Run the recompiled code for real, recording the memory
+	// accesses
+	mAccesses.clear();
+	mMode = Mode::Record;
+	uint32_t executed = ((BlockFn)block->mCode)(&cpu);
+	mMode = Mode::Off;
+
+	recompiled.save(cpu);
+	before.restore(cpu);
+
+	// Now run the same instructions through the interpreter, the
+	// memory accesses are served from the recording
+	mReplayPos = 0;
+	mMode = Mode::Replay;
+	for (uint32_t i = 0; i < executed; i++)
+	{
+		const CachedInstruction &op = block->mOps[i];
+
+		cpu.mCurrentPc = cpu.mPc;
+		cpu.executeInstruction(op.handler, op.instruction);
+	}
+	mMode = Mode::Off;
+
+	if (mReplayPos != mAccesses.size())
+		panic("Lockstep: block {:08x} made {} memory accesses, the interpreter only {}",
+			  mBlockPc, mAccesses.size(), mReplayPos);
+
+	interpreted.save(cpu);
+
+	std::string diff = recompiled.diff(interpreted);
+	if (!diff.empty())
+		panic("Lockstep: block {:08x} diverged after {} instructions (recompiler != interpreter):{}",
+			  mBlockPc, executed, diff);
+
+	mBlocksChecked++;
+
+	return executed;
+}
+
+uint32_t Lockstep::load(Cpu *cpu, uint32_t addr, uint8_t width)
+{
+	if (mMode == Mode::Replay)
+	{
+		if (mReplayPos >= mAccesses.size())
+			panic("Lockstep: block {:08x}: unexpected load{} at {:08x}", mBlockPc, width * 8, addr);
+
+		const MemoryAccess &access = mAccesses[mReplayPos++];
+		if (access.store || access.addr != addr || access.width != width)
+			panic("Lockstep: block {:08x}: load{} at {:08x} doesn't match the recompiler's {}{} at {:08x}",
+				  mBlockPc, width * 8, addr, access.store ? "store" : "load", access.width * 8, access.addr);
+
+		return access.val;
+	}
+
+	uint32_t val;
+	switch (width)
+	{
+	case 1:
+		val = cpu->loadDirect<uint8_t>(addr);
+		break;
+	case 2:
+		val = cpu->loadDirect<uint16_t>(addr);
+		break;
+	default:
+		val = cpu->loadDirect<uint32_t>(addr);
+	}
+
+	mAccesses.push_back({addr, val, width, false});
+
+	return val;
+}
+
+bool Lockstep::store(uint32_t addr, uint32_t val, uint8_t width)
+{
+	if (mMode == Mode::Replay)
+	{
+		if (mReplayPos >= mAccesses.size())
+			panic("Lockstep: block {:08x}: unexpected store{} at {:08x}", mBlockPc, width * 8, addr);
+
+		const MemoryAccess &access = mAccesses[mReplayPos++];
+		if (!access.store || access.addr != addr || access.width != width || access.val != val)
+			panic("Lockstep: block {:08x}: store{} {:08x} at {:08x} doesn't match the recompiler's {}{} {:08x} at {:08x}",
+				  mBlockPc, width * 8, val, addr, access.store ? "store" : "load",
+				  access.width * 8, access.val, access.addr);
+
+		return false;
+	}
+
+	mAccesses.push_back({addr, val, width, true});
+
+	return true;
+}
+
+} // namespace jit
+} // namespace cpu
@@ -0,0 +1,853 @@
+#include <cpu/jit/recompiler.hpp>
+#include <cpu/cpu.hpp>
+#include <bus.hpp>
+#include "backtrace.hpp"
+
+#include <algorithm>
+
+namespace cpu {
+namespace jit {
+
+// Registers holding the arguments of a call
+#ifdef _WIN32
+static const Reg ARG0 = RCX;
+static const Reg ARG1 = RDX;
+// Windows requires 32 bytes of shadow space for the callee
+static const uint8_t FRAME_SIZE = 40;
+#else
+static const Reg ARG0 = RDI;
+static const Reg ARG1 = RSI;
+static const uint8_t FRAME_SIZE = 8;
+#endif
+
+// The Cpu pointer lives in RBX, the load landing after the current
+// instruction in R12 (register index) and R13 (value) and the fastmem
+// arena base in R14. They're all callee-saved so they survive the calls
+// to the Cpu handlers.
+static const Reg CPU = RBX;
+static const Reg LOAD_IDX = R12;
+static const Reg LOAD_VAL = R13;
+static const Reg FASTMEM = R14;
+
+// Address bits of the scratchpad host page above the scratchpad itself
+static const uint32_t SCRATCHPAD_PADDING = 0x1000 - scratchpad::SCRATCHPAD_SIZE;
+
+// Recompiler running generated code on this thread, looked up by the
+// fault handler. Each machine runs on a single thread at a time, so
+// its faults are always found there.
+static thread_local Recompiler *running = nullptr;
+
+// Run a single instruction with the interpreter
+static void interpret(Cpu *cpu, uint32_t instruction)
+{
+	cpu->decodeAndExecute(instruction);
+}
+
+// Run a known opcode with the interpreter without decoding it again
+template<OpHandler handler>
+static void callHandler(Cpu *cpu, uint32_t instruction)
+{
+	(cpu->*handler)(instruction);
+}
+
+typedef void (*Thunk)(Cpu *cpu, uint32_t instruction);
+
+// RAM at `addr` has been written by a fastmem store
+static void invalidateRam(Cpu *cpu, uint32_t addr)
+{
+	cpu->mBlockCache.invalidate(addr & (ram::RAM_SIZE - 1));
+}
+
+// Out of line code handling a fastmem access that can't be done
+// directly: misaligned address, isolated cache, scratchpad padding or
+// fault
+struct SlowPath
+{
+	// Index of the instruction in the block
+	uint32_t mIndex;
+	uint32_t mInstruction;
+	Thunk mThunk;
+	bool mStore;
+	// Offset of the host access that can fault
+	size_t mFaultPos;
+	// Run the whole instruction through the handler
+	Label mEntry;
+	// Stores only: the page holds cached code
+	Label mInvalidate;
+	// Back to the inline code
+	Label mResume;
+};
+
+// Offset of a Cpu member relative to the Cpu pointer. offsetof isn't
+// usable on Cpu since it's not a standard layout class.
+template<typename T>
+static int32_t offset(const Cpu &cpu, const T &member)
+{
+	return (int32_t)((const uint8_t *)&member - (const uint8_t *)&cpu);
+}
+
+class BlockCompiler
+{
+public:
+	BlockCompiler(Cpu &cpu, Block *block, CodeBuffer &buffer, uint8_t *fastmemBase) :
+		mEmit(buffer),
+		mBlock(block),
+		mFastmemBase(fastmemBase),
+		mPc(offset(cpu, cpu.mPc)),
+		mNextPc(offset(cpu, cpu.mNextPc)),
+		mCurrentPc(offset(cpu, cpu.mCurrentPc)),
+		mIp(offset(cpu, cpu.mIp)),
+		mRegs(offset(cpu, cpu.mRegs)),
+		mLoadRegIdx(offset(cpu, cpu.mLoadRegIdx)),
+		mLoadReg(offset(cpu, cpu.mLoadReg)),
+		mPendingLoadRegIdx(offset(cpu, cpu.mPendingLoadRegIdx)),
+		mPendingLoadReg(offset(cpu, cpu.mPendingLoadReg)),
+		mHi(offset(cpu, cpu.mHi)),
+		mLo(offset(cpu, cpu.mLo)),
+		mBranch(offset(cpu, cpu.mBranch)),
+		mDelaySlot(offset(cpu, cpu.mDelaySlot)),
+		mSr(offset(cpu, cpu.mSr)),
+		mRamCodePages(offset(cpu, cpu.mBlockCache.mRamCodePages)),
+		// The bus holds both the CPU and the RAM so it's close
+		// enough
+		mRamDirtyPages(offset(cpu, cpu.mBus->mRam.mDirtyPages)),
+		mCycles(offset(cpu, cpu.mCycles)),
+		mMultDivDone(offset(cpu, cpu.mMultDivDone)),
+		mInstructionCycles(offset(cpu, cpu.mInstructionCycles)),
+		mLoadDelay(offset(cpu, cpu.mLoadDelay))
+	{
+	}
+
+	uint8_t *compile();
+
+	// Offsets of the fastmem accesses that can fault and of the
+	// matching slow path, relative to the start of the code
+	std::vector<std::pair<size_t, size_t>> mFaultSites;
+
+private:
+	int32_t reg(uint32_t index) { return mRegs + 4 * index; }
+
+	void emitPrologue();
+	void emitEpilogue();
+	// Bookkeeping done by Cpu::executeInstruction before the opcode
+	void emitInstructionStart();
+	// Apply the pending load then store RAX into `written`, the
+	// register written by the instruction (0 if none).
+	void emitCommit(uint32_t written);
+	// Run `instruction` through the interpreter and apply the
+	// pending load
+	void emitInterpret(uint32_t instruction);
+	// Leave the block after instruction `index` if it raised an
+	// exception or if it invalidated the block
+	void emitExitCheck(uint32_t index, bool checkValid);
+
+	// Try to generate native code for `instruction`. Returns false if
+	// it must go through the interpreter.
+	bool emitNative(uint32_t instruction);
+	// Helpers for the native implementations
+	void emitAluImm(uint32_t instruction, Alu op, uint32_t imm);
+	void emitAluReg(uint32_t instruction, Alu op, bool invert);
+	void emitSetImm(uint32_t instruction, Cond cond);
+	void emitSetReg(uint32_t instruction, Cond cond);
+	void emitShiftImm(uint32_t instruction, Shift op);
+	void emitShiftReg(uint32_t instruction, Shift op);
+	void emitBranch(uint32_t instruction);
+	void emitJump(uint32_t instruction);
+	void emitCall(Thunk thunk, uint32_t instruction);
+
+	// Loads and stores, through the handler `thunk` or fastmem if
+	// it's enabled
+	void emitLoad(uint32_t index, uint32_t instruction, Thunk thunk, uint8_t size, bool sign);
+	void emitStore(uint32_t index, uint32_t instruction, Thunk thunk, uint8_t size);
+	// Stall until the multiply/divide unit is done, like
+	// Cpu::waitMultDiv
+	void emitWaitMultDiv();
+	// Compute the address of a fastmem access in RCX, jumping to the
+	// slow path if it can't be done directly
+	void emitFastmemAddress(uint32_t instruction, uint8_t size, SlowPath &slow);
+	SlowPath &addSlowPath(uint32_t index, uint32_t instruction, Thunk thunk, bool store);
+	void emitSlowPath(SlowPath &slow);
+
+	Emitter mEmit;
+	Block *mBlock;
+	// Fastmem arena, nullptr if disabled
+	uint8_t *mFastmemBase;
+	// Reserved up front, the slow paths can't move once their labels
+	// are referenced
+	std::vector<SlowPath> mSlowPaths;
+	// Exit taken after the instruction at the same index
+	std::vector<Label> mExits;
+	Label mEpilogue;
+
+	int32_t mPc;
+	int32_t mNextPc;
+	int32_t mCurrentPc;
+	int32_t mIp;
+	int32_t mRegs;
+	int32_t mLoadRegIdx;
+	int32_t mLoadReg;
+	int32_t mPendingLoadRegIdx;
+	int32_t mPendingLoadReg;
+	int32_t mHi;
+	int32_t mLo;
+	int32_t mBranch;
+	int32_t mDelaySlot;
+	int32_t mSr;
+	int32_t mRamCodePages;
+	int32_t mRamDirtyPages;
+	int32_t mCycles;
+	int32_t mMultDivDone;
+	int32_t mInstructionCycles;
+	int32_t mLoadDelay;
+};
+
+uint8_t *BlockCompiler::compile()
+{
+	uint32_t len = mBlock->mOps.size();
+
+	mExits.resize(len);
+	mSlowPaths.reserve(len);
+
+	emitPrologue();
+
+	for (uint32_t i = 0; i < len; i++)
+	{
+		uint32_t instruction = mBlock->mOps[i].instruction;
+
+		emitInstructionStart();
+
+		if (emitNative(instruction))
+			continue;
+
+		switch (Instruction::function(instruction))
+		{
+		case 0b100000:
+			emitLoad(i, instruction, callHandler<&Cpu::opLb>, 1, true);
+			break;
+		case 0b100001:
+			emitLoad(i, instruction, callHandler<&Cpu::opLh>, 2, true);
+			break;
+		case 0b100011:
+			emitLoad(i, instruction, callHandler<&Cpu::opLw>, 4, false);
+			break;
+		case 0b100100:
+			emitLoad(i, instruction, callHandler<&Cpu::opLbu>, 1, false);
+			break;
+		case 0b100101:
+			emitLoad(i, instruction, callHandler<&Cpu::opLhu>, 2, false);
+			break;
+		case 0b101000:
+			emitStore(i, instruction, callHandler<&Cpu::opSb>, 1);
+			break;
+		case 0b101001:
+			emitStore(i, instruction, callHandler<&Cpu::opSh>, 2);
+			break;
+		case 0b101011:
+			emitStore(i, instruction, callHandler<&Cpu::opSw>, 4);
+			break;
+		// Everything else (COP0, COP2, mult/div, exceptions, unaligned
+		// accesses...) runs through the interpreter
+		default:
+			emitInterpret(instruction);
+			emitExitCheck(i, true);
+		}
+	}
+
+	// Fell through the end of the block
+	mEmit.aluMemImm(Alu::Add, CPU, mIp, len);
+	mEmit.movRegImm(RAX, len);
+	mEmit.jmp(mEpilogue);
+
+	// The slow paths can take the exits so they go first
+	for (SlowPath &slow : mSlowPaths)
+		emitSlowPath(slow);
+
+	for (uint32_t i = 0; i < len; i++)
+	{
+		if (mExits[i].mFixups.empty())
+			continue;
+
+		mEmit.bind(mExits[i]);
+		mEmit.aluMemImm(Alu::Add, CPU, mIp, i + 1);
+		mEmit.movRegImm(RAX, i + 1);
+		mEmit.jmp(mEpilogue);
+	}
+
+	mEmit.bind(mEpilogue);
+	emitEpilogue();
+
+	return mEmit.finish();
+}
+
+void BlockCompiler::emitPrologue()
+{
+	mEmit.push(CPU);
+	mEmit.push(LOAD_IDX);
+	mEmit.push(LOAD_VAL);
+	mEmit.push(FASTMEM);
+	// Keep the stack 16 byte aligned for the calls
+	mEmit.subRsp(FRAME_SIZE);
+	mEmit.movReg64(CPU, ARG0);
+
+	if (mFastmemBase)
+		mEmit.movRegImm64(FASTMEM, (uint64_t)mFastmemBase);
+}
+
+void BlockCompiler::emitEpilogue()
+{
+	mEmit.addRsp(FRAME_SIZE);
+	mEmit.pop(FASTMEM);
+	mEmit.pop(LOAD_VAL);
+	mEmit.pop(LOAD_IDX);
+	mEmit.pop(CPU);
+	mEmit.ret();
+}
+
+void BlockCompiler::emitInstructionStart()
+{
+	// mCurrentPc = mPc
+	mEmit.movRegMem(RAX, CPU, mPc);
+	mEmit.movMemReg(CPU, mCurrentPc, RAX);
+
+	// mPc = mNextPc; mNextPc = mPc + 4
+	mEmit.movRegMem(RAX, CPU, mNextPc);
+	mEmit.movMemReg(CPU, mPc, RAX);
+	mEmit.aluRegImm(Alu::Add, RAX, 4);
+	mEmit.movMemReg(CPU, mNextPc, RAX);
+
+	// The load initiated by the previous instruction lands once
+	// this one is done
+	mEmit.movRegMem(LOAD_IDX, CPU, mLoadRegIdx);
+	mEmit.movRegMem(LOAD_VAL, CPU, mLoadReg);
+	mEmit.movMemImm(CPU, mLoadRegIdx, 0);
+	mEmit.movMemImm(CPU, mLoadReg, 0);
+
+	// mDelaySlot = mBranch; mBranch = false
+	mEmit.movRegMem8(RAX, CPU, mBranch);
+	mEmit.movMemReg8(CPU, mDelaySlot, RAX);
+	mEmit.movMemImm8(CPU, mBranch, 0);
+
+	// mCycles += mInstructionCycles
+	mEmit.movRegMem(RAX, CPU, mInstructionCycles);
+	mEmit.aluMemReg64(Alu::Add, CPU, mCycles, RAX);
+}
+
+void BlockCompiler::emitCommit(uint32_t written)
+{
+	// The instruction's own write goes last so that it takes
+	// precedence over the pending load. Writes to R0 are discarded.
+	mEmit.movMemIndexReg(CPU, LOAD_IDX, mRegs, LOAD_VAL);
+	if (written != 0)
+		mEmit.movMemReg(CPU, reg(written), RAX);
+	mEmit.movMemImm(CPU, reg(0), 0);
+}
+
+void BlockCompiler::emitInterpret(uint32_t instruction)
+{
+	// The interpreter needs the pending load for LWL/LWR and can
+	// cancel it by writing to the same register
+	mEmit.movMemReg(CPU, mPendingLoadRegIdx, LOAD_IDX);
+	mEmit.movMemReg(CPU, mPendingLoadReg, LOAD_VAL);
+	emitCall(interpret, instruction);
+	mEmit.movRegMem(LOAD_IDX, CPU, mPendingLoadRegIdx);
+	emitCommit(0);
+}
+
+void BlockCompiler::emitExitCheck(uint32_t index, bool checkValid)
+{
+	// Exceptions are the only way for `mPc` not to be sequential
+	// within a block
+	mEmit.movRegMem(RAX, CPU, mCurrentPc);
+	mEmit.aluRegImm(Alu::Add, RAX, 4);
+	mEmit.aluRegMem(Alu::Cmp, RAX, CPU, mPc);
+	mEmit.jcc(CondNE, mExits[index]);
+
+	if (checkValid)
+	{
+		mEmit.movRegImm64(RAX, (uint64_t)&mBlock->mValid);
+		mEmit.cmpMemImm8(RAX, 0, 0);
+		mEmit.jcc(CondE, mExits[index]);
+	}
+}
+
+void BlockCompiler::emitCall(Thunk thunk, uint32_t instruction)
+{
+	mEmit.movReg64(ARG0, CPU);
+	mEmit.movRegImm(ARG1, instruction);
+	mEmit.call((const void *)thunk);
+}
+
+void BlockCompiler::emitLoad(uint32_t index, uint32_t instruction, Thunk thunk, uint8_t size, bool sign)
+{
+	if (!mFastmemBase)
+	{
+		// Loads only write to the load delay registers
+		emitCall(thunk, instruction);
+		emitCommit(0);
+		emitExitCheck(index, false);
+		return;
+	}
+
+	auto t = Instruction::t(instruction).val;
+
+	SlowPath &slow = addSlowPath(index, instruction, thunk, false);
+
+	emitFastmemAddress(instruction, size, slow);
+
+	slow.mFaultPos = mEmit.size();
+	mEmit.loadHost(RAX, FASTMEM, RCX, size, sign);
+
+	// Only RAM, BIOS and scratchpad loads get here, their delays
+	// are all in the table
+	mEmit.movReg64(RDX, RCX);
+	mEmit.shiftRegImm(Shift::Shr, RDX, DELAY_ZONE_SHIFT);
+	mEmit.aluRegImm(Alu::And, RDX, DELAY_ZONES - 1);
+	mEmit.movzxRegMemIndex8(RDX, CPU, RDX, mLoadDelay + (size >> 1) * DELAY_ZONES);
+	mEmit.aluMemReg64(Alu::Add, CPU, mCycles, RDX);
+
+	// Put the load in the delay slot
+	mEmit.movMemImm(CPU, mLoadRegIdx, t);
+	mEmit.movMemReg(CPU, mLoadReg, RAX);
+	emitCommit(0);
+
+	mEmit.bind(slow.mResume);
+}
+
+void BlockCompiler::emitStore(uint32_t index, uint32_t instruction, Thunk thunk, uint8_t size)
+{
+	if (!mFastmemBase)
+	{
+		// Stores don't write any register but they can overwrite
+		// the block itself
+		emitCall(thunk, instruction);
+		emitCommit(0);
+		emitExitCheck(index, true);
+		return;
+	}
+
+	auto t = Instruction::t(instruction).val;
+
+	SlowPath &slow = addSlowPath(index, instruction, thunk, true);
+
+	emitFastmemAddress(instruction, size, slow);
+
+	mEmit.movRegMem(RAX, CPU, reg(t));
+	slow.mFaultPos = mEmit.size();
+	mEmit.storeHost(FASTMEM, RCX, RAX, size);
+
+	// Only RAM and the scratchpad are writable in the arena. RAM
+	// (with its mirrors) is in the first 8MB of each segment, that's
+	// where the page is marked as written and its blocks dropped if
+	// there are any.
+	static_assert(BLOCK_PAGE_SHIFT == ram::RAM_PAGE_SHIFT, "The code and dirty pages must match");
+	Label scratchpad;
+	mEmit.testRegImm(RCX, scratchpad::SCRATCHPAD_BASE);
+	mEmit.jcc(CondNE, scratchpad);
+	mEmit.movReg64(RDX, RCX);
+	mEmit.aluRegImm(Alu::And, RDX, ram::RAM_SIZE - 1);
+	mEmit.shiftRegImm(Shift::Shr, RDX, BLOCK_PAGE_SHIFT);
+	mEmit.movMemIndexImm8(CPU, RDX, mRamDirtyPages, 1);
+	mEmit.cmpMemIndexImm8(CPU, RDX, mRamCodePages, 0);
+	mEmit.jcc(CondNE, slow.mInvalidate);
+	mEmit.bind(scratchpad);
+	emitCommit(0);
+
+	mEmit.bind(slow.mResume);
+}
+
+void BlockCompiler::emitWaitMultDiv()
+{
+	Label done;
+
+	// if (mCycles < mMultDivDone) mCycles = mMultDivDone
+	mEmit.movRegMem64(RAX, CPU, mMultDivDone);
+	mEmit.aluRegMem64(Alu::Cmp, RAX, CPU, mCycles);
+	mEmit.jcc(CondBE, done);
+	mEmit.movMemReg64(CPU, mCycles, RAX);
+	mEmit.bind(done);
+}
+
+void BlockCompiler::emitFastmemAddress(uint32_t instruction, uint8_t size, SlowPath &slow)
+{
+	auto s = Instruction::s(instruction).val;
+
+	// 32bit operations clear the upper half of RCX, so it can be
+	// used as an offset in the arena directly
+	mEmit.movRegMem(RCX, CPU, reg(s));
+	mEmit.aluRegImm(Alu::Add, RCX, Instruction::imm_se(instruction));
+
+	// The handler raises the address error
+	if (size > 1)
+	{
+		mEmit.testRegImm(RCX, size - 1);
+		mEmit.jcc(CondNE, slow.mEntry);
+	}
+
+	// Same thing for the cache isolation
+	mEmit.testMemImm(CPU, mSr, 0x10000);
+	mEmit.jcc(CondNE, slow.mEntry);
+
+	// The scratchpad view is a whole host page but only its first
+	// 1kB is the scratchpad, the rest goes to the bus like in the
+	// interpreter. Matches 0x1f800400-0x1f800fff in each segment.
+	mEmit.movReg64(RDX, RCX);
+	mEmit.aluRegImm(Alu::And, RDX, 0x1fc00000 | SCRATCHPAD_PADDING);
+	mEmit.aluRegImm(Alu::Sub, RDX, scratchpad::SCRATCHPAD_BASE + scratchpad::SCRATCHPAD_SIZE);
+	mEmit.aluRegImm(Alu::Cmp, RDX, SCRATCHPAD_PADDING);
+	mEmit.jcc(CondB, slow.mEntry);
+}
+
+SlowPath &BlockCompiler::addSlowPath(uint32_t index, uint32_t instruction, Thunk thunk, bool store)
+{
+	mSlowPaths.emplace_back();
+
+	SlowPath &slow = mSlowPaths.back();
+	slow.mIndex = index;
+	slow.mInstruction = instruction;
+	slow.mThunk = thunk;
+	slow.mStore = store;
+
+	return slow;
+}
+
+void BlockCompiler::emitSlowPath(SlowPath &slow)
+{
+	// Nothing has been done by the inline code when we get here, even
+	// on a fault, so the handler can run the whole instruction
+	mEmit.bind(slow.mEntry);
+	mFaultSites.push_back({slow.mFaultPos, mEmit.size()});
+	emitCall(slow.mThunk, slow.mInstruction);
+	emitCommit(0);
+	emitExitCheck(slow.mIndex, slow.mStore);
+	mEmit.jmp(slow.mResume);
+
+	if (!slow.mStore)
+		return;
+
+	// The store is done, the address is still in RCX. ARG0 is RCX on
+	// Windows so ARG1 goes first.
+	mEmit.bind(slow.mInvalidate);
+	mEmit.movReg64(ARG1, RCX);
+	mEmit.movReg64(ARG0, CPU);
+	mEmit.call((const void *)invalidateRam);
+	emitCommit(0);
+	emitExitCheck(slow.mIndex, true);
+	mEmit.jmp(slow.mResume);
+}
+
+void BlockCompiler::emitAluImm(uint32_t instruction, Alu op, uint32_t imm)
+{
+	auto t = Instruction::t(instruction).val;
+	auto s = Instruction::s(instruction).val;
+
+	mEmit.movRegMem(RAX, CPU, reg(s));
+	mEmit.aluRegImm(op, RAX, imm);
+	emitCommit(t);
+}
+
+void BlockCompiler::emitAluReg(uint32_t instruction, Alu op, bool invert)
+{
+	auto d = Instruction::d(instruction).val;
+	auto s = Instruction::s(instruction).val;
+	auto t = Instruction::t(instruction).val;
+
+	mEmit.movRegMem(RAX, CPU, reg(s));
+	mEmit.aluRegMem(op, RAX, CPU, reg(t));
+	if (invert)
+		mEmit.notReg(RAX);
+	emitCommit(d);
+}
+
+void BlockCompiler::emitSetImm(uint32_t instruction, Cond cond)
+{
+	auto t = Instruction::t(instruction).val;
+	auto s = Instruction::s(instruction).val;
+
+	mEmit.movRegMem(RAX, CPU, reg(s));
+	mEmit.aluRegImm(Alu::Cmp, RAX, Instruction::imm_se(instruction));
+	mEmit.setcc(cond, RAX);
+	emitCommit(t);
+}
+
+void BlockCompiler::emitSetReg(uint32_t instruction, Cond cond)
+{
+	auto d = Instruction::d(instruction).val;
+	auto s = Instruction::s(instruction).val;
+	auto t = Instruction::t(instruction).val;
+
+	mEmit.movRegMem(RAX, CPU, reg(s));
+	mEmit.aluRegMem(Alu::Cmp, RAX, CPU, reg(t));
+	mEmit.setcc(cond, RAX);
+	emitCommit(d);
+}
+
+void BlockCompiler::emitShiftImm(uint32_t instruction, Shift op)
+{
+	auto d = Instruction::d(instruction).val;
+	auto t = Instruction::t(instruction).val;
+
+	mEmit.movRegMem(RAX, CPU, reg(t));
+	mEmit.shiftRegImm(op, RAX, Instruction::shift(instruction));
+	emitCommit(d);
+}
+
+void BlockCompiler::emitShiftReg(uint32_t instruction, Shift op)
+{
+	auto d = Instruction::d(instruction).val;
+	auto s = Instruction::s(instruction).val;
+	auto t = Instruction::t(instruction).val;
+
+	// x86 truncates the shift amount to 5 bits just like the R3000
+	mEmit.movRegMem(RCX, CPU, reg(s));
+	mEmit.movRegMem(RAX, CPU, reg(t));
+	mEmit.shiftRegCl(op, RAX);
+	emitCommit(d);
+}
+
+void BlockCompiler::emitBranch(uint32_t instruction)
+{
+	auto s = Instruction::s(instruction).val;
+	auto t = Instruction::t(instruction).val;
+	uint32_t offset = Instruction::imm_se(instruction) << 2;
+
+	Label notTaken;
+
+	mEmit.movRegMem(RAX, CPU, reg(s));
+
+	switch (Instruction::function(instruction))
+	{
+	case 0b000100: // BEQ
+		mEmit.aluRegMem(Alu::Cmp, RAX, CPU, reg(t));
+		mEmit.jcc(CondNE, notTaken);
+		break;
+	case 0b000101: // BNE
+		mEmit.aluRegMem(Alu::Cmp, RAX, CPU, reg(t));
+		mEmit.jcc(CondE, notTaken);
+		break;
+	case 0b000110: // BLEZ
+		mEmit.aluRegImm(Alu::Cmp, RAX, 0);
+		mEmit.jcc(CondG, notTaken);
+		break;
+	case 0b000111: // BGTZ
+		mEmit.aluRegImm(Alu::Cmp, RAX, 0);
+		mEmit.jcc(CondLE, notTaken);
+		break;
+	}
+
+	// mNextPc = mPc + offset
+	mEmit.movRegMem(RAX, CPU, mPc);
+	mEmit.aluRegImm(Alu::Add, RAX, offset);
+	mEmit.movMemReg(CPU, mNextPc, RAX);
+	mEmit.movMemImm8(CPU, mBranch, 1);
+
+	mEmit.bind(notTaken);
+	emitCommit(0);
+}
+
+void BlockCompiler::emitJump(uint32_t instruction)
+{
+	bool link = Instruction::function(instruction) == 0b000011;
+
+	// RAX holds the return address
+	mEmit.movRegMem(RAX, CPU, mNextPc);
+	mEmit.movRegMem(RCX, CPU, mNextPc);
+	mEmit.aluRegImm(Alu::And, RCX, 0xf0000000);
+	mEmit.aluRegImm(Alu::Or, RCX, Instruction::imm_jump(instruction) << 2);
+	mEmit.movMemReg(CPU, mNextPc, RCX);
+	mEmit.movMemImm8(CPU, mBranch, 1);
+
+	emitCommit(link ? 31 : 0);
+}
+
+bool BlockCompiler::emitNative(uint32_t instruction)
+{
+	uint32_t d = Instruction::d(instruction).val;
+	uint32_t s = Instruction::s(instruction).val;
+	uint32_t t = Instruction::t(instruction).val;
+
+	switch (Instruction::function(instruction))
+	{
+	case 0b000000:
+		switch (Instruction::subfunction(instruction))
+		{
+		case 0b000000: // SLL
+			emitShiftImm(instruction, Shift::Shl);
+			return true;
+		case 0b000010: // SRL
+			emitShiftImm(instruction, Shift::Shr);
+			return true;
+		case 0b000011: // SRA
+			emitShiftImm(instruction, Shift::Sar);
+			return true;
+		case 0b000100: // SLLV
+			emitShiftReg(instruction, Shift::Shl);
+			return true;
+		case 0b000110: // SRLV
+			emitShiftReg(instruction, Shift::Shr);
+			return true;
+		case 0b000111: // SRAV
+			emitShiftReg(instruction, Shift::Sar);
+			return true;
+		case 0b001000: // JR
+			mEmit.movRegMem(RAX, CPU, reg(s));
+			mEmit.movMemReg(CPU, mNextPc, RAX);
+			mEmit.movMemImm8(CPU, mBranch, 1);
+			emitCommit(0);
+			return true;
+		case 0b001001: // JALR
+			mEmit.movRegMem(RAX, CPU, mNextPc);
+			mEmit.movRegMem(RCX, CPU, reg(s));
+			mEmit.movMemReg(CPU, mNextPc, RCX);
+			mEmit.movMemImm8(CPU, mBranch, 1);
+			emitCommit(d);
+			return true;
+		case 0b010000: // MFHI
+			emitWaitMultDiv();
+			mEmit.movRegMem(RAX, CPU, mHi);
+			emitCommit(d);
+			return true;
+		case 0b010001: // MTHI
+			mEmit.movRegMem(RAX, CPU, reg(s));
+			mEmit.movMemReg(CPU, mHi, RAX);
+			emitCommit(0);
+			return true;
+		case 0b010010: // MFLO
+			emitWaitMultDiv();
+			mEmit.movRegMem(RAX, CPU, mLo);
+			emitCommit(d);
+			return true;
+		case 0b010011: // MTLO
+			mEmit.movRegMem(RAX, CPU, reg(s));
+			mEmit.movMemReg(CPU, mLo, RAX);
+			emitCommit(0);
+			return true;
+		case 0b100001: // ADDU
+			emitAluReg(instruction, Alu::Add, false);
+			return true;
+		case 0b100011: // SUBU
+			emitAluReg(instruction, Alu::Sub, false);
+			return true;
+		case 0b100100: // AND
+			emitAluReg(instruction, Alu::And, false);
+			return true;
+		case 0b100101: // OR
+			emitAluReg(instruction, Alu::Or, false);
+			return true;
+		case 0b100110: // XOR
+			emitAluReg(instruction, Alu::Xor, false);
+			return true;
+		case 0b100111: // NOR
+			emitAluReg(instruction, Alu::Or, true);
+			return true;
+		case 0b101010: // SLT
+			emitSetReg(instruction, CondL);
+			return true;
+		case 0b101011: // SLTU
+			emitSetReg(instruction, CondB);
+			return true;
+		default:
+			return false;
+		}
+	case 0b000010: // J
+	case 0b000011: // JAL
+		emitJump(instruction);
+		return true;
+	case 0b000100: // BEQ
+	case 0b000101: // BNE
+	case 0b000110: // BLEZ
+	case 0b000111: // BGTZ
+		emitBranch(instruction);
+		return true;
+	case 0b001001: // ADDIU
+		emitAluImm(instruction, Alu::Add, Instruction::imm_se(instruction));
+		return true;
+	case 0b001010: // SLTI
+		emitSetImm(instruction, CondL);
+		return true;
+	case 0b001011: // SLTIU
+		emitSetImm(instruction, CondB);
+		return true;
+	case 0b001100: // ANDI
+		emitAluImm(instruction, Alu::And, Instruction::imm(instruction));
+		return true;
+	case 0b001101: // ORI
+		emitAluImm(instruction, Alu::Or, Instruction::imm(instruction));
+		return true;
+	case 0b001110: // XORI
+		emitAluImm(instruction, Alu::Xor, Instruction::imm(instruction));
+		return true;
+	case 0b001111: // LUI
+		mEmit.movRegImm(RAX, Instruction::imm(instruction) << 16);
+		emitCommit(t);
+		return true;
+	default:
+		return false;
+	}
+}
+
+Recompiler::Recompiler() :
+	mCompiled(0),
+	mFastmemFaults(0),
+	mBuffer(CODE_BUFFER_SIZE),
+	mFastmemBase(nullptr)
+{
+}
+
+Recompiler::~Recompiler()
+{
+	if (running == this)
+		running = nullptr;
+}
+
+bool Recompiler::compile(Cpu &cpu, Block *block)
+{
+	BlockCompiler compiler(cpu, block, mBuffer, mFastmemBase);
+
+	uint8_t *code = compiler.compile();
+	if (!code)
+		return false;
+
+	for (auto &site : compiler.mFaultSites)
+		mFaultSites[code + site.first] = code + site.second;
+
+	block->mCode = code;
+	mCompiled++;
+
+	return true;
+}
+
+uint32_t Recompiler::run(Cpu &cpu, Block *block)
+{
+	running = this;
+
+	return ((BlockFn)block->mCode)(&cpu);
+}
+
+void Recompiler::reset()
+{
+	mBuffer.reset();
+	mFaultSites.clear();
+}
+
+void Recompiler::enableFastmem(uint8_t *base)
+{
+	mFastmemBase = base;
+
+	setFaultHandler(handleFault);
+}
+
+void *Recompiler::handleFault(void *pc)
+{
+	if (!running)
+		return nullptr;
+
+	auto it = running->mFaultSites.find((const uint8_t *)pc);
+	if (it == running->mFaultSites.end())
+		return nullptr;
+
+	running->mFastmemFaults++;
+	return (void *)it->second;
+}
+
+} // namespace jit
+} // namespace cpu
@@ -1,9 +1,6 @@
 #include <gpu/gpu.hpp>
-#include <gpu/opengl/renderer.hpp>
-
-using gpu::opengl::renderer::Vertex;
-using gpu::opengl::renderer::Position;
-using gpu::opengl::renderer::Color;
+#include <gpu/nullRenderer.hpp>
+#include <bus.hpp>
 
 namespace gpu {
 
@@ -53,6 +50,8 @@ uint32_t & CommandBuffer::operator[](uint32_t index)
 }
 
 Gpu::Gpu() :
+	mRenderer(new NullRenderer()),
+	mRendering(true),
 	mPageBaseX(0),
 	mPageBaseY(0),
 	mRectangleTextureXFlip(false),
@@ -89,17 +88,102 @@ Gpu::Gpu() :
 	mDisplayLineEnd(0x100),
 	mInterrupt(false),
 	mDmaDirection(DmaDirection::Off),
+	mVblankEvent(0),
+	mFrames(0),
 	mGp0WordsRemaining(0),
 	mGp0CommandMethod(&Gpu::gp0Nop),
 	mGp0Mode(Gp0Mode::Command)
 {
-	mRenderer.init();
 }
 
 Gpu::~Gpu()
 {
 }
 
+void Gpu::setRenderer(std::unique_ptr<Renderer> renderer)
+{
+	mRenderer = std::move(renderer);
+	mRenderer->init();
+	mRenderer->setDrawing(drawingConfig());
+	mRenderer->setDisplay(displayConfig());
+}
+
+void Gpu::setRendering(bool enabled)
+{
+	if (enabled && !mRendering)
+	{
+		mRenderer->setDrawing(drawingConfig());
+		mRenderer->setDisplay(displayConfig());
+	}
+
+	mRendering = enabled;
+}
+
+DisplayConfig Gpu::displayConfig() const
+{
+	DisplayConfig config;
+
+	config.mVramXStart = mDisplayVramXStart;
+	config.mVramYStart = mDisplayVramYStart;
+	config.mHorizStart = mDisplayHorizStart;
+	config.mHorizEnd = mDisplayHorizEnd;
+	config.mLineStart = mDisplayLineStart;
+	config.mLineEnd = mDisplayLineEnd;
+	config.mHres = mHres.mHr;
+	config.mVres480 = mVres == VerticalRes::Y480Lines;
+	config.mPal = mVmode == VMode::Pal;
+	config.mDepth24 = mDisplayDepth == DisplayDepth::D24Bits;
+	config.mInterlaced = mInterlaced;
+	config.mEnabled = !mDisplayDisabled;
+
+	return config;
+}
+
+DrawingConfig Gpu::drawingConfig() const
+{
+	DrawingConfig config;
+
+	config.mLeft = mDrawingAreaLeft;
+	config.mTop = mDrawingAreaTop;
+	config.mRight = mDrawingAreaRight;
+	config.mBottom = mDrawingAreaBottom;
+	config.mXOffset = mDrawingXOffset;
+	config.mYOffset = mDrawingYOffset;
+	config.mDithering = mDithering;
+	config.mForceSetMaskBit = mForceSetMaskBit;
+	config.mPreserveMaskedPixels = mPreserveMaskedPixels;
+
+	return config;
+}
+
+void Gpu::setupEvents()
+{
+	scheduler::Scheduler &scheduler = mBus->mScheduler;
+
+	mVblankEvent = scheduler.add([this](uint64_t cycle) { vblank(cycle); });
+	scheduler.schedule(mVblankEvent, mBus->mCpu.mCycles + frameCycles());
+}
+
+uint32_t Gpu::frameCycles() const
+{
+	return mVmode == VMode::Ntsc ? NTSC_FRAME_CYCLES : PAL_FRAME_CYCLES;
+}
+
+void Gpu::vblank(uint64_t cycle)
+{
+	mFrames++;
+
+	if (mRendering)
+	{
+		profiler::Scope scope(mBus->mProfiler, profiler::Renderer);
+		mRenderer->display();
+	}
+
+	// Relative to the deadline so that the frame rate doesn't drift
+	// when the CPU overshoots it
+	mBus->mScheduler.schedule(mVblankEvent, cycle + frameCycles());
+}
+
 uint32_t Gpu::status()
 {
 	uint32_t r = 0;
@@ -175,79 +259,83 @@ uint32_t Gpu::status()
 uint32_t Gpu::read()
 {
 	// Not implemented for now...
-	println("GPUREAD");
+	LOG_TRACE(Gpu, "GPUREAD");
 	return 0;
 }
 
+void Gpu::gp0SetupCommand(uint32_t val)
+{
+	auto opcode = (val >> 24) & 0xff;
+
+	switch (opcode)
+	{
+	case 0x00:
+		mGp0WordsRemaining = 1;
+		mGp0CommandMethod = &Gpu::gp0Nop;
+		break;
+	case 0x01:
+		mGp0WordsRemaining = 1;
+		mGp0CommandMethod = &Gpu::gp0ClearCache;
+		break;
+	case 0x28:
+		mGp0WordsRemaining = 5;
+		mGp0CommandMethod = &Gpu::gp0QuadMonoOpaque;
+		break;
+	case 0x2c:
+		mGp0WordsRemaining = 9;
+		mGp0CommandMethod = &Gpu::gp0QuadTextureBlendOpaque;
+		break;
+	case 0x30:
+		mGp0WordsRemaining = 6;
+		mGp0CommandMethod = &Gpu::gp0TriangleShadedOpaque;
+		break;
+	case 0x38:
+		mGp0WordsRemaining = 8;
+		mGp0CommandMethod = &Gpu::gp0QuadShadedOpaque;
+		break;
+	case 0xa0:
+		mGp0WordsRemaining = 3;
+		mGp0CommandMethod = &Gpu::gp0ImageLoad;
+		break;
+	case 0xc0:
+		mGp0WordsRemaining = 3;
+		mGp0CommandMethod = &Gpu::gp0ImageStore;
+		break;
+	case 0xe1:
+		mGp0WordsRemaining = 1;
+		mGp0CommandMethod = &Gpu::gp0DrawMode;
+		break;
+	case 0xe2:
+		mGp0WordsRemaining = 1;
+		mGp0CommandMethod = &Gpu::gp0TextureWindow;
+		break;
+	case 0xe3:
+		mGp0WordsRemaining = 1;
+		mGp0CommandMethod = &Gpu::gp0DrawingAreaTopLeft;
+		break;
+	case 0xe4:
+		mGp0WordsRemaining = 1;
+		mGp0CommandMethod = &Gpu::gp0DrawingAreaBottomRight;
+		break;
+	case 0xe5:
+		mGp0WordsRemaining = 1;
+		mGp0CommandMethod = &Gpu::gp0DrawingOffset;
+		break;
+	case 0xe6:
+		mGp0WordsRemaining = 1;
+		mGp0CommandMethod = &Gpu::gp0MaskBitSetting;
+		break;
+	default:
+		panic("Unhandled GP0 command {:08x}", val);
+	}
+}
+
 void Gpu::gp0(uint32_t val)
 {
 	if (mGp0WordsRemaining == 0)
 	{
 		// We start a new GP0 command
-		auto opcode = (val >> 24) & 0xff;
-
-		switch (opcode)
-		{
-		case 0x00:
-			mGp0WordsRemaining = 1;
-			mGp0CommandMethod = &Gpu::gp0Nop;
-			break;
-		case 0x01:
-			mGp0WordsRemaining = 1;
-			mGp0CommandMethod = &Gpu::gp0ClearCache;
-			break;
-		case 0x28:
-			mGp0WordsRemaining = 5;
-			mGp0CommandMethod = &Gpu::gp0QuadMonoOpaque;
-			break;
-		case 0x2c:
-			mGp0WordsRemaining = 9;
-			mGp0CommandMethod = &Gpu::gp0QuadTextureBlendOpaque;
-			break;
-		case 0x30:
-			mGp0WordsRemaining = 6;
-			mGp0CommandMethod = &Gpu::gp0TriangleShadedOpaque;
-			break;
-		case 0x38:
-			mGp0WordsRemaining = 8;
-			mGp0CommandMethod = &Gpu::gp0QuadShadedOpaque;
-			break;
-		case 0xa0:
-			mGp0WordsRemaining = 3;
-			mGp0CommandMethod = &Gpu::gp0ImageLoad;
-			break;
-		case 0xc0:
-			mGp0WordsRemaining = 3;
-			mGp0CommandMethod = &Gpu::gp0ImageStore;
-			break;
-		case 0xe1:
-			mGp0WordsRemaining = 1;
-			mGp0CommandMethod = &Gpu::gp0DrawMode;
-			break;
-		case 0xe2:
-			mGp0WordsRemaining = 1;
-			mGp0CommandMethod = &Gpu::gp0TextureWindow;
-			break;
-		case 0xe3:
-			mGp0WordsRemaining = 1;
-			mGp0CommandMethod = &Gpu::gp0DrawingAreaTopLeft;
-			break;
-		case 0xe4:
-			mGp0WordsRemaining = 1;
-			mGp0CommandMethod = &Gpu::gp0DrawingAreaBottomRight;
-			break;
-		case 0xe5:
-			mGp0WordsRemaining = 1;
-			mGp0CommandMethod = &Gpu::gp0DrawingOffset;
-			break;
-		case 0xe6:
-			mGp0WordsRemaining = 1;
-			mGp0CommandMethod = &Gpu::gp0MaskBitSetting;
-			break;
-		default:
-			panic("Unhandled GP0 command {:08x}", val);
-		}
-
+		gp0SetupCommand(val);
 		mGp0Command.clear();
 	}
 
@@ -258,11 +346,20 @@ void Gpu::gp0(uint32_t val)
 	case Gp0Mode::Command:
 		mGp0Command.pushWord(val);
 		if (mGp0WordsRemaining == 0)
+		{
 			// We have all the parameters, we can run the command
 			((*this).*mGp0CommandMethod)();
+
+			// The draw mode and the drawing area, offset and mask
+			// commands change the drawing settings
+			uint32_t opcode = mGp0Command[0] >> 24;
+			if (drawing() && (opcode == 0xe1 || (opcode >= 0xe3 && opcode <= 0xe6)))
+				mRenderer->setDrawing(drawingConfig());
+		}
 		break;
 	case Gp0Mode::ImageLoad:
-		// XXX Should copy pixel data to VRAM
+		if (drawing())
+			mRenderer->imageLoadData(val);
 		if (mGp0WordsRemaining == 0)
 			// Load done, switch back to command mode
 			mGp0Mode = Gp0Mode::Command;
@@ -320,7 +417,8 @@ void Gpu::gp0QuadMonoOpaque()
 	Vertex v3 = {Position::fromPacked(mGp0Command[3]), color};
 	Vertex v4 = {Position::fromPacked(mGp0Command[4]), color};
 
-	mRenderer.pushQuad(v1, v2, v3, v4);
+	if (drawing())
+		mRenderer->pushQuad(v1, v2, v3, v4, false);
 }
 
 void Gpu::gp0QuadTextureBlendOpaque()
@@ -333,7 +431,8 @@ void Gpu::gp0QuadTextureBlendOpaque()
 	Vertex v3 = {Position::fromPacked(mGp0Command[5]), color};
 	Vertex v4 = {Position::fromPacked(mGp0Command[7]), color};
 
-	mRenderer.pushQuad(v1, v2, v3, v4);
+	if (drawing())
+		mRenderer->pushQuad(v1, v2, v3, v4, false);
 }
 
 void Gpu::gp0TriangleShadedOpaque()
@@ -342,7 +441,8 @@ void Gpu::gp0TriangleShadedOpaque()
 	Vertex v2 = {Position::fromPacked(mGp0Command[3]), Color::fromPacked(mGp0Command[2])};
 	Vertex v3 = {Position::fromPacked(mGp0Command[5]), Color::fromPacked(mGp0Command[4])};
 
-	mRenderer.pushTriangle(v1, v2, v3);
+	if (drawing())
+		mRenderer->pushTriangle(v1, v2, v3, true);
 }
 
 void Gpu::gp0QuadShadedOpaque()
@@ -352,7 +452,8 @@ void Gpu::gp0QuadShadedOpaque()
 	Vertex v3 = {Position::fromPacked(mGp0Command[5]), Color::fromPacked(mGp0Command[4])};
 	Vertex v4 = {Position::fromPacked(mGp0Command[7]), Color::fromPacked(mGp0Command[6])};
 
-	mRenderer.pushQuad(v1, v2, v3, v4);
+	if (drawing())
+		mRenderer->pushQuad(v1, v2, v3, v4, true);
 }
 
 void Gpu::gp0ImageLoad()
@@ -374,6 +475,11 @@ void Gpu::gp0ImageLoad()
 	// Store number of words expected for this image
 	mGp0WordsRemaining = imgsize / 2;
 
+	// Parameter 1 contains the destination in VRAM
+	auto pos = mGp0Command[1];
+	if (drawing())
+		mRenderer->imageLoad(pos & 0xffff, pos >> 16, width, height);
+
 	// Put the GP0 state machine in ImageLoad mode
 	mGp0Mode = Gp0Mode::ImageLoad;
 }
@@ -386,7 +492,11 @@ void Gpu::gp0ImageStore()
 	auto width  = res & 0xffff;
 	auto height = res >> 16;
 
-	println("Unhandled image store: {}x{}", width, height);
+	auto pos = mGp0Command[1];
+	if (drawing())
+		mRenderer->imageStore(pos & 0xffff, pos >> 16, width, height);
+
+	LOG_WARN(Gpu, "Unhandled image store: {}x{}", width, height);
 }
 
 void Gpu::gp0TextureWindow()
@@ -422,11 +532,6 @@ void Gpu::gp0DrawingOffset()
 	// shift the value to 16bits to force sign extension
 	mDrawingXOffset = ((int16_t)(x << 5)) >> 5;
 	mDrawingYOffset = ((int16_t)(y << 5)) >> 5;
-
-	// XXX Temporary hack: force display when changing offset
-	// since we don't have proper timings
-	mRenderer.display();
-	println("called display()");
 }
 
 void Gpu::gp0MaskBitSetting()
@@ -472,6 +577,14 @@ void Gpu::gp1(uint32_t val)
 	default:
 		panic("Unhandled GP1 command {:08x}", val);
 	}
+
+	// Everything but the command buffer and IRQ handling changes the
+	// display
+	if (mRendering && (opcode == 0x00 || opcode == 0x03 || opcode >= 0x05))
+		mRenderer->setDisplay(displayConfig());
+	// The reset clears the drawing settings as well
+	if (drawing() && opcode == 0x00)
+		mRenderer->setDrawing(drawingConfig());
 }
 
 void Gpu::gp1Reset(uint32_t val)
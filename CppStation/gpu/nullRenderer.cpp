@@ -0,0 +1,51 @@
+#include <gpu/nullRenderer.hpp>
+
+namespace gpu {
+
+NullRenderer::NullRenderer() :
+	mTriangles(0),
+	mQuads(0),
+	mImageLoads(0),
+	mImageLoadWords(0),
+	mImageStores(0),
+	mFrames(0),
+	mDisplay()
+{
+}
+
+void NullRenderer::pushTriangle(Vertex v1, Vertex v2, Vertex v3, bool shaded)
+{
+	mTriangles++;
+}
+
+void NullRenderer::pushQuad(Vertex v1, Vertex v2, Vertex v3, Vertex v4, bool shaded)
+{
+	mQuads++;
+}
+
+void NullRenderer::imageLoad(uint16_t x, uint16_t y, uint16_t width, uint16_t height)
+{
+	mImageLoads++;
+}
+
+void NullRenderer::imageLoadData(uint32_t pixels)
+{
+	mImageLoadWords++;
+}
+
+void NullRenderer::imageStore(uint16_t x, uint16_t y, uint16_t width, uint16_t height)
+{
+	mImageStores++;
+}
+
+void NullRenderer::setDisplay(const DisplayConfig &config)
+{
+	mDisplay = config;
+}
+
+void NullRenderer::display()
+{
+	mFrames++;
+}
+
+} // namespace gpu
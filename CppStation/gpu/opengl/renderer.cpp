@@ -1,6 +1,8 @@
 #include <gpu/opengl/renderer.hpp>
 #include <gpu/opengl/shaderProgram.hpp>
 
+#include <mutex>
+
 #include "helpers.hpp"
 
 using namespace gpu::opengl::shaderProgram;
@@ -13,16 +15,40 @@ namespace renderer {
 static const int windowWidth = 1024;
 static const int windowHeight = 512;
 static const char* windowTitle = "OpenGL Template";
-static gpu::opengl::shaderProgram::ShaderProgram basicShader;
+
+// GLFW is set up for the whole process, by the first renderer
+// initialised, and torn down with the last one
+static std::mutex glfwMutex;
+static uint32_t glfwUsers = 0;
+
+static void acquireGlfw()
+{
+	std::lock_guard<std::mutex> lock(glfwMutex);
+
+	if (glfwUsers++ == 0)
+		glfwInit();
+}
+
+static void releaseGlfw()
+{
+	std::lock_guard<std::mutex> lock(glfwMutex);
+
+	if (--glfwUsers == 0)
+		glfwTerminate();
+}
 
 Renderer::Renderer() :
-	mVerticesNum(0)
+	mVerticesNum(0),
+	mInitialised(false)
 {
 }
 
 Renderer::~Renderer()
 {
-	basicShader.destroy();
+	if (!mInitialised)
+		return;
+
+	mShader.destroy();
 
 	glDisableVertexAttribArray(0);
 	glDisableVertexAttribArray(1);
@@ -31,19 +57,21 @@ Renderer::~Renderer()
 	glDeleteBuffers(1, &mVbo);
 	glDeleteVertexArrays(1, &mVao);
 
-	glfwTerminate();
+	// Before GLFW goes away
+	mWindow.destroy();
+	releaseGlfw();
 }
 
 void Renderer::init()
 {
-	glfwInit();
+	acquireGlfw();
+	mInitialised = true;
 
 	mWindow.init(windowWidth, windowHeight, windowTitle, false);
 	mWindow.installMainCallbacks();
 
 	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
 	{
-		glfwTerminate();
 		panic("Failed to initialize GLAD");
 	}
 
@@ -51,14 +79,14 @@ void Renderer::init()
 	glViewport(0, 0, windowWidth, windowHeight);
 
 	// Create and compile our GLSL program from the shaders
-	if (!basicShader.compileAndLink("assets/shaders/vertex/vertex.glsl", "assets/shaders/fragment/fragment.glsl"))
+	if (!mShader.compileAndLink("assets/shaders/vertex/vertex.glsl", "assets/shaders/fragment/fragment.glsl"))
 	{
-		basicShader.destroy();
-		println("Failed to compile the shader program, exiting early.");
+		mShader.destroy();
+		LOG_ERROR(Renderer, "Failed to compile the shader program, exiting early.");
 	}
 
 	// Use our shader
-	basicShader.bind();
+	mShader.bind();
 
 	glGenVertexArrays(1, &mVao);
 	glBindVertexArray(mVao);
@@ -93,7 +121,7 @@ void Renderer::pushVertex(Vertex v)
 {
 	if (mVerticesNum + 1 > VERTEX_BUFFER_LEN)
 	{
-		println("Vertex attribute buffers full, forcing draw");
+		LOG_DEBUG(Renderer, "Vertex attribute buffers full, forcing draw");
 		draw();
 	}
 
@@ -101,11 +129,11 @@ void Renderer::pushVertex(Vertex v)
     mVerticesNum++;
 }
 
-void Renderer::pushTriangle(Vertex v1, Vertex v2, Vertex v3)
+void Renderer::pushTriangle(Vertex v1, Vertex v2, Vertex v3, bool shaded)
 {
 	if (mVerticesNum + 3 > VERTEX_BUFFER_LEN)
 	{
-		println("Vertex attribute buffers full, forcing draw");
+		LOG_DEBUG(Renderer, "Vertex attribute buffers full, forcing draw");
 		draw();
 	}
 
@@ -114,16 +142,16 @@ void Renderer::pushTriangle(Vertex v1, Vertex v2, Vertex v3)
 	pushVertex(v3);
 }
 
-void Renderer::pushQuad(Vertex v1, Vertex v2, Vertex v3, Vertex v4)
+void Renderer::pushQuad(Vertex v1, Vertex v2, Vertex v3, Vertex v4, bool shaded)
 {
 	if (mVerticesNum + 4 > VERTEX_BUFFER_LEN)
 	{
-		println("Vertex attribute buffers full, forcing draw");
+		LOG_DEBUG(Renderer, "Vertex attribute buffers full, forcing draw");
 		draw();
 	}
 
-	pushTriangle(v1, v2, v3);
-	pushTriangle(v2, v3, v4);
+	pushTriangle(v1, v2, v3, shaded);
+	pushTriangle(v2, v3, v4, shaded);
 }
 
 void Renderer::draw()
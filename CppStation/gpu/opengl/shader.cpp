@@ -10,7 +10,7 @@ bool Shader::compile(ShaderType type, const char* shaderFilepath)
 	// Copy the shader filepath into a string
 	mFilePath = std::string(shaderFilepath);
 
-	println("Compiling shader: {}", mFilePath.c_str());
+	LOG_INFO(Renderer, "Compiling shader: {}", mFilePath.c_str());
 
 	// Read the shader source code from the file
 	std::string shaderSourceCode = readFile(mFilePath.c_str());
@@ -18,7 +18,7 @@ bool Shader::compile(ShaderType type, const char* shaderFilepath)
 	GLenum shaderType = toGlShaderType(type);
 	if (shaderType == GL_INVALID_ENUM)
 	{
-		println("ShaderType is unknown");
+		LOG_ERROR(Renderer, "ShaderType is unknown");
 		return false;
 	}
 
@@ -48,7 +48,7 @@ bool Shader::compile(ShaderType type, const char* shaderFilepath)
 		// We don't need the shader anymore if compilation failed
 		glDeleteShader(mShaderId);
 
-		println("Shader Compilation failed: {}", infoLog.data());
+		LOG_ERROR(Renderer, "Shader Compilation failed: {}", infoLog.data());
 
 		mShaderId = UINT32_MAX;
 		return false;
@@ -19,7 +19,7 @@ bool ShaderProgram::compileAndLink(const char* vertexShaderFile, const char* fra
 	if (!vertexShader.compile(ShaderType::Vertex, vertexShaderFile))
 	{
 		vertexShader.destroy();
-		println("Failed to compile vertex shader.");
+		LOG_ERROR(Renderer, "Failed to compile vertex shader.");
 		return false;
 	}
 
@@ -27,7 +27,7 @@ bool ShaderProgram::compileAndLink(const char* vertexShaderFile, const char* fra
 	if (!fragmentShader.compile(ShaderType::Fragment, fragmentShaderFile))
 	{
 		fragmentShader.destroy();
-		println("Failed to compile fragment shader.");
+		LOG_ERROR(Renderer, "Failed to compile fragment shader.");
 		return false;
 	}
 
@@ -55,7 +55,7 @@ bool ShaderProgram::compileAndLink(const char* vertexShaderFile, const char* fra
 		vertexShader.destroy();
 		fragmentShader.destroy();
 
-		println("Shader linking failed:\n{}", infoLog.data());
+		LOG_ERROR(Renderer, "Shader linking failed:\n{}", infoLog.data());
 		mProgramId = UINT32_MAX;
 		return false;
 	}
@@ -87,7 +87,7 @@ bool ShaderProgram::compileAndLink(const char* vertexShaderFile, const char* fra
 	}
 
 	mProgramId = program;
-	println("Shader compilation and linking succeeded <Vertex:{}>:<Fragment:{}>", vertexShaderFile, fragmentShaderFile);
+	LOG_INFO(Renderer, "Shader compilation and linking succeeded <Vertex:{}>:<Fragment:{}>", vertexShaderFile, fragmentShaderFile);
 	return true;
 }
 
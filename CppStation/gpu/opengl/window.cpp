@@ -7,16 +7,24 @@ namespace gpu {
 namespace opengl {
 namespace window {
 
-Window::Window() : mShouldClose(false)
+Window::Window() :
+	mNativeWindow(nullptr),
+	mShouldClose(false)
 {
 }
 
 Window::~Window()
+{
+	destroy();
+}
+
+void Window::destroy()
 {
 	if (!mNativeWindow)
 		return;
 
 	glfwDestroyWindow(mNativeWindow);
+	mNativeWindow = nullptr;
 }
 
 void Window::init(int width, int height, const char* title, bool fullScreenMode)
@@ -31,8 +39,7 @@ void Window::init(int width, int height, const char* title, bool fullScreenMode)
 	mNativeWindow = glfwCreateWindow(width, height, title, primaryMonitor, nullptr);
 	if (mNativeWindow == nullptr)
 	{
-		println("Failed to create GLFW window");
-		glfwTerminate();
+		LOG_ERROR(Renderer, "Failed to create GLFW window");
 		return;
 	}
 
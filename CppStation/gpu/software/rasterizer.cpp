@@ -0,0 +1,393 @@
+#include <gpu/software/rasterizer.hpp>
+#include <algorithm>
+#include <utility>
+
+#ifdef RASTERIZER_SIMD
+#include <immintrin.h>
+#endif
+
+namespace gpu {
+namespace software {
+
+// The interpolated components are 32 bit fixed point values: 8 bits of
+// integer part, 12 bits of fraction and 12 more below them so that the
+// truncated gradients don't drift across a primitive
+const uint32_t COLOR_FRACTION = 12;
+const uint32_t COLOR_PADDING = 12;
+const uint32_t COLOR_SHIFT = COLOR_FRACTION + COLOR_PADDING;
+
+// Largest primitive the GPU draws
+const int32_t MAX_WIDTH = 1023;
+const int32_t MAX_HEIGHT = 511;
+
+const uint16_t MASK_BIT = 0x8000;
+
+// Added to the 8 bit components before they're truncated to 5 bits,
+// indexed by the low bits of the line and the column
+static const int8_t DITHER[4][4] = {
+	{ -4,  0, -3,  1 },
+	{  2, -2,  3, -1 },
+	{ -3,  1, -4,  0 },
+	{  3, -1,  2, -2 },
+};
+static const int8_t NO_DITHER[4] = { 0, 0, 0, 0 };
+
+static int32_t signExtend11(int32_t val)
+{
+	return (int32_t)((uint32_t)val << 21) >> 21;
+}
+
+// Quotient rounded towards negative infinity
+static int64_t floorDiv(int64_t n, int64_t d)
+{
+	int64_t q = n / d;
+
+	if (n % d != 0 && (n < 0) != (d < 0))
+		q--;
+
+	return q;
+}
+
+// Quotient rounded towards positive infinity
+static int64_t ceilDiv(int64_t n, int64_t d)
+{
+	return -floorDiv(-n, d);
+}
+
+// 5 bit component of an interpolated value
+static inline uint16_t component(uint32_t val, int32_t dither)
+{
+	int32_t c = (int32_t)(val >> COLOR_SHIFT) + dither;
+
+	return std::min(std::max(c, 0), 255) >> 3;
+}
+
+#ifdef RASTERIZER_SIMD
+// Store 8 pixels, the old ones having the mask bit set are kept if
+// `preserve`
+static inline void storePixels(uint16_t *dst, __m128i pixels, bool preserve)
+{
+	if (preserve)
+	{
+		__m128i old = _mm_loadu_si128((const __m128i *)dst);
+		pixels = _mm_blendv_epi8(pixels, old, _mm_srai_epi16(old, 15));
+	}
+
+	_mm_storeu_si128((__m128i *)dst, pixels);
+}
+#endif
+
+Rasterizer::Rasterizer() :
+	mSimd(SIMD_AVAILABLE),
+	mLoad{}
+{
+	setDrawing(DrawingConfig());
+}
+
+void Rasterizer::setDrawing(const DrawingConfig &config)
+{
+	mConfig = config;
+
+	mClipLeft = config.mLeft;
+	mClipTop = config.mTop;
+	mClipRight = std::min<int32_t>(config.mRight, VRAM_WIDTH - 1);
+	mClipBottom = std::min<int32_t>(config.mBottom, VRAM_HEIGHT - 1);
+}
+
+Rasterizer::Point Rasterizer::point(const Vertex &v) const
+{
+	Point p;
+
+	p.x = signExtend11(v.pos.x) + mConfig.mXOffset;
+	p.y = signExtend11(v.pos.y) + mConfig.mYOffset;
+	// Back to the 8 bit values of the command
+	p.color[0] = (uint32_t)(v.color.r * 255.0f + 0.5f);
+	p.color[1] = (uint32_t)(v.color.g * 255.0f + 0.5f);
+	p.color[2] = (uint32_t)(v.color.b * 255.0f + 0.5f);
+
+	return p;
+}
+
+void Rasterizer::triangle(const Vertex &v1, const Vertex &v2, const Vertex &v3, bool shaded)
+{
+	drawTriangle(point(v1), point(v2), point(v3), shaded);
+}
+
+void Rasterizer::quad(const Vertex &v1, const Vertex &v2, const Vertex &v3, const Vertex &v4, bool shaded)
+{
+	Point p2 = point(v2);
+	Point p3 = point(v3);
+
+	drawTriangle(point(v1), p2, p3, shaded);
+	drawTriangle(p2, p3, point(v4), shaded);
+}
+
+void Rasterizer::drawTriangle(Point a, Point b, Point c, bool shaded)
+{
+	// Twice the area, made positive by going around the other way
+	// if needed
+	int64_t area = (int64_t)(b.x - a.x) * (c.y - a.y) - (int64_t)(b.y - a.y) * (c.x - a.x);
+	if (area == 0)
+		return;
+
+	if (area < 0)
+	{
+		std::swap(b, c);
+		area = -area;
+	}
+
+	int32_t minX = std::min({a.x, b.x, c.x});
+	int32_t maxX = std::max({a.x, b.x, c.x});
+	int32_t minY = std::min({a.y, b.y, c.y});
+	int32_t maxY = std::max({a.y, b.y, c.y});
+
+	if (maxX - minX > MAX_WIDTH || maxY - minY > MAX_HEIGHT)
+		return;
+
+	int32_t top = std::max(minY, mClipTop);
+	int32_t bottom = std::min(maxY, mClipBottom);
+	if (top > bottom || std::max(minX, mClipLeft) > std::min(maxX, mClipRight))
+		return;
+
+	// Edges going around the triangle, with the inside on their
+	// positive side. A pixel exactly on one is only drawn if it's a
+	// top edge (horizontal, with the inside below) or a left one.
+	struct Edge
+	{
+		int64_t mX;
+		int64_t mY;
+		int64_t mDx;
+		int64_t mDy;
+		int64_t mBias;
+	};
+
+	const Point *points[3] = { &a, &b, &c };
+	Edge edges[3];
+
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		const Point &from = *points[i];
+		const Point &to = *points[(i + 1) % 3];
+		Edge &edge = edges[i];
+
+		edge.mX = from.x;
+		edge.mY = from.y;
+		edge.mDx = to.x - from.x;
+		edge.mDy = to.y - from.y;
+
+		bool topLeft = edge.mDy < 0 || (edge.mDy == 0 && edge.mDx > 0);
+		edge.mBias = topLeft ? 0 : -1;
+	}
+
+	// Gradients of the components, from the same determinants as the
+	// area, truncated towards zero. The values are interpolated from
+	// the leftmost vertex (the top one on a tie), starting half way
+	// into its component.
+	const Point *origin = points[0];
+	for (const Point *p : points)
+		if (p->x < origin->x || (p->x == origin->x && p->y < origin->y))
+			origin = p;
+
+	uint32_t base[3];
+	uint32_t stepX[3];
+	uint32_t stepY[3];
+	uint16_t flat = 0;
+
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		int64_t db = (int64_t)b.color[i] - a.color[i];
+		int64_t dc = (int64_t)c.color[i] - a.color[i];
+		int64_t gx = db * (c.y - a.y) - dc * (b.y - a.y);
+		int64_t gy = dc * (b.x - a.x) - db * (c.x - a.x);
+
+		stepX[i] = shaded ? (uint32_t)(gx * (1 << COLOR_FRACTION) / area) << COLOR_PADDING : 0;
+		stepY[i] = shaded ? (uint32_t)(gy * (1 << COLOR_FRACTION) / area) << COLOR_PADDING : 0;
+		base[i] = (origin->color[i] << COLOR_SHIFT) + (1 << (COLOR_SHIFT - 1));
+
+		flat |= (a.color[i] >> 3) << (5 * i);
+	}
+
+	if (mConfig.mForceSetMaskBit)
+		flat |= MASK_BIT;
+
+	bool dither = shaded && mConfig.mDithering;
+
+	mVram.markLines(top, bottom - top + 1);
+
+	for (int32_t y = top; y <= bottom; y++)
+	{
+		int64_t left = std::max(minX, mClipLeft);
+		int64_t right = std::min(maxX, mClipRight);
+		bool inside = true;
+
+		// Range of x on the inside of each edge:
+		// mDx * (y - mY) - mDy * (x - mX) + mBias >= 0
+		for (const Edge &edge : edges)
+		{
+			int64_t k = edge.mDx * (y - edge.mY) + edge.mDy * edge.mX + edge.mBias;
+
+			if (edge.mDy > 0)
+				right = std::min(right, floorDiv(k, edge.mDy));
+			else if (edge.mDy < 0)
+				left = std::max(left, ceilDiv(k, edge.mDy));
+			else
+				inside &= k >= 0;
+		}
+
+		if (!inside || left > right)
+			continue;
+
+		uint16_t *dst = mVram.line(y) + left;
+		uint32_t count = right - left + 1;
+
+		if (!shaded)
+		{
+			spanFlat(dst, count, flat);
+			continue;
+		}
+
+		uint32_t color[3];
+		for (uint32_t i = 0; i < 3; i++)
+			color[i] = base[i] + stepX[i] * (uint32_t)(left - origin->x) + stepY[i] * (uint32_t)(y - origin->y);
+
+		spanShaded(dst, left, y, count, color, stepX, dither);
+	}
+}
+
+void Rasterizer::spanFlat(uint16_t *dst, uint32_t count, uint16_t pixel) const
+{
+	bool preserve = mConfig.mPreserveMaskedPixels;
+	uint32_t i = 0;
+
+#ifdef RASTERIZER_SIMD
+	if (mSimd)
+	{
+		__m128i pixels = _mm_set1_epi16((int16_t)pixel);
+
+		for (; i + 8 <= count; i += 8)
+			storePixels(dst + i, pixels, preserve);
+	}
+#endif
+
+	for (; i < count; i++)
+		if (!preserve || !(dst[i] & MASK_BIT))
+			dst[i] = pixel;
+}
+
+void Rasterizer::spanShaded(uint16_t *dst, int32_t x, int32_t y, uint32_t count, const uint32_t color[3],
+							const uint32_t step[3], bool dither) const
+{
+	const int8_t *offsets = dither ? DITHER[y & 3] : NO_DITHER;
+	uint16_t maskBit = mConfig.mForceSetMaskBit ? MASK_BIT : 0;
+	bool preserve = mConfig.mPreserveMaskedPixels;
+	uint32_t i = 0;
+
+#ifdef RASTERIZER_SIMD
+	if (mSimd && count >= 8)
+	{
+		// Components of 8 pixels, 4 in each half. The dither
+		// offsets repeat every 4 pixels so they're the same for
+		// every group of 8.
+		__m128i lo[3];
+		__m128i hi[3];
+		__m128i stride[3];
+		const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+
+		for (uint32_t c = 0; c < 3; c++)
+		{
+			__m128i s = _mm_set1_epi32((int32_t)step[c]);
+			lo[c] = _mm_add_epi32(_mm_set1_epi32((int32_t)color[c]), _mm_mullo_epi32(s, lanes));
+			hi[c] = _mm_add_epi32(lo[c], _mm_slli_epi32(s, 2));
+			stride[c] = _mm_slli_epi32(s, 3);
+		}
+
+		const __m128i offsetsX = _mm_setr_epi16(offsets[x & 3], offsets[(x + 1) & 3], offsets[(x + 2) & 3],
+												offsets[(x + 3) & 3], offsets[x & 3], offsets[(x + 1) & 3],
+												offsets[(x + 2) & 3], offsets[(x + 3) & 3]);
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i max = _mm_set1_epi16(255);
+		const __m128i maskBits = _mm_set1_epi16((int16_t)maskBit);
+
+		// 5 bit values of component `c` for the current pixels
+		auto component5 = [&](uint32_t c)
+		{
+			__m128i v = _mm_packus_epi32(_mm_srli_epi32(lo[c], COLOR_SHIFT), _mm_srli_epi32(hi[c], COLOR_SHIFT));
+			v = _mm_min_epi16(_mm_max_epi16(_mm_add_epi16(v, offsetsX), zero), max);
+
+			lo[c] = _mm_add_epi32(lo[c], stride[c]);
+			hi[c] = _mm_add_epi32(hi[c], stride[c]);
+
+			return _mm_srli_epi16(v, 3);
+		};
+
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i pixels = _mm_or_si128(maskBits, component5(0));
+			pixels = _mm_or_si128(pixels, _mm_slli_epi16(component5(1), 5));
+			pixels = _mm_or_si128(pixels, _mm_slli_epi16(component5(2), 10));
+
+			storePixels(dst + i, pixels, preserve);
+		}
+	}
+#endif
+
+	// Finish where the SIMD loop stopped
+	uint32_t r = color[0] + step[0] * i;
+	uint32_t g = color[1] + step[1] * i;
+	uint32_t b = color[2] + step[2] * i;
+
+	for (; i < count; i++)
+	{
+		int32_t offset = offsets[(x + i) & 3];
+		uint16_t pixel = component(r, offset) | (component(g, offset) << 5) | (component(b, offset) << 10) | maskBit;
+
+		if (!preserve || !(dst[i] & MASK_BIT))
+			dst[i] = pixel;
+
+		r += step[0];
+		g += step[1];
+		b += step[2];
+	}
+}
+
+void Rasterizer::imageLoad(uint16_t x, uint16_t y, uint16_t width, uint16_t height)
+{
+	mLoad.mX = x & (VRAM_WIDTH - 1);
+	mLoad.mY = y & (VRAM_HEIGHT - 1);
+	// A size of 0 is the whole VRAM
+	mLoad.mWidth = ((width - 1) & (VRAM_WIDTH - 1)) + 1;
+	mLoad.mHeight = ((height - 1) & (VRAM_HEIGHT - 1)) + 1;
+	mLoad.mColumn = 0;
+	mLoad.mRow = 0;
+}
+
+void Rasterizer::imageLoadData(uint32_t pixels)
+{
+	loadPixel(pixels);
+	loadPixel(pixels >> 16);
+}
+
+void Rasterizer::loadPixel(uint16_t pixel)
+{
+	// Padding of an odd sized image, or no load at all
+	if (mLoad.mRow >= mLoad.mHeight)
+		return;
+
+	// The pixels may come over several frames, each one is recorded
+	// as it lands so that a rewind snapshot taken meanwhile sees it
+	uint32_t y = (mLoad.mY + mLoad.mRow) & (VRAM_HEIGHT - 1);
+	uint16_t *dst = mVram.line(y) + ((mLoad.mX + mLoad.mColumn) & (VRAM_WIDTH - 1));
+	mVram.markLine(y);
+
+	if (!mConfig.mPreserveMaskedPixels || !(*dst & MASK_BIT))
+		*dst = pixel | (mConfig.mForceSetMaskBit ? MASK_BIT : 0);
+
+	if (++mLoad.mColumn == mLoad.mWidth)
+	{
+		mLoad.mColumn = 0;
+		mLoad.mRow++;
+	}
+}
+
+} // namespace software
+} // namespace gpu
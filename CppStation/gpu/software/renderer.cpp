@@ -0,0 +1,84 @@
+#include <gpu/software/renderer.hpp>
+#include <algorithm>
+
+namespace gpu {
+namespace software {
+
+// Width of the display area for each value of the horizontal
+// resolution bits
+static const uint32_t DISPLAY_WIDTHS[8] = { 256, 368, 320, 368, 512, 368, 640, 368 };
+
+Renderer::Renderer() :
+	mFrameHash(0),
+	mFrames(0),
+	mDisplay()
+{
+}
+
+void Renderer::pushTriangle(Vertex v1, Vertex v2, Vertex v3, bool shaded)
+{
+	mRasterizer.triangle(v1, v2, v3, shaded);
+}
+
+void Renderer::pushQuad(Vertex v1, Vertex v2, Vertex v3, Vertex v4, bool shaded)
+{
+	mRasterizer.quad(v1, v2, v3, v4, shaded);
+}
+
+void Renderer::imageLoad(uint16_t x, uint16_t y, uint16_t width, uint16_t height)
+{
+	mRasterizer.imageLoad(x, y, width, height);
+}
+
+void Renderer::imageLoadData(uint32_t pixels)
+{
+	mRasterizer.imageLoadData(pixels);
+}
+
+void Renderer::setDrawing(const DrawingConfig &config)
+{
+	mRasterizer.setDrawing(config);
+}
+
+void Renderer::setDisplay(const DisplayConfig &config)
+{
+	mDisplay = config;
+}
+
+void Renderer::display()
+{
+	mFrameHash = displayHash();
+	mFrames++;
+}
+
+uint64_t Renderer::displayHash() const
+{
+	// In 24 bit mode 2 pixels take 3 VRAM words
+	uint32_t width = DISPLAY_WIDTHS[mDisplay.mHres & 7];
+	if (mDisplay.mDepth24)
+		width = width * 3 / 2;
+
+	uint32_t height = 0;
+	if (mDisplay.mLineEnd > mDisplay.mLineStart)
+		height = mDisplay.mLineEnd - mDisplay.mLineStart;
+	if (mDisplay.mVres480 && mDisplay.mInterlaced)
+		height *= 2;
+	height = std::min(height, VRAM_HEIGHT);
+
+	// FNV-1a on the VRAM words, wrapping around the edges like the
+	// video output does
+	uint64_t h = 0xcbf29ce484222325;
+
+	for (uint32_t y = 0; y < height; y++)
+	{
+		const uint16_t *line = mRasterizer.mVram.line((mDisplay.mVramYStart + y) & (VRAM_HEIGHT - 1));
+
+		for (uint32_t x = 0; x < width; x++)
+			h = (h ^ line[(mDisplay.mVramXStart + x) & (VRAM_WIDTH - 1)]) * 0x100000001b3;
+	}
+
+	return h;
+}
+
+} // namespace software
+} // namespace gpu
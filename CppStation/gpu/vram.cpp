@@ -0,0 +1,40 @@
+#include <gpu/vram.hpp>
+#include <cstdlib>
+#include <cstring>
+#include "helpers.hpp"
+
+namespace gpu {
+
+Vram::Vram()
+{
+	mPixels = (uint16_t *)malloc(VRAM_SIZE);
+	if (!mPixels)
+		panic("Not enough memory to allocate VRAM buffer");
+
+	memset(mPixels, 0, VRAM_SIZE);
+	memset(mDirtyPages, 1, VRAM_PAGES);
+}
+
+Vram::~Vram()
+{
+	free(mPixels);
+}
+
+void Vram::markLines(uint32_t y, uint32_t count)
+{
+	if (count >= VRAM_HEIGHT)
+	{
+		memset(mDirtyPages, 1, VRAM_PAGES);
+		return;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+		mDirtyPages[((y + i) % VRAM_HEIGHT) / VRAM_PAGE_LINES] = 1;
+}
+
+void Vram::clearDirty()
+{
+	memset(mDirtyPages, 0, VRAM_PAGES);
+}
+
+} // namespace gpu
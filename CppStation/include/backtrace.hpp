@@ -1,3 +1,12 @@
 #pragma once
 
-void setupSigAct();
\ No newline at end of file
+void setupSigAct();
+
+// Called on SIGSEGV with the address of the faulting host instruction.
+// Returns the address execution must resume at, or nullptr if the
+// fault is a genuine crash.
+typedef void *(*FaultHandler)(void *pc);
+
+// Give `handler` a chance to recover from segmentation faults before
+// dumping the backtrace
+void setFaultHandler(FaultHandler handler);
\ No newline at end of file
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bus {
+class Bus;
+}
+
+namespace batch {
+
+// Worker threads running the tasks submitted to them, in order
+class ThreadPool
+{
+public:
+	// One thread per host core if `threads` is 0
+	ThreadPool(uint32_t threads);
+	~ThreadPool();
+
+	void submit(std::function<void()> task);
+	// Wait until all the tasks submitted so far are done
+	void wait();
+
+	uint32_t threads() const
+	{
+		return mThreads.size();
+	}
+
+private:
+	void run();
+
+	std::vector<std::thread> mThreads;
+	std::deque<std::function<void()>> mTasks;
+	std::mutex mMutex;
+	// Signaled when a task is queued or the pool stops
+	std::condition_variable mWork;
+	// Signaled when the last pending task is done
+	std::condition_variable mIdle;
+	// Tasks queued or running
+	uint32_t mPending;
+	bool mStopping;
+};
+
+// Outcome of one machine of a batch
+struct Result
+{
+	uint64_t mFrames;
+	uint64_t mInstructions;
+	uint64_t mCycles;
+	// Host time the machine took, on its own thread
+	double mSeconds;
+	// Hash of the last frame shown, with the software renderer
+	uint64_t mFrameHash;
+};
+
+// Run `instances` independent copies of `bus` on `pool`, each one for
+// `frames` frames. The copies start from the current state of `bus`
+// with the same execution settings and use fastmem if `fastmem` is
+// set. They draw with the software renderer if `bus` does, the null
+// one otherwise. They're created on the thread running them and share nothing,
+// so the throughput scales with the number of threads.
+std::vector<Result> run(ThreadPool &pool, bus::Bus &bus, const std::string &biosPath, bool fastmem,
+						uint32_t instances, uint64_t frames);
+
+} // namespace batch
@@ -4,27 +4,91 @@
 #include <gpu/gpu.hpp>
 #include <memory/bios.hpp>
 #include <memory/dma.hpp>
+#include <memory/exe.hpp>
+#include <memory/fastmem.hpp>
 #include <memory/map.hpp>
+#include <memory/memControl.hpp>
+#include <memory/pageTable.hpp>
 #include <memory/ram.hpp>
+#include <profiler.hpp>
+#include <scheduler.hpp>
 
 namespace bus {
 
+// Cycles taken by a load from RAM
+const uint32_t RAM_LOAD_DELAY = 5;
+// Cycles taken by a load from the I/O registers without a
+// configurable timing
+const uint32_t IO_LOAD_DELAY = 2;
+
+// BIOS image used when none is given
+const char *const DEFAULT_BIOS_PATH = "roms/SCPH1001.BIN";
+// The BIOS jumps there to start the shell once its kernel is set up
+const uint32_t SHELL_ENTRY = 0x80030000;
+
 class Bus
 {
 public:
-	Bus();
-	// Fetch the 32 bit little endian word at ‘addr‘
-	uint32_t load32(uint32_t addr);
-	// Store 32bit word `val` into `addr`
-	void store32(uint32_t addr, uint32_t val);
-	// Load 16bit halfword at `addr`
-	uint16_t load16(uint32_t addr);
-	// Store 16bit halfword `val` into `addr`
-	void store16(uint32_t addr, uint16_t val);
-	// Load byte at `addr`
-	uint8_t load8(uint32_t addr);
-	// Store byte `val` into `addr`
-	void store8(uint32_t addr, uint8_t val);
+	// An empty `biosPath` leaves the BIOS zeroed
+	Bus(const std::string &biosPath = DEFAULT_BIOS_PATH);
+
+	// RAM and BIOS accesses are served straight from the page table,
+	// everything else goes to the `io*` handlers
+
+	// Fetch the little endian value at `addr`
+	template<typename T>
+	T load(uint32_t addr)
+	{
+		const uint8_t *p = mPageTable.read(map::maskRegion(addr));
+		if (p)
+			return endian::load<T>(p);
+
+		return ioLoad<T>(addr);
+	}
+
+	// Store the little endian value `val` into `addr`
+	template<typename T>
+	void store(uint32_t addr, T val)
+	{
+		uint32_t abs_addr = map::maskRegion(addr);
+		uint8_t *p = mPageTable.write(abs_addr);
+		if (p)
+		{
+			endian::store<T>(p, val);
+			// Only RAM is writable
+			mCpu.mBlockCache.invalidate(abs_addr & (ram::RAM_SIZE - 1));
+			mRam.markDirty(abs_addr & (ram::RAM_SIZE - 1));
+			return;
+		}
+
+		ioStore<T>(addr, val);
+	}
+
+	// Accesses to the addresses not backed by memory. Each width has
+	// its own set of registers, the handlers are only defined for
+	// uint8_t, uint16_t and uint32_t.
+	template<typename T>
+	T ioLoad(uint32_t addr);
+	template<typename T>
+	void ioStore(uint32_t addr, T val);
+
+	// Run the CPU until cycle `end`, running the device events when
+	// they're due. The CPU isn't interrupted between two events.
+	void runUntil(uint64_t end);
+	// Run until the next vertical blanking
+	void runFrame();
+	// Run the BIOS until it's about to start the shell, its kernel
+	// is initialised by then. Returns false if it doesn't get there
+	// within `maxCycles`.
+	bool bootKernel(uint64_t maxCycles);
+	// Copy `exe` to RAM and jump to its entry point
+	void sideload(const exe::Exe &exe);
+
+	// Cycles taken by a `width` byte load from `abs_addr` in the I/O
+	// zone or KSEG2
+	uint32_t ioLoadDelay(uint32_t abs_addr, uint8_t width);
+	// Rebuild the CPU load delay table from the memory timings
+	void updateLoadDelays();
 
 	// DMA register read
 	uint32_t dmaReg(uint32_t offset);
@@ -32,6 +96,12 @@ public:
 	// DMA register write
 	void setDmaReg(uint32_t offset, uint32_t val);
 
+	// Move the guest memory to a fastmem arena and let the
+	// recompiler use it. Returns false if fastmem isn't supported.
+	bool enableFastmem();
+	// Fill the page table with the RAM (and its mirrors) and BIOS
+	void mapMemory();
+
 	// Execute DMA transfer for a port
 	void doDma(dma::Port port);
 
@@ -43,11 +113,24 @@ public:
 
 	~Bus();
 	map::Map mMap;
+	scheduler::Scheduler mScheduler;
+	memcontrol::MemControl mMemControl;
+	map::PageTable mPageTable;
 	ram::Ram mRam;
 	bios::Bios mBios;
 	cpu::Cpu mCpu;
 	dma::Dma mDma;
 	gpu::Gpu mGpu;
+	fastmem::Fastmem mFastmem;
+	// Host time per subsystem, only counted when started
+	profiler::Profiler mProfiler;
 };
 
+template<> uint32_t Bus::ioLoad<uint32_t>(uint32_t addr);
+template<> uint16_t Bus::ioLoad<uint16_t>(uint32_t addr);
+template<> uint8_t Bus::ioLoad<uint8_t>(uint32_t addr);
+template<> void Bus::ioStore<uint32_t>(uint32_t addr, uint32_t val);
+template<> void Bus::ioStore<uint16_t>(uint32_t addr, uint16_t val);
+template<> void Bus::ioStore<uint8_t>(uint32_t addr, uint8_t val);
+
 } // namespace bus
\ No newline at end of file
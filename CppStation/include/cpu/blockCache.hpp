@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <memory/map.hpp>
+#include <memory/bios.hpp>
+#include <memory/ram.hpp>
+
+namespace bus {
+class Bus;
+}
+
+namespace cpu {
+
+class Cpu;
+
+// Pointer to the method implementing an opcode
+typedef void (Cpu::*OpHandler)(uint32_t instruction);
+
+// Maximum number of instructions decoded into a single block
+const uint32_t BLOCK_MAX_LEN = 64;
+
+// Granularity of the RAM code tracking used for invalidation
+const uint32_t BLOCK_PAGE_SHIFT = 12;
+const uint32_t BLOCK_RAM_PAGES = ram::RAM_SIZE >> BLOCK_PAGE_SHIFT;
+
+// Instruction decoded once and ready to be dispatched
+struct CachedInstruction
+{
+	OpHandler handler;
+	uint32_t instruction;
+};
+
+// Straight line of code ending with a branch and its delay slot (or
+// when the block reaches BLOCK_MAX_LEN instructions)
+struct Block
+{
+	// Physical address of the first instruction
+	uint32_t mAddr;
+	// False once the code under the block has been overwritten
+	bool mValid;
+	std::vector<CachedInstruction> mOps;
+	// Host code generated by the recompiler, nullptr until the
+	// block is recompiled
+	void *mCode;
+	// True if the block is a loop branching back to its start that
+	// only polls memory: once it has run once, every iteration is
+	// the same until a device changes what it reads
+	bool mIdleLoop;
+};
+
+class BlockCache
+{
+public:
+	BlockCache();
+	~BlockCache();
+
+	// Return the block starting at `pc`, decoding it if it's not in
+	// the cache yet. Returns nullptr if `pc` isn't in RAM or BIOS.
+	Block *get(uint32_t pc, bus::Bus *bus);
+
+	// RAM at `offset` has been written: drop any block containing it
+	void invalidate(uint32_t offset)
+	{
+		if (mRamCodePages[offset >> BLOCK_PAGE_SHIFT])
+			invalidatePage(offset >> BLOCK_PAGE_SHIFT);
+	}
+
+	// Drop every cached block
+	void clear();
+
+	// Number of blocks decoded since the start
+	uint64_t mCompiled;
+	// Number of blocks dropped because their code was overwritten
+	uint64_t mInvalidated;
+	// Non-zero for the RAM pages holding at least one block, checked
+	// by the recompiled stores
+	uint8_t mRamCodePages[BLOCK_RAM_PAGES];
+
+private:
+	// Return the lookup slot for physical address `addr` or nullptr
+	// if the address can't hold cached code.
+	Block **slot(uint32_t addr);
+
+	Block *compile(uint32_t pc, uint32_t addr, bus::Bus *bus);
+
+	void invalidatePage(uint32_t page);
+
+	map::Map mMap;
+	// One slot per word of RAM and BIOS
+	std::vector<Block *> mRamBlocks;
+	std::vector<Block *> mBiosBlocks;
+	// Blocks overlapping each RAM page
+	std::vector<Block *> mRamPages[BLOCK_RAM_PAGES];
+	// Invalidated blocks can still be running, they're freed on
+	// the next lookup
+	std::vector<Block *> mGraveyard;
+};
+
+} // namespace cpu
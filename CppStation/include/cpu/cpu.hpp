@@ -2,6 +2,13 @@
 
 #include <cstdint>
 #include "helpers.hpp"
+#include <cpu/blockCache.hpp>
+#include <cpu/gte.hpp>
+#include <cpu/hle.hpp>
+#include <cpu/icache.hpp>
+#include <cpu/jit/lockstep.hpp>
+#include <cpu/jit/recompiler.hpp>
+#include <memory/scratchpad.hpp>
 namespace bus {
 class Bus;
 }
@@ -98,14 +105,84 @@ static inline constexpr uint32_t shift(uint32_t instruction)
 
 } // namespace Instruction
 
+// How the CPU runs the guest code
+enum class ExecutionMode
+{
+	// Fetch and decode every instruction before running it
+	Interpreter,
+	// Same thing with computed goto dispatch, each opcode jumping
+	// directly to the next one
+	ThreadedInterpreter,
+	// Run basic blocks decoded once and kept in the BlockCache
+	CachedInterpreter,
+	// Translate basic blocks to host code
+	Recompiler,
+	// Run every recompiled block through the interpreter as well and
+	// check that both agree
+	RecompilerLockstep,
+};
+
+// CPU clock frequency in Hz
+const uint32_t CPU_CLOCK = 33868800;
+
+// Latency of the multiply/divide unit. Multiplications are faster
+// when the first operand fits in fewer bits.
+const uint32_t MULT_CYCLES_SHORT = 6;
+const uint32_t MULT_CYCLES_MEDIUM = 9;
+const uint32_t MULT_CYCLES_LONG = 13;
+const uint32_t DIV_CYCLES = 36;
+
+// Load delays are looked up per 4MB zone of the physical address
+// space. That's enough to tell RAM, the expansion 1 and the BIOS
+// apart, everything else lives in the I/O zone.
+const uint32_t DELAY_ZONE_SHIFT = 22;
+const uint32_t DELAY_ZONES = 128;
+// Zone of the scratchpad, the I/O registers and the expansion 2
+const uint32_t IO_DELAY_ZONE = 0x1f800000 >> DELAY_ZONE_SHIFT;
+
+// Return the delay zone of `addr`. The segment bits are ignored so
+// it works with unmasked KUSEG, KSEG0 and KSEG1 addresses.
+inline constexpr uint32_t delayZone(uint32_t addr)
+{
+	return (addr >> DELAY_ZONE_SHIFT) & (DELAY_ZONES - 1);
+}
+
+// The threaded interpreter relies on the "labels as values" GNU
+// extension
+#if defined(__GNUC__)
+#define CPU_COMPUTED_GOTO
+const bool THREADED_INTERPRETER_AVAILABLE = true;
+#else
+const bool THREADED_INTERPRETER_AVAILABLE = false;
+#endif
+
 class Cpu {
 public:
 	Cpu();
 	~Cpu();
 
+	// Return the method implementing `instruction`'s opcode
+	static OpHandler decode(uint32_t instruction);
 	// Decode `instruction`'s opcode and run the function
 	void decodeAndExecute(uint32_t instruction);
 	void runNextInstruction();
+	// Run at least `cycles` cycles with the threaded interpreter
+	void runThreaded(uint64_t cycles);
+	// Run the cached block at PC, returns the number of instructions
+	// executed. `end` is the cycle the current slice stops at.
+	uint32_t runNextBlock(uint64_t end);
+	// Run the recompiled block at PC, returns the number of
+	// instructions executed
+	uint32_t runRecompiledBlock(bool lockstep, uint64_t end);
+	// Called after `block`, started at `pc` and `startCycles`, has
+	// run `executed` instructions. Fast-forwards idle loops to the
+	// next scheduler event, or to `end` if the slice stops before.
+	void checkIdleLoop(Block *block, uint32_t pc, uint64_t startCycles, uint32_t executed, uint64_t end);
+	// Run the BIOS kernel call at PC natively if HLE intercepts it.
+	// Returns false if the guest code has to run.
+	bool runHle();
+	// Run at least `cycles` cycles using the current execution mode
+	void run(uint64_t cycles);
 	// Trigger an exception
 	void exception(enum exception::Exception cause);
 
@@ -115,18 +192,51 @@ public:
 	uint32_t reg(RegisterIndex index);
 	// Set the value of a general purpose register
 	void setReg(RegisterIndex index, uint32_t val);
-	// Load 32bit value from the bus
-	uint32_t load32(uint32_t addr);
-	// Store 32bit value into the memory
-	void store32(uint32_t addr, uint32_t val);
-	// Load 16bit value from the memory
-	uint16_t load16(uint32_t addr);
-	// Store 16bit value into the memory
-	void store16(uint32_t addr, uint16_t val);
-	// Load 8bit value from the memory
-	uint8_t load8(uint32_t addr);
-	// Store 8bit value into the memory
-	void store8(uint32_t addr, uint8_t val);
+	// Retrieve the value of a general purpose register including the
+	// pending load, used by LWL and LWR
+	uint32_t regWithPendingLoad(RegisterIndex index);
+	// Load a value from the memory, `T` is uint8_t, uint16_t or
+	// uint32_t for the access width
+	template<typename T>
+	T load(uint32_t addr);
+	// Store a value into the memory
+	template<typename T>
+	void store(uint32_t addr, T val);
+	// Memory loads bypassing the lockstep checker: the scratchpad
+	// is handled here, everything else goes to the bus
+	template<typename T>
+	T loadDirect(uint32_t addr);
+	// Cycles taken by a `width` byte load from `addr`, on top of the
+	// instruction's own
+	uint32_t loadDelay(uint32_t addr, uint8_t width);
+
+	// Cycles taken by an instruction fetched from `pc`, not counting
+	// its loads and stalls
+	uint32_t instructionCycles(uint32_t pc) const
+	{
+		// KUSEG and KSEG0 fetches go through the instruction
+		// cache. Only its tags are tracked, so assume they always
+		// hit.
+		if ((pc >> 29) != 5)
+			return 1;
+
+		return 1 + mLoadDelay[2][delayZone(pc)];
+	}
+
+	// Start a `cycles` long multiplication or division
+	void startMultDiv(uint32_t cycles);
+	// Stall until the multiply/divide unit is done
+	void waitMultDiv()
+	{
+		if (mCycles < mMultDivDone)
+			mCycles = mMultDivDone;
+	}
+	// Stall until the GTE is done with its command
+	void waitGte()
+	{
+		if (mCycles < mGteDone)
+			mCycles = mGteDone;
+	}
 
 	// Load Upper Immediate
 	void opLui(uint32_t instruction);
@@ -149,9 +259,15 @@ public:
 	// Bitwise Or
 	void opOr(uint32_t instruction);
 
-	// Coprocessor 0 opcode
+	// SPECIAL opcode, dispatched on bits [5:0]
+	void opSpecial(uint32_t instruction);
+
+	// Coprocessor 0 opcode, dispatched on bits [25:21]
 	void opCop0(uint32_t instruction);
 
+	// Coprocessor 0 opcode not implemented
+	void opCop0Unhandled(uint32_t instruction);
+
 	// Move To Coprocessor 0
 	void opMtc0(uint32_t instruction);
 
@@ -215,9 +331,24 @@ public:
 	// Jump And Link Register
 	void opJalr(uint32_t instruction);
 
-	// Various branch instructions: BGEZ, BLTZ, BGEZAL, BLTZAL.
-	// Bits 16 and 20 are used to figure out which one to use.
+	// REGIMM branch instructions: BGEZ, BLTZ, BGEZAL, BLTZAL.
+	// Bits [20:16] are used to figure out which one to use.
 	void opBxx(uint32_t instruction);
+	// Branch if `s` is (`is_bgez` ? greater than or equal : less
+	// than) zero, storing the return address in R31 if `is_link`
+	void branchCompareZero(uint32_t instruction, bool is_bgez, bool is_link);
+
+	// Branch if Less Than Zero
+	void opBltz(uint32_t instruction);
+
+	// Branch if Greater than or Equal to Zero
+	void opBgez(uint32_t instruction);
+
+	// Branch if Less Than Zero And Link
+	void opBltzal(uint32_t instruction);
+
+	// Branch if Greater than or Equal to Zero And Link
+	void opBgezal(uint32_t instruction);
 
 	// Set if Less Than Immediate (signed)
 	void opSlti(uint32_t instruction);
@@ -296,8 +427,20 @@ public:
 
 	// Coprocessor 1 opcode (does not exist on the Playstation)
 	void opCop1(uint32_t instruction);
-	// Coprocessor 2 opcode (GTE)
+	// Coprocessor 2 opcode (GTE), dispatched on bits [25:21]
 	void opCop2(uint32_t instruction);
+	// Coprocessor 2 opcode not implemented
+	void opCop2Unhandled(uint32_t instruction);
+	// Move From Coprocessor 2 data register
+	void opMfc2(uint32_t instruction);
+	// Move From Coprocessor 2 control register
+	void opCfc2(uint32_t instruction);
+	// Move To Coprocessor 2 data register
+	void opMtc2(uint32_t instruction);
+	// Move To Coprocessor 2 control register
+	void opCtc2(uint32_t instruction);
+	// GTE command in bits [24:0]
+	void opGteCommand(uint32_t instruction);
 	// Coprocessor 3 opcode (does not exist on the Playstation)
 	void opCop3(uint32_t instruction);
 
@@ -333,6 +476,10 @@ public:
 	// Illegal instruction
 	void opIllegal(uint32_t instruction);
 
+	// Execute an already fetched and decoded instruction, handling
+	// the branch and load delay slots
+	void executeInstruction(OpHandler handler, uint32_t instruction);
+
 	// The program counter register
 	uint32_t mPc;
 	// Instruction count
@@ -344,13 +491,14 @@ public:
 	// General Purpose Registers.
 	// The first entry must always contain 0.
 	uint32_t mRegs[32];
-	// 2nd set of registers used to emulate the load delay slot
-	// accurately. They contain the output of the current
-	// instruction.
-	uint32_t mOutRegs[32];
 	// Load initiated by the current instruction
 	RegisterIndex mLoadRegIdx;
 	uint32_t mLoadReg;
+	// Load initiated by the previous instruction. It only lands in
+	// `mRegs` once the current instruction is done, unless the
+	// current instruction writes to the same register.
+	RegisterIndex mPendingLoadRegIdx;
+	uint32_t mPendingLoadReg;
 
 	// Cop0 register 12: Status Register
 	uint32_t mSr;
@@ -370,6 +518,49 @@ public:
 	// Set if the current instruction executes in the delay slot
 	bool mDelaySlot;
 
+	// Elapsed CPU cycles
+	uint64_t mCycles;
+	// Cycle at which the multiply/divide unit is done
+	uint64_t mMultDivDone;
+	// Cycle at which the GTE is done with the last command
+	uint64_t mGteDone;
+	// Cycles taken by each instruction of the block being run by
+	// the recompiler
+	uint32_t mInstructionCycles;
+	// Load delays indexed by access width (byte, halfword, word)
+	// and delay zone, set up by the bus. The entry for the I/O
+	// zone is the scratchpad's, the I/O registers are handled by
+	// `Bus::ioLoadDelay`.
+	uint8_t mLoadDelay[3][DELAY_ZONES];
+
+	// Interpreter used by `run`
+	ExecutionMode mExecutionMode;
+	// Pre-decoded blocks used by the cached interpreter and the
+	// recompiler
+	BlockCache mBlockCache;
+	// x86-64 dynamic recompiler
+	jit::Recompiler mRecompiler;
+	// Recompiler checker
+	jit::Lockstep mLockstep;
+
+	// Skip the idle loops run by the cached interpreter and the
+	// recompiler
+	bool mIdleSkipping;
+	// Idle loop that has just completed an iteration, nullptr if
+	// the last block wasn't one
+	Block *mIdleBlock;
+	// Number of idle loops fast-forwarded and cycles skipped
+	uint64_t mIdleLoopsSkipped;
+	uint64_t mIdleCyclesSkipped;
+	// Data cache used as scratchpad RAM
+	scratchpad::Scratchpad mScratchpad;
+	// Instruction cache tags and CACHE_CONTROL
+	icache::ICache mICache;
+	// Coprocessor 2
+	gte::Gte mGte;
+	// High-level emulation of the BIOS kernel calls
+	hle::Hle mHle;
+
 	// Linkage to the communications bus
 	bus::Bus *mBus = nullptr;
 	// Link this CPU to a communications bus
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstdint>
+
+namespace cpu {
+namespace gte {
+
+// The matrix kernels have a SIMD version when the host supports it,
+// the scalar one is always there as a reference
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#define GTE_SIMD
+const bool SIMD_AVAILABLE = true;
+#else
+const bool SIMD_AVAILABLE = false;
+#endif
+
+// Matrices, in the order of their control registers
+enum Matrix
+{
+	Rotation = 0,
+	Light = 1,
+	LightColor = 2,
+	MATRIX_COUNT = 3,
+};
+
+// Vectors added to the matrix products, in the order of their control
+// registers. `Zero` is used when an MVMVA doesn't add anything.
+enum Vector
+{
+	Translation = 0,
+	BackgroundColor = 1,
+	FarColor = 2,
+	Zero = 3,
+	VECTOR_COUNT = 4,
+};
+
+// Geometry Transformation Engine, the fixed-point vector unit used as
+// coprocessor 2. All the commands are computed the way the hardware
+// does it, including the intermediate overflows and the saturation
+// flags.
+class Gte
+{
+public:
+	Gte();
+
+	// Data registers 0 to 31, accessed by MFC2/MTC2 and LWC2/SWC2
+	uint32_t data(uint32_t reg) const;
+	void setData(uint32_t reg, uint32_t val);
+	// Control registers 0 to 31, accessed by CFC2/CTC2
+	uint32_t control(uint32_t reg) const;
+	void setControl(uint32_t reg, uint32_t val);
+
+	// Run the command in bits [24:0] of a COP2 instruction, returns
+	// the number of cycles it takes
+	uint32_t command(uint32_t cmd);
+
+	// Use the SIMD matrix kernels
+	bool mSimd;
+
+private:
+	// Perspective transformation of a vector once `transform` has
+	// been applied to it. `last` is set for the final one of the
+	// command, which also computes the depth cueing.
+	void project(const int64_t res[3], uint32_t shift, bool lm, bool last);
+	void nclip();
+	void op(uint32_t shift, bool lm);
+	void dpcs(const uint8_t color[4], uint32_t shift, bool lm);
+	void intpl(uint32_t shift, bool lm);
+	void mvmva(uint32_t cmd, uint32_t shift, bool lm);
+	void ncds(uint32_t v, uint32_t shift, bool lm);
+	void nccs(uint32_t v, uint32_t shift, bool lm);
+	void ncs(uint32_t v, uint32_t shift, bool lm);
+	void sqr(uint32_t shift, bool lm);
+	void avsz3();
+	void avsz4();
+	void gpf(uint32_t shift, bool lm);
+	void gpl(uint32_t shift, bool lm);
+
+	// Lighting steps shared by the NC*, C* and D* commands: light
+	// intensities of vector `v`, light color, multiplication by the
+	// vertex color and depth cueing of that product
+	void lightVector(uint32_t v, uint32_t shift, bool lm);
+	void lightColor(uint32_t shift, bool lm);
+	void colorProduct(uint32_t shift, bool lm);
+	void depthCue(uint32_t shift, bool lm);
+	// MAC1-3 = in + (FC - in) * IR0
+	void interpolate(int64_t mac1, int64_t mac2, int64_t mac3, uint32_t shift, bool lm);
+
+	// Matrix product of `columns` with `v` plus `vector` << 12, with
+	// the 44 bit overflow checks of the intermediate sums. Returns the
+	// full precision results.
+	void transform(const int32_t columns[3][4], const int32_t vector[4], const int16_t v[3], int64_t res[3]);
+	// Same thing, storing the results in MAC1-3 and IR1-3
+	void mulMatVec(const int32_t columns[3][4], const int32_t vector[4], const int16_t v[3], uint32_t shift, bool lm);
+
+	// Flag the overflows of 44 bit MAC `index` value `val`
+	int64_t checkMac(uint32_t index, int64_t val);
+	// Check `val` then wrap it to 44 bits like the hardware adders
+	int64_t extendMac(uint32_t index, int64_t val);
+	void setMac(uint32_t index, int64_t val, uint32_t shift);
+	void setMac0(int64_t val);
+	void setIr(uint32_t index, int32_t val, bool lm);
+	void setIr0(int32_t val);
+	void setMacIr(uint32_t index, int64_t val, uint32_t shift, bool lm);
+	void setOtz(int32_t val);
+	void pushSz(int32_t val);
+	void pushSxy(int32_t x, int32_t y);
+	// Push MAC1-3 / 16 to the color FIFO
+	void pushColor();
+
+	// Vectors V0 to V2 (data registers 0 to 5)
+	int16_t mV[3][3];
+	// Color and GPU command code (6)
+	uint8_t mRgbc[4];
+	// Average Z value (7)
+	uint16_t mOtz;
+	// Intermediate values IR0 to IR3 (8 to 11)
+	int16_t mIr[4];
+	// Screen XY FIFO (12 to 15)
+	int16_t mSxy[3][2];
+	// Screen Z FIFO (16 to 19)
+	uint16_t mSz[4];
+	// Color FIFO (20 to 22)
+	uint8_t mRgb[3][4];
+	// Unused but readable and writable (23)
+	uint32_t mRes1;
+	// Accumulators MAC0 to MAC3 (24 to 27)
+	int32_t mMac[4];
+	// Leading zeros/ones count source (30) and result (31)
+	uint32_t mLzcs;
+	uint32_t mLzcr;
+
+	// Matrices stored column by column, each padded to 4 rows so
+	// that the SIMD kernels can load them directly (control
+	// registers 0 to 4, 8 to 12 and 16 to 20)
+	int32_t mMatrices[MATRIX_COUNT][3][4];
+	// Translation, background color and far color, padded as well
+	// (5 to 7, 13 to 15 and 21 to 23)
+	int32_t mVectors[VECTOR_COUNT][4];
+	// Screen offset (24, 25)
+	int32_t mOfx;
+	int32_t mOfy;
+	// Projection plane distance (26)
+	uint16_t mH;
+	// Depth cueing coefficient and offset (27, 28)
+	int16_t mDqa;
+	int32_t mDqb;
+	// Average Z scale factors (29, 30)
+	int16_t mZsf3;
+	int16_t mZsf4;
+	// Saturation and overflow flags of the last command (31)
+	uint32_t mFlag;
+};
+
+} // namespace gte
+} // namespace cpu
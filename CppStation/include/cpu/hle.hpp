@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace cpu {
+
+class Cpu;
+
+namespace hle {
+
+// BIOS kernel function tables, called by jumping to 0xa0, 0xb0 and
+// 0xc0 with the function number in `t1`
+enum Table
+{
+	A0 = 0,
+	B0 = 1,
+	C0 = 2,
+	TABLE_COUNT = 3,
+};
+
+// Function numbers are used as an index in the kernel tables, none of
+// them goes past 0xff
+const uint32_t FUNCTION_COUNT = 256;
+
+// High-level emulation of the BIOS kernel calls. When a call to one of
+// the enabled functions is intercepted its native version runs
+// directly on the RAM and returns to the caller, the guest code of
+// the kernel doesn't run at all.
+//
+// The native versions only handle the common cases (valid pointers and
+// lengths, buffers entirely in RAM), anything else is left to the BIOS
+// so that its exact behavior is kept.
+class Hle
+{
+public:
+	Hle();
+
+	// True if `pc` is one of the kernel call entry points and some
+	// functions are enabled
+	bool isEntry(uint32_t pc) const
+	{
+		uint32_t abs = pc & 0x1fffffff;
+
+		return mActive && abs >= 0xa0 && abs <= 0xc0 && (abs & 0xf) == 0;
+	}
+
+	// Run the call made to entry point `pc` natively. Returns false
+	// if the BIOS has to run it. On success `ret` is the value for
+	// `v0` and `cycles` the estimated number of guest cycles the
+	// BIOS would have taken.
+	bool call(Cpu &cpu, uint32_t pc, uint32_t &ret, uint64_t &cycles);
+
+	// Enable or disable the native version of a function, returns
+	// false if there's none
+	bool enable(Table table, uint32_t function, bool enabled);
+	// Enable every function having a native version
+	void enableAll();
+	// Enable the functions in `list`, a comma separated list of
+	// `table:function` entries in hex (e.g. "A0:2A,A0:1B"). Returns
+	// false if an entry isn't valid.
+	bool enableList(const std::string &list);
+	// Enable the same functions as `other`
+	void enableSame(const Hle &other);
+
+	// Print the calls intercepted so far and the cycles they saved
+	void printStats() const;
+
+	// Total number of calls intercepted and guest cycles saved
+	uint64_t mCalls;
+	uint64_t mCyclesSaved;
+
+private:
+	// Native version of a function: arguments come from `a0` to
+	// `a3`. Returns false if the BIOS has to run it, otherwise sets
+	// the return value and the number of bytes processed.
+	typedef bool (Hle::*Handler)(uint32_t &ret, uint32_t &bytes);
+
+	struct Function
+	{
+		const char *mName;
+		Handler mHandler;
+		// Cost of the BIOS version in instructions: fixed part,
+		// including the dispatch through the kernel table, and
+		// per byte processed
+		uint32_t mBaseInstructions;
+		uint32_t mByteInstructions;
+		bool mEnabled;
+		uint64_t mCalls;
+		uint64_t mCyclesSaved;
+	};
+
+	void add(Table table, uint32_t function, const char *name, Handler handler,
+			 uint32_t baseInstructions, uint32_t byteInstructions);
+
+	// Host pointer for `len` bytes of RAM at guest address `addr`,
+	// nullptr if they're not all in RAM
+	uint8_t *ram(uint32_t addr, uint32_t len) const;
+	// Length of the string at `addr`, -1 if it doesn't end in RAM
+	int32_t stringLength(uint32_t addr) const;
+	// `len` bytes of RAM at `addr` have been written
+	void written(uint32_t addr, uint32_t len);
+
+	uint32_t arg(uint32_t index) const;
+
+	// A0 table
+	bool strcat(uint32_t &ret, uint32_t &bytes);
+	bool strcpy(uint32_t &ret, uint32_t &bytes);
+	bool strlen(uint32_t &ret, uint32_t &bytes);
+	bool bzero(uint32_t &ret, uint32_t &bytes);
+	bool memcpy(uint32_t &ret, uint32_t &bytes);
+	bool memset(uint32_t &ret, uint32_t &bytes);
+	bool flushCache(uint32_t &ret, uint32_t &bytes);
+
+	Function mFunctions[TABLE_COUNT][FUNCTION_COUNT];
+	// True if at least one function is enabled
+	bool mActive;
+	// CPU making the current call
+	Cpu *mCpu;
+};
+
+} // namespace hle
+} // namespace cpu
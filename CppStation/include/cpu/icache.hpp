@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+
+namespace cpu {
+namespace icache {
+
+// 4kB direct mapped instruction cache, 256 lines of 4 words
+const uint32_t LINE_SIZE = 16;
+const uint32_t LINE_COUNT = 256;
+
+// CACHE_CONTROL bits (0xfffe0130)
+// Isolated stores write the tags instead of the instructions
+const uint32_t TAG_TEST = 1 << 2;
+const uint32_t ENABLE = 1 << 11;
+
+// Tags as kept by `ICache`: address bits 31:12 of the line and a valid
+// bit per word
+const uint32_t TAG_MASK = 0xfffff000;
+const uint32_t VALID_MASK = 0xf;
+
+// State of the instruction cache as seen by the code maintaining it.
+// The fetches aren't emulated (they're assumed to always hit), what's
+// tracked is what the BIOS does to the cache through CACHE_CONTROL and
+// the cache isolation: the tags and their valid bits. The instructions
+// written to the cache while isolated aren't kept, nothing reads them.
+class ICache
+{
+public:
+	ICache() :
+		mControl(0)
+	{
+		invalidateAll();
+	}
+
+	// Store done while the cache is isolated (SR bit 16). In tag test
+	// mode the line of `addr` gets the tag of `addr` and is
+	// invalidated, whatever is written, otherwise the word goes to the
+	// cache data.
+	void isolatedStore(uint32_t addr)
+	{
+		if (mControl & TAG_TEST)
+			mTags[line(addr)] = addr & TAG_MASK;
+	}
+
+	// What the BIOS FlushCache loop leaves behind: every line tagged
+	// with its index in the first 4kB and invalid
+	void invalidateAll()
+	{
+		for (uint32_t i = 0; i < LINE_COUNT; i++)
+			mTags[i] = 0;
+	}
+
+	static uint32_t line(uint32_t addr)
+	{
+		return (addr / LINE_SIZE) & (LINE_COUNT - 1);
+	}
+
+	// CACHE_CONTROL register
+	uint32_t mControl;
+	uint32_t mTags[LINE_COUNT];
+};
+
+} // namespace icache
+} // namespace cpu
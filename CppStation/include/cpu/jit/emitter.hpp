@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace cpu {
+namespace jit {
+
+// x86-64 general purpose registers
+enum Reg : uint8_t
+{
+	RAX = 0,
+	RCX = 1,
+	RDX = 2,
+	RBX = 3,
+	RSP = 4,
+	RBP = 5,
+	RSI = 6,
+	RDI = 7,
+	R8  = 8,
+	R9  = 9,
+	R10 = 10,
+	R11 = 11,
+	R12 = 12,
+	R13 = 13,
+	R14 = 14,
+	R15 = 15,
+};
+
+// Condition codes used by Jcc and SETcc
+enum Cond : uint8_t
+{
+	// Unsigned comparisons
+	CondB  = 0x2,
+	CondBE = 0x6,
+	CondE  = 0x4,
+	CondNE = 0x5,
+	// Signed comparisons
+	CondL  = 0xc,
+	CondGE = 0xd,
+	CondLE = 0xe,
+	CondG  = 0xf,
+};
+
+// Arithmetic/logic operations, the value is the /digit used by the
+// immediate forms
+enum class Alu : uint8_t
+{
+	Add = 0,
+	Or  = 1,
+	And = 4,
+	Sub = 5,
+	Xor = 6,
+	Cmp = 7,
+};
+
+// Shift operations, the value is the /digit of the opcode
+enum class Shift : uint8_t
+{
+	Shl = 4,
+	Shr = 5,
+	Sar = 7,
+};
+
+// Block of memory the generated code is written to and run from
+class CodeBuffer
+{
+public:
+	CodeBuffer(size_t size);
+	~CodeBuffer();
+
+	// Return true if at least `size` bytes are still available
+	bool hasRoom(size_t size) const { return mUsed + size <= mSize; }
+	uint8_t *current() const { return mBase + mUsed; }
+	// Forget about all the code generated so far
+	void reset() { mUsed = 0; }
+
+	uint8_t *mBase;
+	size_t mSize;
+	size_t mUsed;
+};
+
+// Jump target. Jumps emitted before the label is bound are patched
+// once its position is known.
+struct Label
+{
+	static const size_t UNBOUND = std::numeric_limits<size_t>::max();
+
+	std::vector<size_t> mFixups;
+	size_t mPos = UNBOUND;
+};
+
+// Minimal x86-64 instruction encoder. Memory operands are always
+// relative to a base register plus an optional index scaled by 4,
+// which is all the recompiler needs to access the Cpu state. The
+// "host" accesses use an unscaled index for fastmem.
+class Emitter
+{
+public:
+	Emitter(CodeBuffer &buffer);
+
+	// Commit the generated code into the buffer and return its
+	// entry point
+	uint8_t *finish();
+
+	size_t size() const { return mCode.size(); }
+
+	// mov r32, [base + disp]
+	void movRegMem(Reg dst, Reg base, int32_t disp);
+	// mov r32, [base + index * 4 + disp]
+	void movRegMemIndex(Reg dst, Reg base, Reg index, int32_t disp);
+	// mov [base + disp], r32
+	void movMemReg(Reg base, int32_t disp, Reg src);
+	// mov [base + index * 4 + disp], r32
+	void movMemIndexReg(Reg base, Reg index, int32_t disp, Reg src);
+	// mov dword [base + disp], imm32
+	void movMemImm(Reg base, int32_t disp, uint32_t imm);
+	// mov r8, byte [base + disp]
+	void movRegMem8(Reg dst, Reg base, int32_t disp);
+	// mov byte [base + disp], r8
+	void movMemReg8(Reg base, int32_t disp, Reg src);
+	// mov byte [base + disp], imm8
+	void movMemImm8(Reg base, int32_t disp, uint8_t imm);
+	// mov r32, imm32
+	void movRegImm(Reg dst, uint32_t imm);
+	// mov r64, imm64
+	void movRegImm64(Reg dst, uint64_t imm);
+	// mov r64, r64
+	void movReg64(Reg dst, Reg src);
+	// mov r64, [base + disp]
+	void movRegMem64(Reg dst, Reg base, int32_t disp);
+	// mov [base + disp], r64
+	void movMemReg64(Reg base, int32_t disp, Reg src);
+	// movzx r32, byte [base + index + disp]
+	void movzxRegMemIndex8(Reg dst, Reg base, Reg index, int32_t disp);
+
+	// op r32, [base + disp]
+	void aluRegMem(Alu op, Reg dst, Reg base, int32_t disp);
+	// op r32, imm32
+	void aluRegImm(Alu op, Reg dst, uint32_t imm);
+	// op dword [base + disp], imm32
+	void aluMemImm(Alu op, Reg base, int32_t disp, uint32_t imm);
+	// op r64, [base + disp]
+	void aluRegMem64(Alu op, Reg dst, Reg base, int32_t disp);
+	// op qword [base + disp], r64
+	void aluMemReg64(Alu op, Reg base, int32_t disp, Reg src);
+	// cmp byte [base + disp], imm8
+	void cmpMemImm8(Reg base, int32_t disp, uint8_t imm);
+	// shift r32, imm8
+	void shiftRegImm(Shift op, Reg dst, uint8_t imm);
+	// shift r32, cl
+	void shiftRegCl(Shift op, Reg dst);
+	// not r32
+	void notReg(Reg dst);
+	// setcc r8; movzx r32, r8
+	void setcc(Cond cond, Reg dst);
+	// test r32, imm32
+	void testRegImm(Reg dst, uint32_t imm);
+	// test dword [base + disp], imm32
+	void testMemImm(Reg base, int32_t disp, uint32_t imm);
+	// cmp byte [base + index + disp], imm8
+	void cmpMemIndexImm8(Reg base, Reg index, int32_t disp, uint8_t imm);
+	// mov byte [base + index + disp], imm8
+	void movMemIndexImm8(Reg base, Reg index, int32_t disp, uint8_t imm);
+
+	// Load `size` (1, 2 or 4) bytes at [base + index] into `dst`,
+	// zero or sign extended
+	void loadHost(Reg dst, Reg base, Reg index, uint8_t size, bool sign);
+	// Store the `size` low bytes of `src` at [base + index]
+	void storeHost(Reg base, Reg index, Reg src, uint8_t size);
+
+	void push(Reg reg);
+	void pop(Reg reg);
+	// sub rsp, imm8
+	void subRsp(uint8_t imm);
+	// add rsp, imm8
+	void addRsp(uint8_t imm);
+	// Call an absolute address (clobbers RAX)
+	void call(const void *target);
+	void ret();
+
+	// jcc label
+	void jcc(Cond cond, Label &label);
+	// jmp label
+	void jmp(Label &label);
+	// Point all the jumps to `label` at the current position
+	void bind(Label &label);
+
+private:
+	void emit8(uint8_t v);
+	void emit32(uint32_t v);
+	void emit64(uint64_t v);
+	// Emit a REX prefix if needed
+	void rex(bool w, uint8_t reg, uint8_t index, uint8_t base, bool force = false);
+	// Emit the ModRM/SIB/displacement for [base + index * scale + disp]
+	void modrmMem(uint8_t reg, Reg base, int32_t disp, int index = -1, uint8_t scale = 4);
+	// Emit an instruction with a memory operand
+	void opMem(uint8_t opcode, uint8_t reg, Reg base, int32_t disp, int index = -1,
+			   bool w = false, bool byteReg = false, uint8_t scale = 4);
+	// Emit the rel32 of a jump to `label`
+	void emitTarget(Label &label);
+
+	CodeBuffer &mBuffer;
+	std::vector<uint8_t> mCode;
+};
+
+} // namespace jit
+} // namespace cpu
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <cpu/gte.hpp>
+
+namespace cpu {
+
+class Cpu;
+struct Block;
+
+namespace jit {
+
+// Copy of the CPU registers compared after each block
+struct CpuState
+{
+	uint32_t mPc;
+	uint32_t mNextPc;
+	uint32_t mCurrentPc;
+	uint32_t mIp;
+	uint32_t mRegs[32];
+	uint32_t mLoadRegIdx;
+	uint32_t mLoadReg;
+	uint32_t mSr;
+	uint32_t mCause;
+	uint32_t mEpc;
+	uint32_t mHi;
+	uint32_t mLo;
+	bool mBranch;
+	bool mDelaySlot;
+	uint64_t mCycles;
+	uint64_t mMultDivDone;
+	uint64_t mGteDone;
+	gte::Gte mGte;
+
+	void save(const Cpu &cpu);
+	void restore(Cpu &cpu) const;
+	// Return a description of the registers that differ from `other`
+	std::string diff(const CpuState &other) const;
+};
+
+// Memory access made while running a block
+struct MemoryAccess
+{
+	uint32_t addr;
+	uint32_t val;
+	uint8_t width;
+	bool store;
+};
+
+// Debug mode running every recompiled block a second time with the
+// interpreter. The memory accesses made by the recompiled code are
+// recorded and replayed to the interpreter so that side effects only
+// happen once. Any divergence is fatal.
+class Lockstep
+{
+public:
+	Lockstep();
+
+	// Run the recompiled `block` then check it against the
+	// interpreter. Returns the number of instructions executed.
+	uint32_t run(Cpu &cpu, Block *block);
+
+	// True while a block is being recorded or replayed, in which case
+	// the Cpu memory accesses must go through `load` and `store`
+	bool active() const { return mMode != Mode::Off; }
+
+	// Load `width` bytes at `addr`
+	uint32_t load(Cpu *cpu, uint32_t addr, uint8_t width);
+
+	// Store `width` bytes of `val` at `addr`. Returns true if the
+	// store has to be forwarded to the memory.
+	bool store(uint32_t addr, uint32_t val, uint8_t width);
+
+	// Number of blocks checked so far
+	uint64_t mBlocksChecked;
+
+private:
+	enum class Mode
+	{
+		Off,
+		Record,
+		Replay,
+	};
+
+	Mode mMode;
+	std::vector<MemoryAccess> mAccesses;
+	size_t mReplayPos;
+	// Guest address of the block being checked, for error reporting
+	uint32_t mBlockPc;
+};
+
+} // namespace jit
+} // namespace cpu
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+
+#include <cpu/blockCache.hpp>
+#include <cpu/jit/emitter.hpp>
+
+namespace cpu {
+
+class Cpu;
+
+namespace jit {
+
+// The recompiler generates x86-64 code, other hosts have to use one
+// of the interpreters
+#if defined(__x86_64__) || defined(_M_X64)
+const bool AVAILABLE = true;
+#else
+const bool AVAILABLE = false;
+#endif
+
+// Size of the buffer holding the generated code. Once it's full all
+// the blocks are recompiled from scratch.
+const size_t CODE_BUFFER_SIZE = 16 * 1024 * 1024;
+
+// Entry point of a recompiled block, returns the number of guest
+// instructions executed
+typedef uint32_t (*BlockFn)(Cpu *cpu);
+
+class Recompiler
+{
+public:
+	Recompiler();
+	~Recompiler();
+
+	// Generate the host code for `block`. Returns false if the code
+	// buffer is full.
+	bool compile(Cpu &cpu, Block *block);
+	// Run the code generated for `block`, returns the number of
+	// guest instructions executed
+	uint32_t run(Cpu &cpu, Block *block);
+
+	// Drop all the generated code. The blocks referencing it must be
+	// dropped as well.
+	void reset();
+
+	// Generate direct host accesses to the guest memory mapped at
+	// `base`. Must be called before any block is compiled.
+	void enableFastmem(uint8_t *base);
+
+	// Fault handler redirecting the fastmem accesses that hit an
+	// unmapped page to their slow path
+	static void *handleFault(void *pc);
+
+	// Number of blocks recompiled since the start
+	uint64_t mCompiled;
+	// Number of fastmem accesses that had to take the slow path
+	// after a fault
+	uint64_t mFastmemFaults;
+
+private:
+	CodeBuffer mBuffer;
+	// Fastmem arena, nullptr if disabled
+	uint8_t *mFastmemBase;
+	// Host address of each fastmem access that can fault and of its
+	// slow path
+	std::unordered_map<const uint8_t *, const uint8_t *> mFaultSites;
+};
+
+} // namespace jit
+} // namespace cpu
@@ -1,9 +1,10 @@
 #pragma once
 
-#include <gpu/opengl/renderer.hpp>
-#include "helpers.hpp"
+#include <memory>
 
-using namespace gpu::opengl::renderer;
+#include <gpu/renderer.hpp>
+#include <scheduler.hpp>
+#include "helpers.hpp"
 
 namespace bus {
 class Bus;
@@ -11,6 +12,12 @@ class Bus;
 
 namespace gpu {
 
+// CPU cycles per video frame: 263 lines of 3413 GPU cycles for NTSC
+// and 314 lines of 3406 GPU cycles for PAL, converted from the GPU
+// clock
+const uint32_t NTSC_FRAME_CYCLES = 566204;
+const uint32_t PAL_FRAME_CYCLES = 680824;
+
 // Possible states for the GP0 command register
 enum class Gp0Mode {
 	// Default mode: handling commands
@@ -106,7 +113,28 @@ public:
 	Gpu();
 	~Gpu();
 
-	Renderer mRenderer;
+	// Backend receiving the primitives, a NullRenderer until
+	// `setRenderer` is called
+	std::unique_ptr<Renderer> mRenderer;
+	// Switch to `renderer`, which gets initialised and the current
+	// display settings
+	void setRenderer(std::unique_ptr<Renderer> renderer);
+	// Display settings passed to the renderer
+	DisplayConfig displayConfig() const;
+	// Drawing settings passed to the renderer
+	DrawingConfig drawingConfig() const;
+	// False while the frames being emulated won't be shown, the
+	// renderer isn't called at all then, unless it keeps a VRAM
+	bool mRendering;
+	// Turn the renderer calls on or off, it gets the current
+	// settings when turned back on
+	void setRendering(bool enabled);
+	// True if the renderer gets the drawing commands: while
+	// rendering, or all the time if it keeps a VRAM
+	bool drawing() const
+	{
+		return mRendering || mRenderer->vram();
+	}
 
 	// Texture page base X coordinate (4 bits, 64 byte increment)
 	uint8_t mPageBaseX;
@@ -186,6 +214,10 @@ public:
 	bool mInterrupt;
 	// DMA request direction
 	DmaDirection mDmaDirection;
+	// Scheduler event raised at the start of the vertical blanking
+	scheduler::EventId mVblankEvent;
+	// Number of vertical blankings so far
+	uint64_t mFrames;
 
 	// Buffer containing the current GP0 command
 	CommandBuffer mGp0Command;
@@ -196,6 +228,16 @@ public:
 	// Current mode of the GP0 register
 	Gp0Mode mGp0Mode;
 
+	// Register the video timing events with the bus scheduler
+	void setupEvents();
+
+	// CPU cycles between two vertical blankings in the current
+	// video mode
+	uint32_t frameCycles() const;
+
+	// Start of the vertical blanking, due at `cycle`
+	void vblank(uint64_t cycle);
+
 	// Retreive value of the status register
 	uint32_t status();
 
@@ -205,6 +247,10 @@ public:
 	// Handle writes to the GP0 command register
 	void gp0(uint32_t val);
 
+	// Set the length and the method of the GP0 command starting with
+	// word `val`
+	void gp0SetupCommand(uint32_t val);
+
 	// GP0(0x00): No Operation
 	void gp0Nop();
 
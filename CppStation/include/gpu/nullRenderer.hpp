@@ -0,0 +1,34 @@
+#pragma once
+
+#include <gpu/renderer.hpp>
+
+namespace gpu {
+
+// Backend drawing nothing, it only counts what it receives. It doesn't
+// need a display so it's the one used for headless runs and
+// benchmarks.
+class NullRenderer : public Renderer
+{
+public:
+	NullRenderer();
+
+	void pushTriangle(Vertex v1, Vertex v2, Vertex v3, bool shaded) override;
+	void pushQuad(Vertex v1, Vertex v2, Vertex v3, Vertex v4, bool shaded) override;
+	void imageLoad(uint16_t x, uint16_t y, uint16_t width, uint16_t height) override;
+	void imageLoadData(uint32_t pixels) override;
+	void imageStore(uint16_t x, uint16_t y, uint16_t width, uint16_t height) override;
+	void setDisplay(const DisplayConfig &config) override;
+	void display() override;
+
+	uint64_t mTriangles;
+	uint64_t mQuads;
+	uint64_t mImageLoads;
+	// 32 bit words of pixel data received by the image loads
+	uint64_t mImageLoadWords;
+	uint64_t mImageStores;
+	uint64_t mFrames;
+	// Last display settings
+	DisplayConfig mDisplay;
+};
+
+} // namespace gpu
@@ -2,8 +2,10 @@
 
 #include <thread>
 
+#include <gpu/renderer.hpp>
 #include <gpu/opengl/core.hpp>
 #include <gpu/opengl/window.hpp>
+#include <gpu/opengl/shaderProgram.hpp>
 #include <ui/input.hpp>
 
 using namespace gpu::opengl::window;
@@ -15,36 +17,10 @@ namespace renderer {
 // Maximum number of vertex that can be stored in an attribute buffers
 static const uint32_t VERTEX_BUFFER_LEN = 16 * 1024;
 
-struct Position
-{
-	int16_t x;
-	int16_t y;
-
-	static struct Position fromPacked(uint32_t val)
-	{
-		return {int16_t(val), int16_t(val >> 16)};
-	}
-};
-
-struct Color
-{
-	GLfloat r;
-	GLfloat g;
-	GLfloat b;
-
-	static struct Color fromPacked(uint32_t val)
-	{
-		return {uint8_t(val) / 255.0f, uint8_t(val >> 8) / 255.0f, uint8_t(val >> 16) / 255.0f};
-	}
-};
-
-struct Vertex
-{
-	Position pos;
-	Color color;
-};
-
-class Renderer
+// Backend drawing with OpenGL in a GLFW window. Each renderer has its
+// own window and GL objects, GLFW itself is shared by all of them and
+// must only be used from the main thread.
+class Renderer : public gpu::Renderer
 {
 public:
 	Renderer();
@@ -55,13 +31,22 @@ public:
 	uint32_t mVerticesNum;
 	GLuint mVao;
 	GLuint mVbo;
+	gpu::opengl::shaderProgram::ShaderProgram mShader;
+	// Set once `init` has created the window and the GL objects
+	bool mInitialised;
 
-	void init();
+	void init() override;
 	void pushVertex(Vertex v);
-	void pushTriangle(Vertex v1, Vertex v2, Vertex v3);
-	void pushQuad(Vertex v1, Vertex v2, Vertex v3, Vertex v4);
+	void pushTriangle(Vertex v1, Vertex v2, Vertex v3, bool shaded) override;
+	void pushQuad(Vertex v1, Vertex v2, Vertex v3, Vertex v4, bool shaded) override;
+	// XXX VRAM isn't emulated yet, the transfers are ignored
+	void imageLoad(uint16_t x, uint16_t y, uint16_t width, uint16_t height) override {}
+	void imageLoadData(uint32_t pixels) override {}
+	void imageStore(uint16_t x, uint16_t y, uint16_t width, uint16_t height) override {}
+	void setDisplay(const DisplayConfig &config) override {}
 	void draw();
-	void display();
+	void display() override;
+	bool shouldClose() const override { return mWindow.shouldClose(); }
 };
 
 } // namespace gpu
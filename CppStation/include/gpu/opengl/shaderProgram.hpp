@@ -1,3 +1,5 @@
+#pragma once
+
 #include <gpu/opengl/core.hpp>
 
 namespace gpu {
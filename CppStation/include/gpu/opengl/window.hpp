@@ -1,6 +1,7 @@
 #pragma once
 
 #include <gpu/opengl/core.hpp>
+#include <ui/input.hpp>
 
 namespace gpu {
 namespace opengl {
@@ -19,7 +20,12 @@ public:
 
 	bool mShouldClose;
 
+	// Keyboard and mouse state, once the callbacks are installed
+	ui::input::Input mInput;
+
 	void init(int width, int height, const char* title, bool fullScreenMode);
+	// Destroy the native window, the destructor does it as well
+	void destroy();
 	[[nodiscard]] bool shouldClose() const;
 
 	void installMainCallbacks();
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+
+namespace gpu {
+
+class Vram;
+
+struct Position
+{
+	int16_t x;
+	int16_t y;
+
+	static struct Position fromPacked(uint32_t val)
+	{
+		return {int16_t(val), int16_t(val >> 16)};
+	}
+};
+
+struct Color
+{
+	float r;
+	float g;
+	float b;
+
+	static struct Color fromPacked(uint32_t val)
+	{
+		return {uint8_t(val) / 255.0f, uint8_t(val >> 8) / 255.0f, uint8_t(val >> 16) / 255.0f};
+	}
+};
+
+struct Vertex
+{
+	Position pos;
+	Color color;
+};
+
+// Part of the VRAM sent to the video output and how, set by the GP1
+// display commands
+struct DisplayConfig
+{
+	// Top left corner of the display area in VRAM
+	uint16_t mVramXStart;
+	uint16_t mVramYStart;
+	// Output range relative to HSYNC and VSYNC
+	uint16_t mHorizStart;
+	uint16_t mHorizEnd;
+	uint16_t mLineStart;
+	uint16_t mLineEnd;
+	// Value of the horizontal resolution bits of the status register
+	uint8_t mHres;
+	bool mVres480;
+	bool mPal;
+	bool mDepth24;
+	bool mInterlaced;
+	bool mEnabled;
+};
+
+// Drawing settings, set by the GP0 environment commands
+struct DrawingConfig
+{
+	// Drawing area, inclusive
+	uint16_t mLeft;
+	uint16_t mTop;
+	uint16_t mRight;
+	uint16_t mBottom;
+	// Added to the vertex coordinates
+	int16_t mXOffset;
+	int16_t mYOffset;
+	// Dither the shaded primitives from 24 to 15 bits
+	bool mDithering;
+	bool mForceSetMaskBit;
+	bool mPreserveMaskedPixels;
+};
+
+// Image load in progress in a backend writing to a VRAM: destination
+// rectangle and position of the next pixel in it
+struct ImageLoad
+{
+	uint32_t mX;
+	uint32_t mY;
+	uint32_t mWidth;
+	uint32_t mHeight;
+	uint32_t mColumn;
+	uint32_t mRow;
+};
+
+// Backend drawing what the GPU is asked to. The GPU decodes the GP0
+// and GP1 commands and hands over the primitives, the VRAM transfers
+// and the display settings.
+class Renderer
+{
+public:
+	virtual ~Renderer() {}
+
+	// Set up the backend, called once before anything else
+	virtual void init() {}
+
+	// Primitives with the vertex colors Gouraud shaded if `shaded`,
+	// otherwise all the vertices have the same color
+	virtual void pushTriangle(Vertex v1, Vertex v2, Vertex v3, bool shaded) = 0;
+	virtual void pushQuad(Vertex v1, Vertex v2, Vertex v3, Vertex v4, bool shaded) = 0;
+
+	// Copy of a `width` x `height` image from the CPU to VRAM at `x`,
+	// `y`. Its pixels follow two by two through `imageLoadData`.
+	virtual void imageLoad(uint16_t x, uint16_t y, uint16_t width, uint16_t height) = 0;
+	virtual void imageLoadData(uint32_t pixels) = 0;
+	// Copy of a VRAM rectangle to the CPU
+	virtual void imageStore(uint16_t x, uint16_t y, uint16_t width, uint16_t height) = 0;
+
+	// New drawing settings
+	virtual void setDrawing(const DrawingConfig &config) {}
+	// New display settings
+	virtual void setDisplay(const DisplayConfig &config) = 0;
+	// End of a frame, at the start of the vertical blanking
+	virtual void display() = 0;
+
+	// True once the user wants to quit, by closing the window for
+	// instance
+	virtual bool shouldClose() const { return false; }
+
+	// Emulated VRAM the backend draws into, nullptr if it doesn't
+	// keep one. Such a backend gets the drawing commands even while
+	// the frames aren't shown, the VRAM has to stay up to date.
+	virtual Vram *vram() { return nullptr; }
+	// Image load in progress, saved with the machine state as the
+	// rest of its pixels may still be on their way
+	virtual ImageLoad imageLoadState() const { return {}; }
+	virtual void setImageLoadState(const ImageLoad &load) {}
+};
+
+} // namespace gpu
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <gpu/renderer.hpp>
+#include <gpu/vram.hpp>
+
+namespace gpu {
+namespace software {
+
+// The span loops have a SIMD version when the host supports it, the
+// scalar one is always there as a reference
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#define RASTERIZER_SIMD
+const bool SIMD_AVAILABLE = true;
+#else
+const bool SIMD_AVAILABLE = false;
+#endif
+
+// Draws the primitives into a VRAM the way the GPU does. Everything is
+// integer arithmetic, so the pixels are the same whatever the host and
+// whichever span loops are used:
+// - the vertex coordinates are 11 bit signed values moved by the
+//   drawing offset, primitives more than 1023 pixels wide or 511
+//   pixels high are dropped;
+// - a pixel is drawn if its integer coordinates are inside all three
+//   edges, or on a top or left one, so the two triangles of a quad
+//   never overlap;
+// - the colors are interpolated from per-triangle gradients in fixed
+//   point, and dithered down to 15 bits for the shaded primitives;
+// - nothing is drawn outside the drawing area, or over the pixels
+//   having the mask bit set if the mask settings say so.
+class Rasterizer
+{
+public:
+	Rasterizer();
+
+	void setDrawing(const DrawingConfig &config);
+
+	void triangle(const Vertex &v1, const Vertex &v2, const Vertex &v3, bool shaded);
+	// Drawn as the triangles 1, 2, 3 and 2, 3, 4
+	void quad(const Vertex &v1, const Vertex &v2, const Vertex &v3, const Vertex &v4, bool shaded);
+
+	// Copy of a `width` x `height` image from the CPU to VRAM at `x`,
+	// `y`, wrapping around the edges. Its pixels follow two by two
+	// through `imageLoadData`.
+	void imageLoad(uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+	void imageLoadData(uint32_t pixels);
+
+	Vram mVram;
+	// Use the SIMD span loops
+	bool mSimd;
+	// Image load in progress
+	ImageLoad mLoad;
+
+private:
+	// Vertex in drawing coordinates, with its 8 bit components
+	struct Point
+	{
+		int32_t x;
+		int32_t y;
+		uint32_t color[3];
+	};
+
+	Point point(const Vertex &v) const;
+	void drawTriangle(Point a, Point b, Point c, bool shaded);
+	// `count` pixels of one color
+	void spanFlat(uint16_t *dst, uint32_t count, uint16_t pixel) const;
+	// `count` pixels starting at `x`, `y` with the components
+	// starting at `color` and moving by `step` per pixel
+	void spanShaded(uint16_t *dst, int32_t x, int32_t y, uint32_t count, const uint32_t color[3],
+					const uint32_t step[3], bool dither) const;
+	// Store the next pixel of the image load
+	void loadPixel(uint16_t pixel);
+
+	DrawingConfig mConfig;
+	// Drawing area clamped to the VRAM
+	int32_t mClipLeft;
+	int32_t mClipTop;
+	int32_t mClipRight;
+	int32_t mClipBottom;
+};
+
+} // namespace software
+} // namespace gpu
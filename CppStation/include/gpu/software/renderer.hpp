@@ -0,0 +1,42 @@
+#pragma once
+
+#include <gpu/renderer.hpp>
+#include <gpu/software/rasterizer.hpp>
+
+namespace gpu {
+namespace software {
+
+// Backend drawing into an emulated VRAM on the CPU. It needs neither a
+// GPU nor a display, and the pixels only depend on the commands, so the
+// hash of each frame can be checked against a known good run.
+class Renderer : public gpu::Renderer
+{
+public:
+	Renderer();
+
+	void pushTriangle(Vertex v1, Vertex v2, Vertex v3, bool shaded) override;
+	void pushQuad(Vertex v1, Vertex v2, Vertex v3, Vertex v4, bool shaded) override;
+	void imageLoad(uint16_t x, uint16_t y, uint16_t width, uint16_t height) override;
+	void imageLoadData(uint32_t pixels) override;
+	// XXX GPUREAD isn't emulated, nothing reads the image
+	void imageStore(uint16_t x, uint16_t y, uint16_t width, uint16_t height) override {}
+	void setDrawing(const DrawingConfig &config) override;
+	void setDisplay(const DisplayConfig &config) override;
+	void display() override;
+	Vram *vram() override { return &mRasterizer.mVram; }
+	ImageLoad imageLoadState() const override { return mRasterizer.mLoad; }
+	void setImageLoadState(const ImageLoad &load) override { mRasterizer.mLoad = load; }
+
+	// Hash of the display area, as it is now
+	uint64_t displayHash() const;
+
+	Rasterizer mRasterizer;
+	// Hash of the display area at the end of the last frame
+	uint64_t mFrameHash;
+	uint64_t mFrames;
+	// Last display settings
+	DisplayConfig mDisplay;
+};
+
+} // namespace software
+} // namespace gpu
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+
+namespace gpu {
+
+// 1MB of 16 bit pixels, 512 lines of 1024
+const uint32_t VRAM_WIDTH = 1024;
+const uint32_t VRAM_HEIGHT = 512;
+const uint32_t VRAM_SIZE = VRAM_WIDTH * VRAM_HEIGHT * 2;
+// Granularity of the write tracking, same as the RAM's: two lines
+const uint32_t VRAM_PAGE_SHIFT = 12;
+const uint32_t VRAM_PAGES = VRAM_SIZE >> VRAM_PAGE_SHIFT;
+const uint32_t VRAM_PAGE_LINES = (1 << VRAM_PAGE_SHIFT) / (VRAM_WIDTH * 2);
+
+// Video RAM kept by the backends that draw like the GPU does: a
+// 1024x512 framebuffer of 15 bit BGR pixels with the mask bit on top,
+// holding the display buffers, the textures and their palettes.
+class Vram
+{
+public:
+	Vram();
+	~Vram();
+
+	uint16_t *line(uint32_t y) { return mPixels + y * VRAM_WIDTH; }
+	const uint16_t *line(uint32_t y) const { return mPixels + y * VRAM_WIDTH; }
+
+	uint8_t *data() { return (uint8_t *)mPixels; }
+	const uint8_t *data() const { return (const uint8_t *)mPixels; }
+
+	// Record a write to the line `y`
+	void markLine(uint32_t y)
+	{
+		mDirtyPages[y / VRAM_PAGE_LINES] = 1;
+	}
+	// Record a write to `count` lines starting at `y`, wrapping
+	// around the bottom
+	void markLines(uint32_t y, uint32_t count);
+	// Forget the writes recorded so far
+	void clearDirty();
+	// Non-zero for the pages written since the last `clearDirty`,
+	// all of them at first
+	uint8_t mDirtyPages[VRAM_PAGES];
+
+private:
+	uint16_t *mPixels;
+};
+
+} // namespace gpu
@@ -12,10 +12,12 @@
 #include <fmt/core.h>
 
 #include "result.hpp"
+#include <logger.hpp>
 
 template<typename ... Args>
 [[noreturn]] static void panic(const char *error_msg, Args ... args)
 {
+	logging::flush();
 	std::cerr << fmt::format(error_msg, args ...) << std::endl;
 	exit(-1);
 }
@@ -23,13 +25,18 @@ template<typename ... Args>
 template<typename ... Args>
 [[noreturn]] static void panic(std::string error_msg, Args ... args)
 {
+	logging::flush();
 	std::cerr << fmt::format(error_msg, args ...) << std::endl;
 	exit(-1);
 }
 
+// Messages for the user. Unlike the logs they're never dropped or
+// filtered out: they're printed right away, once what's been logged
+// before them is out.
 template<typename ... Args>
 static void println(std::string msg, Args ... args)
 {
+	logging::flush();
 	std::cout << fmt::format(msg, args ...) << std::endl;
 }
 
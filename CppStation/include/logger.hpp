@@ -0,0 +1,83 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <fmt/core.h>
+
+namespace logging {
+
+enum Level : uint8_t
+{
+	Trace = 0,
+	Debug = 1,
+	Info = 2,
+	Warn = 3,
+	Error = 4,
+	Off = 5,
+};
+
+// Subsystem a message comes from, each one has its own runtime level
+enum Category : uint8_t
+{
+	General = 0,
+	Cpu = 1,
+	Bus = 2,
+	Dma = 3,
+	Gpu = 4,
+	Renderer = 5,
+	Memory = 6,
+	Hle = 7,
+	CATEGORY_COUNT = 8,
+};
+
+// Messages below this level are compiled out, set by the build
+#ifndef CPPSTATION_LOG_LEVEL
+#define CPPSTATION_LOG_LEVEL Info
+#endif
+constexpr Level MIN_LEVEL = CPPSTATION_LOG_LEVEL;
+
+// Longer messages are truncated
+const uint32_t MESSAGE_SIZE = 512;
+
+// True if messages of `level` from `category` are printed
+bool enabled(Level level, Category category);
+// Change the runtime level of `category`, Info by default
+void setLevel(Category category, Level level);
+// Apply a comma separated list of `category=level` entries, or a
+// single level for all of them (e.g. "gpu=debug,dma=trace"). Returns
+// false if an entry isn't valid.
+bool configure(const std::string &spec);
+
+// Queue a formatted message, it's printed by the logging thread. The
+// message is dropped if the queue is full, it never blocks.
+void write(Level level, Category category, const char *text, uint32_t length);
+// Wait until everything queued so far has been printed
+void flush();
+
+template<typename ... Args>
+void log(Level level, Category category, const std::string &format, const Args & ... args)
+{
+	if (!enabled(level, category))
+		return;
+
+	char text[MESSAGE_SIZE];
+	auto res = fmt::format_to_n(text, MESSAGE_SIZE, format, args ...);
+	write(level, category, text, std::min<size_t>(res.size, MESSAGE_SIZE));
+}
+
+} // namespace logging
+
+// The level check is done at compile time first so that the disabled
+// calls, arguments included, don't generate any code
+#define LOG(level, category, ...)												\
+	do {																		\
+		if constexpr (logging::level >= logging::MIN_LEVEL)						\
+			logging::log(logging::level, logging::category, __VA_ARGS__);		\
+	} while (0)
+
+#define LOG_TRACE(category, ...) LOG(Trace, category, __VA_ARGS__)
+#define LOG_DEBUG(category, ...) LOG(Debug, category, __VA_ARGS__)
+#define LOG_INFO(category, ...) LOG(Info, category, __VA_ARGS__)
+#define LOG_WARN(category, ...) LOG(Warn, category, __VA_ARGS__)
+#define LOG_ERROR(category, ...) LOG(Error, category, __VA_ARGS__)
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <memory>
+#include <memory/endian.hpp>
 #include "helpers.hpp"
 
 namespace bus {
@@ -9,21 +11,66 @@ class Bus;
 namespace bios {
 
 const uint64_t BIOS_SIZE = 512 * 1024;
+
+// Read-only BIOS image loaded from a file. All the machines of the
+// process loading the same file share one image: the file is mapped
+// once, so its pages also come from the page cache shared with the
+// other processes, and it's validated and hashed once.
+class Image
+{
+public:
+	~Image();
+
+	// Image of the file at `path`, loaded unless another machine
+	// still uses it
+	static auto open(const std::string &path) -> cpp::result<std::shared_ptr<const Image>, std::string>;
+
+	const uint8_t *mData;
+	// Hash of the data, used to check that a savestate was made with
+	// the same image
+	uint64_t mHash;
+	// Descriptor of the mapped file on Linux, for the fastmem views,
+	// -1 otherwise
+	int mFd;
+
+private:
+	Image();
+
+	static auto load(const std::string &path) -> cpp::result<std::shared_ptr<const Image>, std::string>;
+};
+
+// Hash of `BIOS_SIZE` bytes at `data`
+uint64_t hash(const uint8_t *data);
+
 class Bios
 {
 public:
+	// Zeroed until an image is loaded
 	Bios();
-	auto loadFromFile(std::string &path) -> cpp::result<uint64_t, std::string>;
-	uint32_t load32(size_t offset);
-	uint8_t load8(size_t offset);
+	auto loadFromFile(const std::string &path) -> cpp::result<uint64_t, std::string>;
+	// Fetch the little endian value at `offset`
+	template<typename T>
+	T load(size_t offset) const
+	{
+		return endian::load<T>(mBuffer + offset);
+	}
+	// Hash of the image, used to check that a savestate was made
+	// with the same one
+	uint64_t hash() const;
+	// Descriptor of the image file the fastmem views can be mapped
+	// from, -1 if there's none
+	int fd() const;
+	// Move the BIOS image to `buffer`, owned by the caller
+	void setBuffer(uint8_t *buffer);
 	~Bios();
-	bool mIsValidImage = false;
 public:
-	char *mBuffer;
+	const uint8_t *mBuffer;
+	// Image `mBuffer` comes from, null for the zeroed BIOS
+	std::shared_ptr<const Image> mImage;
 	// Linkage to the communications bus
 	bus::Bus *mBus = nullptr;
 	// Link this CPU to a communications bus
 	void connectBus(bus::Bus *n) { mBus = n; }
 };
 
-} // namespace bios
\ No newline at end of file
+} // namespace bios
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace endian {
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The guest memory is accessed in host order, a little endian host is required"
+#endif
+
+// Guest accesses are 8, 16 or 32 bits wide, each one is made with a
+// single host access of the same width
+template<typename T>
+constexpr bool isWidth()
+{
+	return std::is_same<T, uint8_t>::value || std::is_same<T, uint16_t>::value ||
+		std::is_same<T, uint32_t>::value;
+}
+
+// Fetch the little endian value at `p`, which doesn't need to be
+// aligned. The compiler turns the copy into a plain load.
+template<typename T>
+inline T load(const uint8_t *p)
+{
+	static_assert(isWidth<T>(), "Unsupported access width");
+
+	T val;
+	memcpy(&val, p, sizeof(T));
+	return val;
+}
+
+// Store the little endian value `val` at `p`
+template<typename T>
+inline void store(uint8_t *p, T val)
+{
+	static_assert(isWidth<T>(), "Unsupported access width");
+
+	memcpy(p, &val, sizeof(T));
+}
+
+} // namespace endian
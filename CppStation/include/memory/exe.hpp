@@ -0,0 +1,38 @@
+#pragma once
+
+#include "helpers.hpp"
+
+namespace exe {
+
+// Header size, the text segment follows it in the file
+const uint32_t HEADER_SIZE = 0x800;
+// The text segment is padded to a multiple of this size
+const uint32_t TEXT_ALIGNMENT = 0x800;
+
+// PS-X EXE executable, the format of the programs started by the BIOS
+// shell
+class Exe
+{
+public:
+	Exe();
+	// Read the executable at `path`, returns the size of its text
+	// segment
+	auto loadFromFile(const std::string &path) -> cpp::result<uint32_t, std::string>;
+
+	// Entry point and initial `gp`
+	uint32_t mPc;
+	uint32_t mGp;
+	// Load address of the text segment
+	uint32_t mTextAddr;
+	// Zero filled area, usually the BSS
+	uint32_t mFillAddr;
+	uint32_t mFillSize;
+	// Initial `sp` and `fp` are `mSpBase + mSpOffset`, they're left
+	// alone if `mSpBase` is 0
+	uint32_t mSpBase;
+	uint32_t mSpOffset;
+	// Text segment, its size is a multiple of 2kB
+	std::vector<uint8_t> mText;
+};
+
+} // namespace exe
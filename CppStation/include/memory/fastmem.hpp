@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace fastmem {
+
+// The arena covers the whole 32bit guest address space so that any
+// guest address can be added to its base
+const uint64_t ARENA_SIZE = 1ull << 32;
+
+// Guest memory mapped into a reserved block of host address space at
+// its KUSEG, KSEG0 and KSEG1 addresses: the recompiler turns RAM,
+// BIOS and scratchpad accesses into plain host accesses relative to
+// `mBase`. Anything else (I/O, KSEG2, unmapped space) is left
+// inaccessible and faults.
+// Only supported on Linux.
+class Fastmem
+{
+public:
+	Fastmem();
+	~Fastmem();
+
+	// Allocate the guest memory and build the arena. The BIOS views
+	// map the image file `biosFd` if it's not -1, so that they share
+	// its pages, otherwise the BIOS is part of the memory file.
+	// Returns false if fastmem isn't available on this host.
+	bool init(int biosFd);
+
+	// Start of the arena, nullptr until `init` succeeds
+	uint8_t *mBase;
+	// Regular views of the guest RAM, BIOS (in the memory file, not
+	// used with an image file) and scratchpad
+	uint8_t *mRam;
+	uint8_t *mBios;
+	uint8_t *mScratchpad;
+
+private:
+	// Map `size` bytes at `offset` in the file `fd` at guest address
+	// `addr` in the arena
+	bool mapView(uint32_t addr, int fd, size_t offset, size_t size, bool writable);
+
+	// File holding the RAM, the BIOS and the scratchpad, -1 if not
+	// initialized
+	int mFd;
+};
+
+} // namespace fastmem
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+namespace memcontrol {
+
+// Devices whose bus timings are configured through MEM_CONTROL, in
+// the order of their delay/size registers
+enum Region
+{
+	Expansion1 = 0,
+	Expansion3 = 1,
+	Bios = 2,
+	Spu = 3,
+	Cdrom = 4,
+	Expansion2 = 5,
+	REGION_COUNT = 6,
+};
+
+// Memory latency and expansion mapping registers. The delay/size
+// registers are turned into access times (in CPU cycles) every time
+// they're written so that lookups are cheap.
+class MemControl
+{
+public:
+	MemControl();
+
+	// Register write at `offset` in the MEM_CONTROL range
+	void store32(uint32_t offset, uint32_t val);
+	// Register read at `offset` in the MEM_CONTROL range
+	uint32_t load32(uint32_t offset) const;
+
+	// Cycles taken by a `width` byte load from `region`
+	uint32_t accessTime(Region region, uint8_t width) const
+	{
+		return mAccessTimes[region][width >> 1];
+	}
+
+private:
+	void updateAccessTimes();
+
+	// Delay/size register of each region
+	uint32_t mDelaySize[REGION_COUNT];
+	// Common delays (COM0 to COM3) the regions can opt into
+	uint32_t mComDelay;
+	// Byte, halfword and word access times of each region
+	uint8_t mAccessTimes[REGION_COUNT][3];
+};
+
+} // namespace memcontrol
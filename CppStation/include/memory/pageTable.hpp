@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+namespace map {
+
+// 4kB pages, small enough to keep the scratchpad and the I/O
+// registers on separate pages
+const uint32_t PAGE_SHIFT = 12;
+const uint32_t PAGE_SIZE = 1 << PAGE_SHIFT;
+const uint32_t PAGE_MASK = PAGE_SIZE - 1;
+// The table covers the whole 512MB physical address space
+const uint32_t PHYSICAL_SIZE = 512 * 1024 * 1024;
+const uint32_t PAGE_COUNT = PHYSICAL_SIZE >> PAGE_SHIFT;
+
+// Physical address to host memory lookup for the regions backed by
+// plain memory (RAM and BIOS). Pages without a host pointer (I/O
+// registers, expansions, unmapped space) go through the Bus handlers.
+class PageTable
+{
+public:
+	PageTable();
+	~PageTable();
+
+	// Back `size` bytes at physical address `base` with `data`.
+	// Read-only regions are only mapped for loads.
+	void map(uint32_t base, uint32_t size, uint8_t *data, bool writable);
+
+	// Return the host pointer for loads from `abs_addr` (a physical
+	// address returned by `maskRegion`) or nullptr if it's not
+	// backed by memory
+	const uint8_t *read(uint32_t abs_addr) const
+	{
+		return lookup(mRead, abs_addr);
+	}
+
+	// Same thing for stores
+	uint8_t *write(uint32_t abs_addr) const
+	{
+		return lookup(mWrite, abs_addr);
+	}
+
+private:
+	static uint8_t *lookup(const std::vector<uint8_t *> &table, uint32_t abs_addr)
+	{
+		// KSEG2 isn't masked and ends up out of the table
+		if (abs_addr >= PHYSICAL_SIZE)
+			return nullptr;
+
+		uint8_t *page = table[abs_addr >> PAGE_SHIFT];
+		if (!page)
+			return nullptr;
+
+		return page + (abs_addr & PAGE_MASK);
+	}
+
+	std::vector<uint8_t *> mRead;
+	std::vector<uint8_t *> mWrite;
+};
+
+} // namespace map
@@ -2,6 +2,7 @@
 #include <vector>
 #include <cstddef>
 #include <cstdint>
+#include <memory/endian.hpp>
 
 namespace bus {
 class Bus;
@@ -10,29 +11,59 @@ class Bus;
 namespace ram {
 
 const uint64_t RAM_SIZE = 2 * 1024 * 1024;
+// RAM is mirrored 4 times in the first 8MB of the physical address
+// space
+const uint32_t RAM_MIRRORS = 4;
+// Granularity of the write tracking
+const uint32_t RAM_PAGE_SHIFT = 12;
+const uint32_t RAM_PAGES = RAM_SIZE >> RAM_PAGE_SHIFT;
 
 class Ram {
 public:
 	Ram();
 	~Ram();
-	// Fetch the 32bit little endian word at `offset`
-	uint32_t load32(size_t offset);
-	// Store the 32bit little endian word `val` into `offset`
-	void store32(size_t offset, uint32_t val);
-	// Fetch the 16bit little endian halfword at `offset`
-	uint16_t load16(size_t offset);
-	// Store the 16bit little endian halfword `val` into `offset`
-	void store16(size_t offset, uint16_t val);
-	// Fetch the byte at `offset`
-	uint8_t load8(size_t offset);
-	// Store the byte `val` into `offset`
-	void store8(size_t offset, uint8_t val);
+	// Fetch the little endian value at `offset`
+	template<typename T>
+	T load(size_t offset) const
+	{
+		return endian::load<T>((const uint8_t *)mData + offset);
+	}
+
+	// Store the little endian value `val` into `offset`
+	template<typename T>
+	void store(size_t offset, T val)
+	{
+		endian::store<T>((uint8_t *)mData + offset, val);
+		markDirty(offset);
+	}
+
+	// Host memory backing the RAM
+	uint8_t *data() { return (uint8_t *)mData; }
+	// Move the RAM contents to `data`, owned by the caller
+	void setData(uint8_t *data);
+
+	// Record a write to the page holding `offset`
+	void markDirty(uint32_t offset)
+	{
+		mDirtyPages[offset >> RAM_PAGE_SHIFT] = 1;
+	}
+	// Record a write of `len` bytes at `offset`. `store` does it
+	// itself, whoever writes to `data()` directly has to.
+	void markDirty(uint32_t offset, uint32_t len);
+	// Forget the writes recorded so far
+	void clearDirty();
+	// Non-zero for the pages written since the last `clearDirty`,
+	// all of them at first. Set by the recompiled stores as well.
+	uint8_t mDirtyPages[RAM_PAGES];
+
 	// Linkage to the communications bus
 	bus::Bus *mBus = nullptr;
 	// Link RAM to a communications bus
 	void connectBus(bus::Bus *n) { mBus = n; }
 private:
 	char *mData;
+	// False if `mData` has been provided by `setData`
+	bool mOwnsData;
 };
 
 } // namespace ram
\ No newline at end of file
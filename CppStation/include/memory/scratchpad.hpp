@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <memory/endian.hpp>
+
+namespace scratchpad {
+
+const uint32_t SCRATCHPAD_BASE = 0x1f800000;
+const uint32_t SCRATCHPAD_SIZE = 1024;
+
+// Return true if the CPU address `addr` is in the scratchpad. It's
+// only reachable through KUSEG and KSEG0: the KSEG1 mirror (and
+// anything masked by `maskRegion`) isn't decoded.
+inline constexpr bool contains(uint32_t addr)
+{
+	return (addr & 0x7fffffff & ~(SCRATCHPAD_SIZE - 1)) == SCRATCHPAD_BASE;
+}
+
+// 1kB of data cache used as fast RAM. It lives in the CPU, so it's
+// not visible from the bus and can't be used for DMA transfers.
+class Scratchpad
+{
+public:
+	Scratchpad();
+	~Scratchpad();
+
+	// Fetch the little endian value at `addr`
+	template<typename T>
+	T load(uint32_t addr) const
+	{
+		return endian::load<T>(mData + offset(addr));
+	}
+
+	// Store the little endian value `val` into `addr`
+	template<typename T>
+	void store(uint32_t addr, T val)
+	{
+		endian::store<T>(mData + offset(addr), val);
+	}
+
+	// Host memory backing the scratchpad
+	uint8_t *data() { return mData; }
+	// Move the scratchpad contents to `data`, owned by the caller
+	void setData(uint8_t *data);
+
+private:
+	static uint32_t offset(uint32_t addr)
+	{
+		return addr & (SCRATCHPAD_SIZE - 1);
+	}
+
+	uint8_t *mData;
+	// False if `mData` has been provided by `setData`
+	bool mOwnsData;
+};
+
+} // namespace scratchpad
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace profiler {
+
+// Parts of the emulator the host time is split between
+enum Section : uint8_t
+{
+	// CPU execution, everything not in another section
+	Cpu = 0,
+	// Device events run by the scheduler
+	Events = 1,
+	// DMA transfers, including the GPU commands they carry
+	Dma = 2,
+	// GP0 and GP1 writes from the CPU
+	Gpu = 3,
+	// Frame display by the renderer
+	Renderer = 4,
+	SECTION_COUNT = 5,
+};
+
+extern const char *const SECTION_NAMES[SECTION_COUNT];
+
+// Host time spent in each section. Sections nest, entering one pauses
+// the time of the section it was entered from so each one only counts
+// its own time. Disabled by default, then it doesn't read the clock.
+class Profiler
+{
+public:
+	Profiler();
+
+	// Clear the times and start counting in `Cpu`
+	void start();
+	// Stop counting, the times can then be read
+	void stop();
+
+	// Switch to `section`, returns the section to go back to
+	Section enter(Section section)
+	{
+		Section previous = mCurrent;
+
+		if (mEnabled)
+			switchTo(section);
+
+		return previous;
+	}
+
+	void leave(Section previous)
+	{
+		if (mEnabled)
+			switchTo(previous);
+	}
+
+	double seconds(Section section) const
+	{
+		return mTime[section].count();
+	}
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	void switchTo(Section section);
+
+	bool mEnabled;
+	Section mCurrent;
+	// Start of the current section's time slice
+	Clock::time_point mSliceStart;
+	std::chrono::duration<double> mTime[SECTION_COUNT];
+};
+
+// Time spent in the scope is counted in `section`
+class Scope
+{
+public:
+	Scope(Profiler &profiler, Section section) :
+		mProfiler(profiler),
+		mPrevious(profiler.enter(section))
+	{
+	}
+
+	~Scope()
+	{
+		mProfiler.leave(mPrevious);
+	}
+
+private:
+	Profiler &mProfiler;
+	Section mPrevious;
+};
+
+} // namespace profiler
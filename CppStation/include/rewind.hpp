@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <memory/ram.hpp>
+#include <gpu/vram.hpp>
+
+namespace bus {
+class Bus;
+}
+
+namespace rewinding {
+
+// Machine snapshots taken every `interval` frames, kept in a ring
+// bounded by a memory budget: the oldest ones are dropped to make
+// room for the new ones.
+//
+// Only the RAM pages written since the previous snapshot are looked
+// at, as recorded by the RAM write tracking. Each snapshot stores the
+// XOR of these pages with their previous contents, compressed, and the
+// rest of the machine in the savestate format. A copy of the RAM at
+// the last snapshot is kept as the reference the deltas are undone
+// from when rewinding. The VRAM of the renderer, if it keeps one, is
+// handled the same way.
+class Rewind
+{
+public:
+	Rewind(bus::Bus &bus, uint32_t interval, uint64_t budget);
+
+	// Called after each frame, takes a snapshot every `mInterval`
+	// frames
+	void frame();
+	// Take a snapshot now
+	void capture();
+	// Go back to the snapshot `count` steps back, 1 being the most
+	// recent one, and drop the newer ones. Returns false if there
+	// aren't that many.
+	bool rewind(uint32_t count);
+
+	size_t snapshots() const
+	{
+		return mSnapshots.size();
+	}
+
+	// Bytes used by the snapshots, not counting the reference copy of
+	// the RAM
+	uint64_t mUsed;
+	// Snapshots taken and host time spent taking them
+	uint64_t mCaptures;
+	double mCaptureSeconds;
+
+private:
+	struct Snapshot
+	{
+		// Machine section, in the savestate format
+		std::vector<uint8_t> mMachine;
+		// Page index (16 bits, the VRAM pages following the RAM
+		// ones) followed by the compressed XOR of the page with its
+		// contents in the previous snapshot, for each page that
+		// changed
+		std::vector<uint8_t> mPages;
+	};
+
+	uint64_t size(const Snapshot &snapshot) const
+	{
+		return snapshot.mMachine.capacity() + snapshot.mPages.capacity();
+	}
+
+	// Add the pages of `current` written since the last snapshot to
+	// `snapshot`, numbered from `firstIndex`, and update `reference`
+	void capturePages(Snapshot &snapshot, const uint8_t *current, uint8_t *reference, const uint8_t *dirty,
+					  uint32_t pages, uint32_t firstIndex);
+
+	bus::Bus &mBus;
+	uint32_t mInterval;
+	uint64_t mBudget;
+	// Frames until the next snapshot
+	uint32_t mCountdown;
+	// Oldest first
+	std::deque<Snapshot> mSnapshots;
+	// RAM at the last snapshot
+	std::vector<uint8_t> mReference;
+	// VRAM at the last snapshot, empty if the renderer doesn't keep
+	// one
+	std::vector<uint8_t> mVramReference;
+};
+
+} // namespace rewinding
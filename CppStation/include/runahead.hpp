@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace bus {
+class Bus;
+}
+
+namespace runahead {
+
+// Hides the input lag of games reacting a frame or more late: each
+// frame is emulated for real without being shown, then the machine is
+// saved, `frames` more frames are emulated and the last one is shown,
+// and the machine goes back to the saved state. What's shown is always
+// `frames` ahead of the real state.
+//
+// The state is kept in buffers allocated once, switching back and
+// forth doesn't allocate anything. The frames that aren't shown don't
+// call the renderer at all, unless it keeps a VRAM: that one is drawn
+// into all along, and saved and restored with the machine.
+class RunAhead
+{
+public:
+	RunAhead(bus::Bus &bus, uint32_t frames);
+
+	// Emulate one frame and show the one `mFrames` later
+	void runFrame();
+
+	// Frames emulated ahead and thrown away
+	uint64_t mSpeculativeFrames;
+	// Host time spent saving and restoring the machine
+	double mStateSeconds;
+
+private:
+	void save();
+	void restore();
+
+	bus::Bus &mBus;
+	uint32_t mFrames;
+	// Machine section in the savestate format
+	std::vector<uint8_t> mMachine;
+	std::vector<uint8_t> mRam;
+	// Empty if the renderer doesn't keep a VRAM
+	std::vector<uint8_t> mVram;
+};
+
+} // namespace runahead
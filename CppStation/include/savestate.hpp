@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <memory/ram.hpp>
+#include <gpu/vram.hpp>
+#include "helpers.hpp"
+
+namespace bus {
+class Bus;
+}
+
+namespace savestate {
+
+// Bumped whenever the layout changes, states saved by other versions
+// are rejected
+const uint32_t VERSION = 4;
+
+// A state file is a header page followed by sections starting on a
+// page boundary at fixed offsets, so that a mapping of the file can
+// be restored with plain copies:
+// - the RAM, as is;
+// - the VRAM of the renderer, as is, zeroes if it doesn't keep one;
+// - the rest of the machine (CPU, GTE, scratchpad, instruction cache
+//   tags, DMA, GPU, memory control and scheduler), a few kB of little
+//   endian fields.
+// The BIOS isn't saved, only its hash to make sure the state is
+// restored with the same image.
+const uint64_t PAGE_SIZE = 4096;
+const uint64_t RAM_OFFSET = PAGE_SIZE;
+const uint64_t VRAM_OFFSET = RAM_OFFSET + ram::RAM_SIZE;
+const uint64_t MACHINE_OFFSET = VRAM_OFFSET + gpu::VRAM_SIZE;
+
+// Write the state of `bus` to `path`, returns the size of the file
+auto save(bus::Bus &bus, const std::string &path) -> cpp::result<uint64_t, std::string>;
+
+// Restore `bus` from the state file at `path`. Nothing is changed if
+// the file isn't valid. Returns the size of the file.
+auto load(bus::Bus &bus, const std::string &path) -> cpp::result<uint64_t, std::string>;
+
+// Append the machine section of `bus` to `data`
+void saveMachine(bus::Bus &bus, std::vector<uint8_t> &data);
+// Restore the machine section saved by `saveMachine` with the same
+// build
+void loadMachine(bus::Bus &bus, const uint8_t *data);
+// Copy `saved` to the RAM. Only the pages that differ are written, so
+// the code on the others doesn't have to be decoded or recompiled
+// again.
+void restoreRam(bus::Bus &bus, const uint8_t *saved);
+// Same thing for the VRAM of the renderer, if it keeps one
+void restoreVram(bus::Bus &bus, const uint8_t *saved);
+
+} // namespace savestate
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+namespace scheduler {
+
+// Handle of an event registered with the scheduler
+typedef uint32_t EventId;
+
+// Deadline returned when nothing is scheduled
+const uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+
+// Device deadlines keyed on the CPU cycle count. Events are registered
+// once and can then be scheduled, moved and cancelled any number of
+// times. The pending ones are kept in a binary min-heap that tracks
+// the position of each event, so all of these are O(log n) and
+// finding the next deadline is O(1).
+class Scheduler
+{
+public:
+	// Called with the cycle the event was due at, which can be
+	// slightly in the past
+	typedef std::function<void(uint64_t)> Callback;
+
+	Scheduler();
+	~Scheduler();
+
+	// Register an event, it doesn't run until it's scheduled. Events
+	// can't be registered from a callback.
+	EventId add(Callback callback);
+
+	// Run the event at cycle `deadline`, replacing its previous
+	// deadline if it's already pending
+	void schedule(EventId id, uint64_t deadline);
+
+	// Remove the event from the pending ones, if it's there
+	void cancel(EventId id);
+
+	bool isPending(EventId id) const
+	{
+		return mEvents[id].mHeapPos != NOT_PENDING;
+	}
+
+	// Number of registered events, their ids go from 0 to
+	// `eventCount() - 1`
+	uint32_t eventCount() const
+	{
+		return mEvents.size();
+	}
+
+	// Deadline of event `id`, only meaningful if it's pending
+	uint64_t deadline(EventId id) const
+	{
+		return mEvents[id].mDeadline;
+	}
+
+	// Cycle of the earliest pending event
+	uint64_t nextDeadline() const
+	{
+		return mHeap.empty() ? NEVER : mEvents[mHeap[0]].mDeadline;
+	}
+
+	// Run the events due at or before `now` in deadline order. The
+	// callbacks can schedule events, including their own.
+	void runDue(uint64_t now);
+
+private:
+	static const uint32_t NOT_PENDING = std::numeric_limits<uint32_t>::max();
+
+	struct Event
+	{
+		Callback mCallback;
+		uint64_t mDeadline;
+		// Index in `mHeap`, NOT_PENDING if not scheduled
+		uint32_t mHeapPos;
+	};
+
+	// Earlier deadline first. Ties are broken by id so that the
+	// order doesn't depend on the heap layout.
+	bool before(EventId a, EventId b) const;
+	// Put the entry at `pos` in `mHeap` and update its event
+	void place(uint32_t pos, EventId id);
+	void siftUp(uint32_t pos);
+	void siftDown(uint32_t pos);
+	void remove(uint32_t pos);
+
+	std::vector<Event> mEvents;
+	std::vector<EventId> mHeap;
+};
+
+} // namespace scheduler
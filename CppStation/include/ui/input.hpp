@@ -5,20 +5,29 @@
 namespace ui {
 namespace input {
 
-extern bool keyPressedData[GLFW_KEY_LAST];
-extern bool mouseButtonPressedData[GLFW_MOUSE_BUTTON_LAST];
-extern float mouseX;
-extern float mouseY;
-extern float mouseScrollX;
-extern float mouseScrollY;
+// Keyboard and mouse state of a window, updated by the callbacks
+// installed on it
+class Input
+{
+public:
+	Input();
 
+	bool mKeyPressed[GLFW_KEY_LAST];
+	bool mMouseButtonPressed[GLFW_MOUSE_BUTTON_LAST];
+	float mMouseX;
+	float mMouseY;
+	float mMouseScrollX;
+	float mMouseScrollY;
+
+	bool isKeyDown(int key) const;
+	bool isMouseButtonDown(int mouseButton) const;
+};
+
+// The callbacks update the Input of the window they're called for
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void mouseCallback(GLFWwindow* window, double xpos, double ypos);
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 void mouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 
-bool isKeyDown(int key);
-bool isMouseButtonDown(int mouseButton);
-
 } // namespace input
-} // namespace ui
\ No newline at end of file
+} // namespace ui
@@ -0,0 +1,251 @@
+#include <logger.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+namespace logging {
+
+static const char *LEVEL_NAMES[] = { "trace", "debug", "info", "warn", "error", "off" };
+static const char *CATEGORY_NAMES[CATEGORY_COUNT] = {
+	"general", "cpu", "bus", "dma", "gpu", "renderer", "memory", "hle"
+};
+
+// Number of messages the queue holds, a power of 2
+const uint32_t RING_SIZE = 1024;
+// How long the logging thread sleeps when there's nothing to print
+const std::chrono::milliseconds IDLE_SLEEP(1);
+
+// Bounded multi-producer queue drained by a single thread. Each slot
+// has a sequence number telling whose turn it is: producers claim a
+// position with a CAS on `mHead` and publish the slot by bumping its
+// sequence, the thread frees it once printed by moving the sequence a
+// full lap ahead.
+class Logger
+{
+public:
+	Logger();
+	~Logger();
+
+	void push(Level level, Category category, const char *text, uint32_t length);
+	void flush();
+
+	std::atomic<Level> mLevels[CATEGORY_COUNT];
+
+private:
+	struct Slot
+	{
+		std::atomic<uint32_t> mSequence;
+		Level mLevel;
+		Category mCategory;
+		uint32_t mLength;
+		char mText[MESSAGE_SIZE];
+	};
+
+	// Print the queued messages, returns false if there were none
+	bool drain();
+	void run();
+
+	Slot mSlots[RING_SIZE];
+	// Next position to write
+	std::atomic<uint32_t> mHead;
+	// Next position to print, only the thread moves it
+	std::atomic<uint32_t> mTail;
+	// Messages lost because the queue was full
+	std::atomic<uint64_t> mDropped;
+	std::atomic<bool> mRunning;
+	std::thread mThread;
+};
+
+Logger::Logger() :
+	mHead(0),
+	mTail(0),
+	mDropped(0),
+	mRunning(true)
+{
+	for (uint32_t i = 0; i < CATEGORY_COUNT; i++)
+		mLevels[i] = Info;
+
+	for (uint32_t i = 0; i < RING_SIZE; i++)
+		mSlots[i].mSequence = i;
+
+	mThread = std::thread(&Logger::run, this);
+}
+
+Logger::~Logger()
+{
+	mRunning = false;
+	mThread.join();
+	drain();
+
+	if (mDropped)
+		fprintf(stderr, "logging: %llu messages dropped\n", (unsigned long long)mDropped.load());
+}
+
+void Logger::push(Level level, Category category, const char *text, uint32_t length)
+{
+	uint32_t pos = mHead.load(std::memory_order_relaxed);
+	Slot *slot;
+
+	for (;;)
+	{
+		slot = &mSlots[pos & (RING_SIZE - 1)];
+		int32_t diff = slot->mSequence.load(std::memory_order_acquire) - pos;
+
+		if (diff == 0)
+		{
+			if (mHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+		{
+			// Still holding a message from the previous lap
+			mDropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else
+		{
+			pos = mHead.load(std::memory_order_relaxed);
+		}
+	}
+
+	slot->mLevel = level;
+	slot->mCategory = category;
+	slot->mLength = length;
+	memcpy(slot->mText, text, length);
+	slot->mSequence.store(pos + 1, std::memory_order_release);
+}
+
+void Logger::flush()
+{
+	uint32_t head = mHead.load(std::memory_order_acquire);
+
+	while ((int32_t)(mTail.load(std::memory_order_acquire) - head) < 0)
+		std::this_thread::yield();
+}
+
+bool Logger::drain()
+{
+	uint32_t tail = mTail.load(std::memory_order_relaxed);
+	bool printed = false;
+
+	for (;;)
+	{
+		Slot &slot = mSlots[tail & (RING_SIZE - 1)];
+
+		if (slot.mSequence.load(std::memory_order_acquire) != tail + 1)
+			break;
+
+		FILE *out = slot.mLevel >= Warn ? stderr : stdout;
+		if (slot.mCategory != General)
+			fprintf(out, "%s: ", CATEGORY_NAMES[slot.mCategory]);
+		fwrite(slot.mText, 1, slot.mLength, out);
+		fputc('\n', out);
+
+		slot.mSequence.store(tail + RING_SIZE, std::memory_order_release);
+		tail++;
+		mTail.store(tail, std::memory_order_release);
+		printed = true;
+	}
+
+	// Once per batch instead of once per message
+	if (printed)
+	{
+		fflush(stdout);
+		fflush(stderr);
+	}
+
+	return printed;
+}
+
+void Logger::run()
+{
+	while (mRunning.load(std::memory_order_relaxed))
+	{
+		if (!drain())
+			std::this_thread::sleep_for(IDLE_SLEEP);
+	}
+}
+
+static Logger &logger()
+{
+	static Logger instance;
+
+	return instance;
+}
+
+bool enabled(Level level, Category category)
+{
+	return level >= logger().mLevels[category].load(std::memory_order_relaxed);
+}
+
+void setLevel(Category category, Level level)
+{
+	logger().mLevels[category] = level;
+}
+
+static bool parseLevel(const std::string &name, Level &level)
+{
+	for (uint32_t i = 0; i <= Off; i++)
+	{
+		if (name == LEVEL_NAMES[i])
+		{
+			level = (Level)i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool configure(const std::string &spec)
+{
+	Level level;
+
+	if (parseLevel(spec, level))
+	{
+		for (uint32_t i = 0; i < CATEGORY_COUNT; i++)
+			setLevel((Category)i, level);
+		return true;
+	}
+
+	size_t start = 0;
+
+	while (start <= spec.size())
+	{
+		size_t end = spec.find(',', start);
+		if (end == std::string::npos)
+			end = spec.size();
+
+		std::string entry = spec.substr(start, end - start);
+		size_t equal = entry.find('=');
+		if (equal == std::string::npos || !parseLevel(entry.substr(equal + 1), level))
+			return false;
+
+		std::string name = entry.substr(0, equal);
+		uint32_t category = 0;
+		while (category < CATEGORY_COUNT && name != CATEGORY_NAMES[category])
+			category++;
+
+		if (category == CATEGORY_COUNT)
+			return false;
+
+		setLevel((Category)category, level);
+		start = end + 1;
+	}
+
+	return true;
+}
+
+void write(Level level, Category category, const char *text, uint32_t length)
+{
+	logger().push(level, category, text, length);
+}
+
+void flush()
+{
+	logger().flush();
+}
+
+} // namespace logging
@@ -1,34 +1,535 @@
 #include <iostream>
+#include <chrono>
+#include <algorithm>
 
 #include <memory/bios.hpp>
 #include <cpu/cpu.hpp>
 #include <bus.hpp>
+#include <batch.hpp>
+#include <rewind.hpp>
+#include <runahead.hpp>
+#include <savestate.hpp>
 
-#include <gpu/opengl/core.hpp>
-#include <gpu/opengl/shaderProgram.hpp>
+#include <gpu/nullRenderer.hpp>
+#include <gpu/opengl/renderer.hpp>
+#include <gpu/software/renderer.hpp>
+#include <ui/input.hpp>
 
 #include "helpers.hpp"
 #include "backtrace.hpp"
 
-using gpu::opengl::renderer::Vertex;
-using gpu::opengl::renderer::Position;
-using gpu::opengl::renderer::Color;
+static const char *executionModeName(cpu::ExecutionMode mode)
+{
+	switch (mode)
+	{
+	case cpu::ExecutionMode::Interpreter:
+		return "interpreter";
+	case cpu::ExecutionMode::ThreadedInterpreter:
+		return "threaded-interpreter";
+	case cpu::ExecutionMode::CachedInterpreter:
+		return "cached-interpreter";
+	case cpu::ExecutionMode::Recompiler:
+		return "recompiler";
+	case cpu::ExecutionMode::RecompilerLockstep:
+		return "recompiler-lockstep";
+	}
+
+	return "unknown";
+}
 
-int main()
+// `str` quoted for JSON
+static std::string jsonString(const std::string &str)
 {
-	setupSigAct();
+	std::string quoted("\"");
+
+	for (char c : str)
+	{
+		if (c == '"' || c == '\\')
+			quoted += '\\';
+		quoted += c;
+	}
+
+	return quoted + "\"";
+}
+
+// Run `maxFrames` frames or `maxInstructions` instructions, whichever
+// isn't 0, then print the guest speed and the host time spent in each
+// subsystem as JSON. The instruction count is only checked between two
+// scheduler events so a run always stops at the same point whatever
+// the host. `rewind`, if not null, gets the frames as well. With
+// `runAhead` the frames are run through it, which isn't supported with
+// an instruction count. With the software renderer `software`, the hash
+// of the last frame is printed as well.
+static void runBenchmark(bus::Bus &bus, rewinding::Rewind *rewind, runahead::RunAhead *runAhead,
+						 const gpu::software::Renderer *software, const std::string &biosPath,
+						 const std::string &exePath, uint64_t maxFrames, uint64_t maxInstructions)
+{
+	cpu::Cpu &cpu = bus.mCpu;
+	uint64_t startFrames = bus.mGpu.mFrames;
+	uint64_t startCycles = cpu.mCycles;
+	uint64_t startIdle = cpu.mIdleCyclesSkipped;
+	uint64_t startHle = cpu.mHle.mCalls;
+	// The instruction counter wraps around, add up the differences
+	uint32_t lastIp = cpu.mIp;
+	uint64_t instructions = 0;
+
+	bus.mProfiler.start();
+	auto start = std::chrono::steady_clock::now();
+
+	if (maxFrames)
+	{
+		for (uint64_t frame = 0; frame < maxFrames; frame++)
+		{
+			if (runAhead)
+				runAhead->runFrame();
+			else
+				bus.runFrame();
+			instructions += (uint32_t)(cpu.mIp - lastIp);
+			lastIp = cpu.mIp;
+
+			if (rewind)
+				rewind->frame();
+		}
+	}
+	else
+	{
+		uint64_t lastFrames = startFrames;
+
+		while (instructions < maxInstructions)
+		{
+			bus.runUntil(bus.mScheduler.nextDeadline());
+			instructions += (uint32_t)(cpu.mIp - lastIp);
+			lastIp = cpu.mIp;
+
+			for (; rewind && lastFrames < bus.mGpu.mFrames; lastFrames++)
+				rewind->frame();
+		}
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	bus.mProfiler.stop();
+
+	double seconds = elapsed.count();
+	uint64_t frames = bus.mGpu.mFrames - startFrames;
+	uint64_t cycles = cpu.mCycles - startCycles;
+
+	// Nothing else on stdout after this
+	logging::flush();
+
+	fmt::print("{{\n");
+	fmt::print("  \"bios\": {},\n", jsonString(biosPath));
+	fmt::print("  \"exe\": {},\n", exePath.empty() ? "null" : jsonString(exePath));
+	fmt::print("  \"execution_mode\": \"{}\",\n", executionModeName(cpu.mExecutionMode));
+	fmt::print("  \"frames\": {},\n", frames);
+	fmt::print("  \"instructions\": {},\n", instructions);
+	fmt::print("  \"guest_cycles\": {},\n", cycles);
+	fmt::print("  \"idle_cycles_skipped\": {},\n", cpu.mIdleCyclesSkipped - startIdle);
+	fmt::print("  \"hle_calls\": {},\n", cpu.mHle.mCalls - startHle);
+	fmt::print("  \"host_seconds\": {:.6f},\n", seconds);
+	fmt::print("  \"mips\": {:.3f},\n", instructions / seconds / 1e6);
+	fmt::print("  \"ns_per_instruction\": {:.3f},\n", instructions ? seconds * 1e9 / instructions : 0.0);
+	fmt::print("  \"fps\": {:.2f},\n", frames / seconds);
+	fmt::print("  \"speed_percent\": {:.1f},\n", cycles / seconds * 100 / cpu::CPU_CLOCK);
+
+	if (software)
+		fmt::print("  \"frame_hash\": \"{:016x}\",\n", software->mFrameHash);
+
+	if (rewind)
+	{
+		fmt::print("  \"rewind\": {{\"captures\": {}, \"snapshots\": {}, \"bytes\": {}, "
+				   "\"ms_per_capture\": {:.3f}, \"percent\": {:.1f}}},\n",
+				   rewind->mCaptures, rewind->snapshots(), rewind->mUsed,
+				   rewind->mCaptures ? rewind->mCaptureSeconds * 1e3 / rewind->mCaptures : 0.0,
+				   rewind->mCaptureSeconds * 100 / seconds);
+	}
 
-	bus::Bus bus;
+	if (runAhead)
+	{
+		fmt::print("  \"run_ahead\": {{\"speculative_frames\": {}, \"ms_per_frame\": {:.3f}, "
+				   "\"state_percent\": {:.1f}}},\n",
+				   runAhead->mSpeculativeFrames, frames ? runAhead->mStateSeconds * 1e3 / frames : 0.0,
+				   runAhead->mStateSeconds * 100 / seconds);
+	}
+
+	fmt::print("  \"subsystems\": {{\n");
+
+	for (uint32_t i = 0; i < profiler::SECTION_COUNT; i++)
+	{
+		double time = bus.mProfiler.seconds((profiler::Section)i);
+
+		fmt::print("    \"{}\": {{\"seconds\": {:.6f}, \"percent\": {:.1f}}}{}\n", profiler::SECTION_NAMES[i],
+				   time, time * 100 / seconds, i + 1 < profiler::SECTION_COUNT ? "," : "");
+	}
+
+	fmt::print("  }}\n}}\n");
+}
+
+// Run `instances` copies of `bus` for `maxFrames` frames each on
+// `threads` threads, one per host core if 0, then print the aggregate
+// guest speed as JSON. A single copy is run alone first, the scaling
+// is the aggregate speed relative to it times the copies that can run
+// at once.
+static void runBatch(bus::Bus &bus, const std::string &biosPath, const std::string &exePath, bool fastmem,
+					 uint32_t instances, uint32_t threads, uint64_t maxFrames)
+{
+	batch::ThreadPool pool(threads);
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<batch::Result> single = batch::run(pool, bus, biosPath, fastmem, 1, maxFrames);
+	std::chrono::duration<double> singleElapsed = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	std::vector<batch::Result> results = batch::run(pool, bus, biosPath, fastmem, instances, maxFrames);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	double seconds = elapsed.count();
+	uint64_t frames = 0;
+	uint64_t instructions = 0;
+	uint64_t cycles = 0;
+	double slowest = 0;
+
+	for (const batch::Result &result : results)
+	{
+		frames += result.mFrames;
+		instructions += result.mInstructions;
+		cycles += result.mCycles;
+		slowest = std::max(slowest, result.mSeconds);
+	}
+
+	double singleFps = single[0].mFrames / singleElapsed.count();
+	uint32_t parallel = std::min(instances, pool.threads());
+
+	logging::flush();
+
+	fmt::print("{{\n");
+	fmt::print("  \"bios\": {},\n", jsonString(biosPath));
+	fmt::print("  \"exe\": {},\n", exePath.empty() ? "null" : jsonString(exePath));
+	fmt::print("  \"execution_mode\": \"{}\",\n", executionModeName(bus.mCpu.mExecutionMode));
+	fmt::print("  \"instances\": {},\n", instances);
+	fmt::print("  \"threads\": {},\n", pool.threads());
+	fmt::print("  \"frames_per_instance\": {},\n", maxFrames);
+	fmt::print("  \"instructions\": {},\n", instructions);
+	fmt::print("  \"guest_cycles\": {},\n", cycles);
+	fmt::print("  \"host_seconds\": {:.6f},\n", seconds);
+	fmt::print("  \"slowest_instance_seconds\": {:.6f},\n", slowest);
+	fmt::print("  \"mips\": {:.3f},\n", instructions / seconds / 1e6);
+	fmt::print("  \"fps\": {:.2f},\n", frames / seconds);
+	fmt::print("  \"speed_percent\": {:.1f},\n", cycles / seconds * 100 / cpu::CPU_CLOCK);
+	fmt::print("  \"single_instance_fps\": {:.2f},\n", singleFps);
+	// Every copy draws the same frames
+	if (bus.mGpu.mRenderer->vram())
+		fmt::print("  \"frame_hash\": \"{:016x}\",\n", results[0].mFrameHash);
+	fmt::print("  \"scaling_efficiency\": {:.3f}\n", frames / seconds / (singleFps * parallel));
+	fmt::print("}}\n");
+}
+
+// Run until the window is closed or for `maxFrames` frames if it's
+// not 0. With `rewind`, holding backspace in the window `input` comes
+// from goes back one snapshot per frame. With `runAhead`, the frames shown are the ones it runs ahead.
+// With `hashes`, the hash of each frame drawn by the software renderer
+// is printed.
+static void runFrontend(bus::Bus &bus, const ui::input::Input *input, rewinding::Rewind *rewind,
+						runahead::RunAhead *runAhead, const gpu::software::Renderer *hashes, uint64_t maxFrames)
+{
+	// Guest instructions per second and speed relative to the real
+	// console, reported every second so that execution modes can be
+	// compared on the same workload
+	auto statsStart = std::chrono::steady_clock::now();
+	uint32_t statsIp = bus.mCpu.mIp;
+	uint64_t statsCycles = bus.mCpu.mCycles;
+	uint64_t statsIdle = bus.mCpu.mIdleCyclesSkipped;
+
+	// A restored state doesn't start at frame 0
+	uint64_t startFrames = bus.mGpu.mFrames;
 	bool shouldClose = false;
 
 	do {
-		for (int i = 0; i < 1000000; i++) 
+		if (rewind && input && input->isKeyDown(GLFW_KEY_BACKSPACE))
 		{
-			bus.mCpu.runNextInstruction();
+			// Back to the previous snapshot, or the only one
+			if (!rewind->rewind(2))
+				rewind->rewind(1);
+		}
+
+		if (runAhead)
+			runAhead->runFrame();
+		else
+			bus.runFrame();
+
+		if (rewind)
+			rewind->frame();
+		if (hashes)
+			println("Frame {}: {:016x}", bus.mGpu.mFrames, hashes->mFrameHash);
+		shouldClose = bus.mGpu.mRenderer->shouldClose() || bus.mGpu.mFrames - startFrames == maxFrames;
+
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - statsStart;
+		if (elapsed.count() >= 1.0)
+		{
+			uint64_t cycles = bus.mCpu.mCycles - statsCycles;
+			uint64_t idle = bus.mCpu.mIdleCyclesSkipped - statsIdle;
+
+			println("{:.2f} MIPS, {:.0f}% speed, {:.0f}% idle skipped", (bus.mCpu.mIp - statsIp) / elapsed.count() / 1e6,
+					cycles / elapsed.count() * 100 / cpu::CPU_CLOCK, cycles ? idle * 100.0 / cycles : 0.0);
+			statsStart = std::chrono::steady_clock::now();
+			statsIp = bus.mCpu.mIp;
+			statsCycles = bus.mCpu.mCycles;
+			statsIdle = bus.mCpu.mIdleCyclesSkipped;
 		}
-		glfwPollEvents();
-		shouldClose = bus.mGpu.mRenderer.mWindow.shouldClose();
 	} while(!shouldClose);
+}
+
+int main(int argc, char *argv[])
+{
+	setupSigAct();
+
+	// The BIOS is loaded with the bus, look for it first
+	std::string biosPath(bus::DEFAULT_BIOS_PATH);
+	for (int i = 1; i < argc; i++)
+		if (std::string(argv[i]).rfind("--bios=", 0) == 0)
+			biosPath = argv[i] + 7;
+
+	bus::Bus bus(biosPath);
+	bool fastmem = false;
+	std::string exePath;
+	bool skipBios = false;
+	std::string loadStatePath;
+	std::string saveStatePath;
+	std::string bootStatePath;
+	// Frames between two rewind snapshots, 0 if disabled
+	uint32_t rewindInterval = 0;
+	uint64_t rewindBudget = 64 << 20;
+	// Frames shown ahead of the real state, 0 if disabled
+	uint32_t runAheadFrames = 0;
+	// OpenGL by default, the null renderer in benchmark mode
+	std::string renderer;
+	// Print the hash of every frame drawn by the software renderer
+	bool frameHashes = false;
+	// Run forever by default
+	uint64_t maxFrames = 0;
+	uint64_t maxInstructions = 0;
+	bool bench = false;
+	// Copies run by the batch benchmark and threads running them, 0
+	// for one per host core
+	uint32_t instances = 0;
+	uint32_t threads = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg(argv[i]);
+
+		if (arg == "--interpreter")
+			bus.mCpu.mExecutionMode = cpu::ExecutionMode::Interpreter;
+		else if (arg == "--threaded-interpreter")
+		{
+			if (!cpu::THREADED_INTERPRETER_AVAILABLE)
+				panic("The threaded interpreter isn't supported by this compiler");
+
+			bus.mCpu.mExecutionMode = cpu::ExecutionMode::ThreadedInterpreter;
+		}
+		else if (arg == "--cached-interpreter")
+			bus.mCpu.mExecutionMode = cpu::ExecutionMode::CachedInterpreter;
+		else if (arg == "--recompiler" || arg == "--recompiler-lockstep")
+		{
+			if (!cpu::jit::AVAILABLE)
+				panic("The recompiler isn't supported on this host");
+
+			bus.mCpu.mExecutionMode = (arg == "--recompiler") ?
+				cpu::ExecutionMode::Recompiler :
+				cpu::ExecutionMode::RecompilerLockstep;
+		}
+		else if (arg == "--fastmem")
+			fastmem = true;
+		else if (arg == "--no-idle-skip")
+			bus.mCpu.mIdleSkipping = false;
+		else if (arg == "--hle")
+			bus.mCpu.mHle.enableAll();
+		else if (arg.rfind("--hle=", 0) == 0)
+		{
+			if (!bus.mCpu.mHle.enableList(arg.substr(6)))
+				panic("Invalid HLE function list '{}'", arg.substr(6));
+		}
+		else if (arg.rfind("--bios=", 0) == 0)
+			continue;
+		else if (arg.rfind("--exe=", 0) == 0)
+			exePath = arg.substr(6);
+		else if (arg == "--skip-bios")
+			skipBios = true;
+		else if (arg.rfind("--load-state=", 0) == 0)
+			loadStatePath = arg.substr(13);
+		else if (arg.rfind("--save-state=", 0) == 0)
+			saveStatePath = arg.substr(13);
+		else if (arg.rfind("--boot-state=", 0) == 0)
+			bootStatePath = arg.substr(13);
+		else if (arg.rfind("--rewind=", 0) == 0)
+		{
+			rewindInterval = std::stoul(arg.substr(9));
+			if (rewindInterval == 0)
+				panic("The rewind interval must be at least one frame");
+		}
+		else if (arg.rfind("--rewind-budget=", 0) == 0)
+			rewindBudget = std::stoull(arg.substr(16)) << 20;
+		else if (arg.rfind("--run-ahead=", 0) == 0)
+		{
+			runAheadFrames = std::stoul(arg.substr(12));
+			if (runAheadFrames == 0)
+				panic("The run-ahead must be at least one frame");
+		}
+		else if (arg.rfind("--renderer=", 0) == 0)
+			renderer = arg.substr(11);
+		else if (arg == "--frame-hashes")
+			frameHashes = true;
+		else if (arg.rfind("--frames=", 0) == 0)
+			maxFrames = std::stoull(arg.substr(9));
+		else if (arg.rfind("--instructions=", 0) == 0)
+			maxInstructions = std::stoull(arg.substr(15));
+		else if (arg == "--bench")
+			bench = true;
+		else if (arg.rfind("--instances=", 0) == 0)
+		{
+			instances = std::stoul(arg.substr(12));
+			if (instances == 0)
+				panic("At least one instance is needed");
+		}
+		else if (arg.rfind("--threads=", 0) == 0)
+			threads = std::stoul(arg.substr(10));
+		else if (arg.rfind("--log=", 0) == 0)
+		{
+			if (!logging::configure(arg.substr(6)))
+				panic("Invalid log levels '{}'", arg.substr(6));
+		}
+		else
+			panic("Unknown option '{}'", arg);
+	}
+
+	if (bench)
+	{
+		if (!maxFrames == !maxInstructions)
+			panic("--bench needs either --frames or --instructions");
+		if (!renderer.empty() && renderer != "null" && renderer != "software")
+			panic("--bench only runs with the null and software renderers");
+	}
+	else if (maxInstructions)
+		panic("--instructions is only supported with --bench");
+
+	if (runAheadFrames && maxInstructions)
+		panic("--run-ahead is only supported with --frames");
+
+	if (instances && (!bench || !maxFrames || runAheadFrames || rewindInterval))
+		panic("--instances is only supported with --bench and --frames");
+
+	if (renderer.empty())
+		renderer = bench ? "null" : "opengl";
+
+	if (frameHashes && (bench || renderer != "software"))
+		panic("--frame-hashes is only supported with the software renderer, outside of --bench");
+
+	// The null renderer is already there
+	const ui::input::Input *input = nullptr;
+	const gpu::software::Renderer *software = nullptr;
+	if (renderer == "opengl")
+	{
+		auto glRenderer = std::make_unique<gpu::opengl::renderer::Renderer>();
+		input = &glRenderer->mWindow.mInput;
+		bus.mGpu.setRenderer(std::move(glRenderer));
+	}
+	else if (renderer == "software")
+	{
+		auto softwareRenderer = std::make_unique<gpu::software::Renderer>();
+		software = softwareRenderer.get();
+		bus.mGpu.setRenderer(std::move(softwareRenderer));
+	}
+	else if (renderer != "null")
+		panic("Unknown renderer '{}'", renderer);
+
+	if (fastmem)
+	{
+		if (bus.mCpu.mExecutionMode != cpu::ExecutionMode::Recompiler)
+			panic("--fastmem is only supported with --recompiler");
+
+		if (!bus.enableFastmem())
+			panic("Fastmem isn't supported on this host");
+	}
+
+	if (!loadStatePath.empty())
+	{
+		if (!bootStatePath.empty())
+			panic("--load-state and --boot-state can't be used together");
+
+		auto start = std::chrono::steady_clock::now();
+		uint64_t res = savestate::load(bus, loadStatePath).check();
+		(void)res;
+
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if (!bench)
+			println("Loaded {} in {:.2f} ms", loadStatePath, elapsed.count() * 1e3);
+	}
+
+	if (!exePath.empty())
+	{
+		auto start = std::chrono::steady_clock::now();
+		exe::Exe exe;
+		uint32_t res = exe.loadFromFile(exePath).check();
+		(void)res;
+
+		// A restored state is expected to have the kernel set up
+		// already. Without the kernel the EXE can't use the BIOS
+		// functions, that's fine for the test programs.
+		if (!skipBios && loadStatePath.empty())
+		{
+			// The state saved after a previous boot is used if
+			// there's a valid one
+			if (bootStatePath.empty() || savestate::load(bus, bootStatePath).has_error())
+			{
+				if (!bus.bootKernel(10 * cpu::CPU_CLOCK))
+					panic("The BIOS didn't get to the shell, can't start {}", exePath);
+
+				if (!bootStatePath.empty())
+				{
+					uint64_t res = savestate::save(bus, bootStatePath).check();
+					(void)res;
+				}
+			}
+		}
+
+		bus.sideload(exe);
+
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if (!bench)
+			println("Started {} at {:08x} after {:.1f} ms", exePath, exe.mPc, elapsed.count() * 1e3);
+	}
+	else if (skipBios)
+		panic("--skip-bios needs an EXE to start");
+	else if (!bootStatePath.empty())
+		panic("--boot-state needs an EXE to start");
+
+	std::unique_ptr<rewinding::Rewind> rewind;
+	if (rewindInterval)
+		rewind = std::make_unique<rewinding::Rewind>(bus, rewindInterval, rewindBudget);
+
+	std::unique_ptr<runahead::RunAhead> runAhead;
+	if (runAheadFrames)
+		runAhead = std::make_unique<runahead::RunAhead>(bus, runAheadFrames);
+
+	if (instances)
+		runBatch(bus, biosPath, exePath, fastmem, instances, threads, maxFrames);
+	else if (bench)
+		runBenchmark(bus, rewind.get(), runAhead.get(), software, biosPath, exePath, maxFrames, maxInstructions);
+	else
+		runFrontend(bus, input, rewind.get(), runAhead.get(), frameHashes ? software : nullptr, maxFrames);
+
+	if (!saveStatePath.empty())
+	{
+		auto start = std::chrono::steady_clock::now();
+		uint64_t res = savestate::save(bus, saveStatePath).check();
+		(void)res;
+
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if (!bench)
+			println("Saved {} in {:.2f} ms", saveStatePath, elapsed.count() * 1e3);
+	}
+
+	if (!bench && bus.mCpu.mHle.mCalls)
+		bus.mCpu.mHle.printStats();
 
 	return 0;
 }
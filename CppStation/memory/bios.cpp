@@ -1,60 +1,159 @@
 #include <memory/bios.hpp>
 #include <bus.hpp>
+#include <map>
+#include <mutex>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
 namespace bios {
 
-Bios::Bios()
+// What the BIOS reads as before an image is loaded
+static const uint8_t BLANK[BIOS_SIZE] = {};
+
+// Images in use, by path
+static std::mutex imagesMutex;
+static std::map<std::string, std::weak_ptr<const Image>> images;
+
+uint64_t hash(const uint8_t *data)
+{
+	// FNV-1a on 64 bit words, good enough to tell two images apart
+	uint64_t h = 0xcbf29ce484222325;
+
+	for (size_t offset = 0; offset < BIOS_SIZE; offset += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data + offset, 8);
+		h = (h ^ word) * 0x100000001b3;
+	}
+
+	return h;
+}
+
+Image::Image() :
+	mData(nullptr),
+	mHash(0),
+	mFd(-1)
+{
+}
+
+Image::~Image()
+{
+#ifdef __linux__
+	if (mData)
+		munmap((void *)mData, BIOS_SIZE);
+	if (mFd != -1)
+		close(mFd);
+#else
+	free((void *)mData);
+#endif
+}
+
+auto Image::open(const std::string &path) -> cpp::result<std::shared_ptr<const Image>, std::string>
+{
+	std::lock_guard<std::mutex> lock(imagesMutex);
+
+	std::shared_ptr<const Image> image = images[path].lock();
+	if (image)
+		return image;
+
+	auto loaded = load(path);
+	if (!loaded.has_error())
+		images[path] = loaded.value();
+
+	return loaded;
+}
+
+auto Image::load(const std::string &path) -> cpp::result<std::shared_ptr<const Image>, std::string>
 {
-	mBuffer = (char*)malloc(BIOS_SIZE);
-	if (!mBuffer)
+	std::shared_ptr<Image> image(new Image());
+
+#ifdef __linux__
+	image->mFd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (image->mFd == -1)
+		return cpp::fail(path + ": " + std::string(std::strerror(errno)));
+
+	struct stat st;
+	if (fstat(image->mFd, &st) != 0)
+		return cpp::fail(path + ": " + std::string(std::strerror(errno)));
+
+	if ((uint64_t)st.st_size != BIOS_SIZE)
+		return cpp::fail(path + " is not a valid bios image");
+
+	void *data = mmap(nullptr, BIOS_SIZE, PROT_READ, MAP_SHARED, image->mFd, 0);
+	if (data == MAP_FAILED)
+		return cpp::fail(path + ": " + std::string(std::strerror(errno)));
+
+	image->mData = (const uint8_t *)data;
+#else
+	std::ifstream ifs(path, std::ifstream::binary);
+	if (!ifs.is_open())
+		return cpp::fail(path + ": " + std::string(std::strerror(errno)));
+
+	ifs.seekg(0, std::ios_base::end);
+	if ((uint64_t)ifs.tellg() != BIOS_SIZE)
+		return cpp::fail(path + " is not a valid bios image");
+
+	char *data = (char *)malloc(BIOS_SIZE);
+	if (!data)
 		panic("Not enough memory to read BIOS file");
+
+	image->mData = (const uint8_t *)data;
+	ifs.seekg(0, std::ios_base::beg);
+	ifs.read(data, BIOS_SIZE);
+#endif
+
+	image->mHash = hash(image->mData);
+
+	return image;
+}
+
+Bios::Bios() :
+	mBuffer(BLANK)
+{
 }
 
 Bios::~Bios()
 {
-	free(mBuffer);
 }
 
-auto Bios::loadFromFile(std::string &path) -> cpp::result<uint64_t, std::string>
+void Bios::setBuffer(uint8_t *buffer)
 {
-	std::ifstream ifs;
-	ifs.open(path, std::ifstream::binary);
-	if (ifs.is_open())
-	{
-		ifs.seekg(0, std::ios_base::end);
-		uint64_t bufferSize = ifs.tellg();
-		if (bufferSize == BIOS_SIZE) {
-			mIsValidImage = true;
-			ifs.seekg(0, std::ios_base::beg);
-			ifs.read(mBuffer, BIOS_SIZE);
-		}
-		return bufferSize;
-	}
-	ifs.close();
+	memcpy(buffer, mBuffer, BIOS_SIZE);
 
-	if (errno != 0) {
-		return cpp::fail(path + ": " + std::string(std::strerror(errno)));
-	}
+	mBuffer = buffer;
+}
+
+auto Bios::loadFromFile(const std::string &path) -> cpp::result<uint64_t, std::string>
+{
+	auto image = Image::open(path);
+	if (image.has_error())
+		return cpp::fail(image.error());
+
+	mImage = image.value();
+	mBuffer = mImage->mData;
 
-	return cpp::fail(path + " is not a valid bios image");
+	return BIOS_SIZE;
 }
 
-// Fetch byte at `offset`
-uint8_t Bios::load8(size_t offset)
+uint64_t Bios::hash() const
 {
-	return mBuffer[offset];
+	if (mImage)
+		return mImage->mHash;
+
+	static const uint64_t blankHash = bios::hash(BLANK);
+	return blankHash;
 }
 
-// Fetch the 32 bit little endian word at ‘offset‘
-uint32_t Bios::load32(size_t offset)
+int Bios::fd() const
 {
-	uint8_t b0 = mBuffer[offset + 0];
-	uint8_t b1 = mBuffer[offset + 1];
-	uint8_t b2 = mBuffer[offset + 2];
-	uint8_t b3 = mBuffer[offset + 3];
-	return b0 | ( b1 << 8 ) | ( b2 << 16 ) | ( b3 << 24 );
+	return mImage ? mImage->mFd : -1;
 }
 
-} // namespace bios
\ No newline at end of file
+} // namespace bios
@@ -76,7 +76,7 @@ void Dma::setInterrupt(uint32_t val)
 	uint8_t ack = (uint8_t)((val >> 24) & 0x3f);
 	mChannelIrqFlags &= !ack;
 
-	println("DMA IRQ en: {} {:08x}", mIrqEn, val);
+	LOG_DEBUG(Dma, "DMA IRQ en: {} {:08x}", mIrqEn, val);
 }
 
 // Return a channel pointer by port number.
@@ -0,0 +1,53 @@
+#include <memory/exe.hpp>
+#include <memory/ram.hpp>
+
+namespace exe {
+
+static uint32_t headerWord(const uint8_t *header, uint32_t offset)
+{
+	return header[offset] | (header[offset + 1] << 8) | (header[offset + 2] << 16) |
+		((uint32_t)header[offset + 3] << 24);
+}
+
+Exe::Exe() :
+	mPc(0),
+	mGp(0),
+	mTextAddr(0),
+	mFillAddr(0),
+	mFillSize(0),
+	mSpBase(0),
+	mSpOffset(0)
+{
+}
+
+auto Exe::loadFromFile(const std::string &path) -> cpp::result<uint32_t, std::string>
+{
+	std::ifstream ifs(path, std::ifstream::binary);
+	if (!ifs.is_open())
+		return cpp::fail(path + ": " + std::string(std::strerror(errno)));
+
+	uint8_t header[HEADER_SIZE];
+	if (!ifs.read((char *)header, HEADER_SIZE) || memcmp(header, "PS-X EXE", 8) != 0)
+		return cpp::fail(path + " is not a PS-X EXE file");
+
+	mPc = headerWord(header, 0x10);
+	mGp = headerWord(header, 0x14);
+	mTextAddr = headerWord(header, 0x18);
+	mFillAddr = headerWord(header, 0x28);
+	mFillSize = headerWord(header, 0x2c);
+	mSpBase = headerWord(header, 0x30);
+	mSpOffset = headerWord(header, 0x34);
+
+	// The size is checked before anything is allocated for it
+	uint32_t textSize = headerWord(header, 0x1c);
+	if (textSize > ram::RAM_SIZE || textSize % TEXT_ALIGNMENT != 0)
+		return cpp::fail(path + " has a bad text segment size: " + std::to_string(textSize));
+
+	mText.resize(textSize);
+	if (!ifs.read((char *)mText.data(), textSize))
+		return cpp::fail(path + " is truncated");
+
+	return textSize;
+}
+
+} // namespace exe
@@ -0,0 +1,139 @@
+#include <memory/fastmem.hpp>
+#include <memory/bios.hpp>
+#include <memory/ram.hpp>
+#include <memory/scratchpad.hpp>
+#include "helpers.hpp"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace fastmem {
+
+// Offsets of the guest memory in the memory file
+static const size_t RAM_OFFSET = 0;
+static const size_t BIOS_OFFSET = ram::RAM_SIZE;
+static const size_t SCRATCHPAD_OFFSET = BIOS_OFFSET + bios::BIOS_SIZE;
+// The scratchpad is smaller than a host page, the rest of the page
+// is padding. The recompiler sends the accesses to it to the bus.
+static const size_t SCRATCHPAD_VIEW_SIZE = 4096;
+static const size_t FILE_SIZE = SCRATCHPAD_OFFSET + SCRATCHPAD_VIEW_SIZE;
+
+// Base of the segments sharing the physical address space
+static const uint32_t SEGMENTS[] = {
+	0x00000000, // KUSEG
+	0x80000000, // KSEG0
+	0xa0000000, // KSEG1
+};
+
+Fastmem::Fastmem() :
+	mBase(nullptr),
+	mRam(nullptr),
+	mBios(nullptr),
+	mScratchpad(nullptr),
+	mFd(-1)
+{
+}
+
+Fastmem::~Fastmem()
+{
+#ifdef __linux__
+	if (mBase)
+		munmap(mBase, ARENA_SIZE);
+	if (mRam)
+		munmap(mRam, FILE_SIZE);
+	if (mFd != -1)
+		close(mFd);
+#endif
+}
+
+bool Fastmem::init(int biosFd)
+{
+#ifdef __linux__
+	mFd = memfd_create("cppstation", 0);
+	if (mFd == -1)
+	{
+		LOG_WARN(Memory, "memfd_create failed: {}", std::strerror(errno));
+		return false;
+	}
+
+	if (ftruncate(mFd, FILE_SIZE) != 0)
+	{
+		LOG_WARN(Memory, "can't resize the memory file: {}", std::strerror(errno));
+		return false;
+	}
+
+	void *view = mmap(nullptr, FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+	if (view == MAP_FAILED)
+	{
+		LOG_WARN(Memory, "can't map the guest memory: {}", std::strerror(errno));
+		return false;
+	}
+	mRam = (uint8_t *)view + RAM_OFFSET;
+	mBios = (uint8_t *)view + BIOS_OFFSET;
+	mScratchpad = (uint8_t *)view + SCRATCHPAD_OFFSET;
+
+	// Only reserve the arena, the guest memory views are mapped over
+	// it
+	void *arena = mmap(nullptr, ARENA_SIZE, PROT_NONE,
+					   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (arena == MAP_FAILED)
+	{
+		LOG_WARN(Memory, "can't reserve {} bytes of address space: {}",
+				ARENA_SIZE, std::strerror(errno));
+		return false;
+	}
+	mBase = (uint8_t *)arena;
+
+	for (uint32_t segment : SEGMENTS)
+	{
+		for (uint32_t mirror = 0; mirror < ram::RAM_MIRRORS; mirror++)
+		{
+			if (!mapView(segment + mirror * ram::RAM_SIZE, mFd, RAM_OFFSET, ram::RAM_SIZE, true))
+				return false;
+		}
+
+		bool mapped = biosFd != -1 ?
+			mapView(segment + 0x1fc00000, biosFd, 0, bios::BIOS_SIZE, false) :
+			mapView(segment + 0x1fc00000, mFd, BIOS_OFFSET, bios::BIOS_SIZE, false);
+		if (!mapped)
+			return false;
+
+		// The scratchpad can't be accessed through KSEG1
+		if (scratchpad::contains(segment + scratchpad::SCRATCHPAD_BASE) &&
+			!mapView(segment + scratchpad::SCRATCHPAD_BASE, mFd, SCRATCHPAD_OFFSET, SCRATCHPAD_VIEW_SIZE, true))
+			return false;
+	}
+
+	return true;
+#else
+	(void)biosFd;
+	return false;
+#endif
+}
+
+bool Fastmem::mapView(uint32_t addr, int fd, size_t offset, size_t size, bool writable)
+{
+#ifdef __linux__
+	int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+
+	void *view = mmap(mBase + addr, size, prot, MAP_SHARED | MAP_FIXED, fd, offset);
+	if (view == MAP_FAILED)
+	{
+		LOG_WARN(Memory, "can't map guest memory at {:08x}: {}", addr, std::strerror(errno));
+		return false;
+	}
+
+	return true;
+#else
+	(void)addr;
+	(void)fd;
+	(void)offset;
+	(void)size;
+	(void)writable;
+	return false;
+#endif
+}
+
+} // namespace fastmem
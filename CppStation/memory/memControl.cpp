@@ -0,0 +1,108 @@
+#include <memory/memControl.hpp>
+#include <algorithm>
+#include "helpers.hpp"
+
+namespace memcontrol {
+
+MemControl::MemControl() :
+	// Values set by the BIOS during boot, used until it gets there
+	mDelaySize{
+		0x0013243f, // Expansion 1
+		0x00003022, // Expansion 3
+		0x0013243f, // BIOS
+		0x200931e1, // SPU
+		0x00020843, // CDROM
+		0x00070777, // Expansion 2
+	},
+	mComDelay(0x00031125)
+{
+	updateAccessTimes();
+}
+
+void MemControl::store32(uint32_t offset, uint32_t val)
+{
+	switch (offset)
+	{
+	case 0: // Expansion 1 base address
+		if (val != 0x1f000000)
+			panic("Bad expansion 1 base address: 0x{:08x}", val);
+		break;
+	case 4: // Expansion 2 base address
+		if (val != 0x1f802000)
+			panic("Bad expansion 2 base address: 0x{:08x}", val);
+		break;
+	case 0x20: // Common delay
+		mComDelay = val;
+		updateAccessTimes();
+		break;
+	default: // Delay/size of one of the regions
+		mDelaySize[(offset - 8) >> 2] = val;
+		updateAccessTimes();
+	}
+}
+
+uint32_t MemControl::load32(uint32_t offset) const
+{
+	switch (offset)
+	{
+	case 0: // Expansion 1 base address
+		return 0x1f000000;
+	case 4: // Expansion 2 base address
+		return 0x1f802000;
+	case 0x20: // Common delay
+		return mComDelay;
+	default: // Delay/size of one of the regions
+		return mDelaySize[(offset - 8) >> 2];
+	}
+}
+
+void MemControl::updateAccessTimes()
+{
+	for (uint32_t region = 0; region < REGION_COUNT; region++)
+	{
+		uint32_t delaySize = mDelaySize[region];
+		int32_t readDelay = (delaySize >> 4) & 0xf;
+		bool bus16 = (delaySize & (1 << 12)) != 0;
+
+		// The first access pays the full latency, the following
+		// ones (when the access is wider than the data bus) only
+		// the sequential delay
+		int32_t first = 0;
+		int32_t seq = 0;
+		int32_t min = 0;
+
+		if ((delaySize & (1 << 8)) != 0)
+		{
+			int32_t com0 = mComDelay & 0xf;
+			first += com0 - 1;
+			seq += com0 - 1;
+		}
+		if ((delaySize & (1 << 10)) != 0)
+		{
+			int32_t com2 = (mComDelay >> 8) & 0xf;
+			first += com2;
+			seq += com2;
+		}
+		if ((delaySize & (1 << 11)) != 0)
+			min = (mComDelay >> 12) & 0xf;
+
+		if (first < 6)
+			first++;
+
+		first += readDelay + 2;
+		seq += readDelay + 2;
+		first = std::max(first, min + 6);
+		seq = std::max(seq, min + 2);
+
+		int32_t byte = first;
+		int32_t halfword = bus16 ? first : first + seq;
+		int32_t word = bus16 ? first + seq : first + 3 * seq;
+
+		// The instruction itself already accounts for one cycle
+		mAccessTimes[region][0] = std::max(byte - 1, 0);
+		mAccessTimes[region][1] = std::max(halfword - 1, 0);
+		mAccessTimes[region][2] = std::max(word - 1, 0);
+	}
+}
+
+} // namespace memcontrol
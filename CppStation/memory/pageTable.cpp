@@ -0,0 +1,30 @@
+#include <memory/pageTable.hpp>
+#include "helpers.hpp"
+
+namespace map {
+
+PageTable::PageTable() :
+	mRead(PAGE_COUNT, nullptr),
+	mWrite(PAGE_COUNT, nullptr)
+{
+}
+
+PageTable::~PageTable()
+{
+}
+
+void PageTable::map(uint32_t base, uint32_t size, uint8_t *data, bool writable)
+{
+	if ((base & PAGE_MASK) != 0 || (size & PAGE_MASK) != 0)
+		panic("Can't map {} bytes at {:08x}: not page aligned", size, base);
+
+	for (uint32_t offset = 0; offset < size; offset += PAGE_SIZE)
+	{
+		uint32_t page = (base + offset) >> PAGE_SHIFT;
+
+		mRead[page] = data + offset;
+		mWrite[page] = writable ? data + offset : nullptr;
+	}
+}
+
+} // namespace map
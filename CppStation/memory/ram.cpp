@@ -3,7 +3,8 @@
 
 namespace ram {
 
-Ram::Ram()
+Ram::Ram() :
+	mOwnsData(true)
 {
 	mData = (char*)malloc(RAM_SIZE);
 	if (!mData)
@@ -11,66 +12,40 @@ Ram::Ram()
 
 	// Default RAM contents are garbage
 	memset(mData, 0xca, RAM_SIZE);
+	memset(mDirtyPages, 1, RAM_PAGES);
 }
 
 Ram::~Ram()
 {
-	free(mData);
+	if (mOwnsData)
+		free(mData);
 }
 
-// Fetch the 32 bit little endian word at ‘offset‘
-uint32_t Ram::load32(size_t offset)
+void Ram::setData(uint8_t *data)
 {
-	uint8_t b0 = mData[offset + 0];
-	uint8_t b1 = mData[offset + 1];
-	uint8_t b2 = mData[offset + 2];
-	uint8_t b3 = mData[offset + 3];
+	memcpy(data, mData, RAM_SIZE);
 
-	return b0 | (b1 << 8) | (b2 << 16) | (b3 << 24);
-}
-
-// Store the 32bit little endian word `val` into `offset`
-void Ram::store32(size_t offset, uint32_t val)
-{
-	uint8_t b0 = val & 0xff;
-	uint8_t b1 = (val >> 8) & 0xff;
-	uint8_t b2 = (val >> 16) & 0xff;
-	uint8_t b3 = (val >> 24) & 0xff;
+	if (mOwnsData)
+		free(mData);
 
-	mData[offset + 0] = b0;
-	mData[offset + 1] = b1;
-	mData[offset + 2] = b2;
-	mData[offset + 3] = b3;
+	mData = (char *)data;
+	mOwnsData = false;
 }
 
-// Fetch the 16bit little endian halfword at `offset`
-uint16_t Ram::load16(size_t offset)
+void Ram::markDirty(uint32_t offset, uint32_t len)
 {
-	uint8_t b0 = mData[offset + 0];
-	uint8_t b1 = mData[offset + 1];
-
-	return b0 | (b1 << 8);
-}
+	if (len == 0)
+		return;
 
-// Store the 16bit little endian halfword `val` into `offset`
-void Ram::store16(size_t offset, uint16_t val)
-{
-	uint8_t b0 = val & 0xff;
-	uint8_t b1 = (val >> 8) & 0xff;
+	uint32_t first = offset >> RAM_PAGE_SHIFT;
+	uint32_t last = (offset + len - 1) >> RAM_PAGE_SHIFT;
 
-	mData[offset + 0] = b0;
-	mData[offset + 1] = b1;
+	memset(mDirtyPages + first, 1, last - first + 1);
 }
 
-// Fetch the byte at `offset`
-uint8_t Ram::load8(size_t offset)
+void Ram::clearDirty()
 {
-	return mData[offset];
+	memset(mDirtyPages, 0, RAM_PAGES);
 }
 
-// Store the byte `val` into `offset`
-void Ram::store8(size_t offset, uint8_t val)
-{
-	mData[offset] = val;
-}
 } // namespace ram
\ No newline at end of file
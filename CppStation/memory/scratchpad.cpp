@@ -0,0 +1,34 @@
+#include <memory/scratchpad.hpp>
+#include "helpers.hpp"
+
+namespace scratchpad {
+
+Scratchpad::Scratchpad() :
+	mOwnsData(true)
+{
+	mData = (uint8_t *)malloc(SCRATCHPAD_SIZE);
+	if (!mData)
+		panic("Not enough memory to allocate the scratchpad");
+
+	// Default contents are garbage
+	memset(mData, 0xca, SCRATCHPAD_SIZE);
+}
+
+Scratchpad::~Scratchpad()
+{
+	if (mOwnsData)
+		free(mData);
+}
+
+void Scratchpad::setData(uint8_t *data)
+{
+	memcpy(data, mData, SCRATCHPAD_SIZE);
+
+	if (mOwnsData)
+		free(mData);
+
+	mData = data;
+	mOwnsData = false;
+}
+
+} // namespace scratchpad
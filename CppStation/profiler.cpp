@@ -0,0 +1,43 @@
+#include <profiler.hpp>
+
+namespace profiler {
+
+const char *const SECTION_NAMES[SECTION_COUNT] = { "cpu", "events", "dma", "gpu", "renderer" };
+
+Profiler::Profiler() :
+	mEnabled(false),
+	mCurrent(Cpu)
+{
+	for (uint32_t i = 0; i < SECTION_COUNT; i++)
+		mTime[i] = std::chrono::duration<double>::zero();
+}
+
+void Profiler::start()
+{
+	for (uint32_t i = 0; i < SECTION_COUNT; i++)
+		mTime[i] = std::chrono::duration<double>::zero();
+
+	mEnabled = true;
+	mCurrent = Cpu;
+	mSliceStart = Clock::now();
+}
+
+void Profiler::stop()
+{
+	if (!mEnabled)
+		return;
+
+	switchTo(Cpu);
+	mEnabled = false;
+}
+
+void Profiler::switchTo(Section section)
+{
+	Clock::time_point now = Clock::now();
+
+	mTime[mCurrent] += now - mSliceStart;
+	mSliceStart = now;
+	mCurrent = section;
+}
+
+} // namespace profiler
@@ -0,0 +1,220 @@
+#include <rewind.hpp>
+#include <bus.hpp>
+#include <savestate.hpp>
+#include <chrono>
+
+namespace rewinding {
+
+const uint32_t PAGE_SIZE = 1 << ram::RAM_PAGE_SHIFT;
+const uint32_t PAGE_WORDS = PAGE_SIZE / 4;
+
+static_assert(gpu::VRAM_PAGE_SHIFT == ram::RAM_PAGE_SHIFT, "The RAM and VRAM pages are encoded the same way");
+// Longest run a token describes
+const uint32_t MAX_RUN = 128;
+
+// The XOR deltas are mostly zeroes with a few changed words here and
+// there. They're encoded as runs of 32 bit words, each preceded by a
+// token: bit 7 is clear for a run of zero words and set for a run of
+// literal words, which follow the token, bits 6:0 are the length of
+// the run minus one.
+static void compress(const uint32_t *delta, std::vector<uint8_t> &out)
+{
+	uint32_t i = 0;
+
+	while (i < PAGE_WORDS)
+	{
+		uint32_t start = i;
+
+		if (delta[i] == 0)
+		{
+			while (i < PAGE_WORDS && i - start < MAX_RUN && delta[i] == 0)
+				i++;
+
+			out.push_back(i - start - 1);
+			continue;
+		}
+
+		// Single zero words are cheaper as literals than as a run
+		while (i < PAGE_WORDS && i - start < MAX_RUN &&
+			   (delta[i] != 0 || (i + 1 < PAGE_WORDS && delta[i + 1] != 0)))
+			i++;
+
+		out.push_back(0x80 | (i - start - 1));
+		const uint8_t *p = (const uint8_t *)(delta + start);
+		out.insert(out.end(), p, p + (i - start) * 4);
+	}
+}
+
+// XOR the delta compressed at `in` into `page`, returns the end of the
+// compressed data
+static const uint8_t *applyDelta(const uint8_t *in, uint8_t *page)
+{
+	uint32_t i = 0;
+
+	while (i < PAGE_WORDS)
+	{
+		uint8_t token = *in++;
+		uint32_t len = (token & 0x7f) + 1;
+
+		if (token & 0x80)
+		{
+			for (uint32_t w = 0; w < len; w++)
+			{
+				uint32_t word, delta;
+				memcpy(&word, page + (i + w) * 4, 4);
+				memcpy(&delta, in + w * 4, 4);
+				word ^= delta;
+				memcpy(page + (i + w) * 4, &word, 4);
+			}
+
+			in += len * 4;
+		}
+
+		i += len;
+	}
+
+	return in;
+}
+
+Rewind::Rewind(bus::Bus &bus, uint32_t interval, uint64_t budget) :
+	mUsed(0),
+	mCaptures(0),
+	mCaptureSeconds(0),
+	mBus(bus),
+	mInterval(interval),
+	mBudget(budget),
+	mCountdown(interval),
+	mReference(bus.mRam.data(), bus.mRam.data() + ram::RAM_SIZE)
+{
+	// The references are up to date
+	bus.mRam.clearDirty();
+
+	if (gpu::Vram *vram = bus.mGpu.mRenderer->vram())
+	{
+		mVramReference.assign(vram->data(), vram->data() + gpu::VRAM_SIZE);
+		vram->clearDirty();
+	}
+}
+
+void Rewind::frame()
+{
+	if (--mCountdown != 0)
+		return;
+
+	mCountdown = mInterval;
+	capture();
+}
+
+void Rewind::capture()
+{
+	auto start = std::chrono::steady_clock::now();
+
+	mSnapshots.emplace_back();
+	Snapshot &snapshot = mSnapshots.back();
+
+	savestate::saveMachine(mBus, snapshot.mMachine);
+
+	capturePages(snapshot, mBus.mRam.data(), mReference.data(), mBus.mRam.mDirtyPages, ram::RAM_PAGES, 0);
+	mBus.mRam.clearDirty();
+
+	if (!mVramReference.empty())
+	{
+		gpu::Vram *vram = mBus.mGpu.mRenderer->vram();
+		capturePages(snapshot, vram->data(), mVramReference.data(), vram->mDirtyPages, gpu::VRAM_PAGES,
+					 ram::RAM_PAGES);
+		vram->clearDirty();
+	}
+
+	snapshot.mMachine.shrink_to_fit();
+	snapshot.mPages.shrink_to_fit();
+	mUsed += size(snapshot);
+
+	// Always keep the one just taken
+	while (mUsed > mBudget && mSnapshots.size() > 1)
+	{
+		mUsed -= size(mSnapshots.front());
+		mSnapshots.pop_front();
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	mCaptures++;
+	mCaptureSeconds += elapsed.count();
+}
+
+void Rewind::capturePages(Snapshot &snapshot, const uint8_t *current, uint8_t *reference, const uint8_t *dirty,
+						  uint32_t pages, uint32_t firstIndex)
+{
+	uint32_t delta[PAGE_WORDS];
+
+	for (uint32_t page = 0; page < pages; page++)
+	{
+		if (!dirty[page])
+			continue;
+
+		const uint8_t *currentPage = current + page * PAGE_SIZE;
+		uint8_t *referencePage = reference + page * PAGE_SIZE;
+		uint32_t changed = 0;
+
+		for (uint32_t w = 0; w < PAGE_WORDS; w++)
+		{
+			uint32_t a, b;
+			memcpy(&a, currentPage + w * 4, 4);
+			memcpy(&b, referencePage + w * 4, 4);
+			delta[w] = a ^ b;
+			changed |= delta[w];
+		}
+
+		// Written with the same data
+		if (!changed)
+			continue;
+
+		memcpy(referencePage, currentPage, PAGE_SIZE);
+
+		uint32_t index = firstIndex + page;
+		snapshot.mPages.push_back(index & 0xff);
+		snapshot.mPages.push_back(index >> 8);
+		compress(delta, snapshot.mPages);
+	}
+}
+
+bool Rewind::rewind(uint32_t count)
+{
+	if (count == 0 || count > mSnapshots.size())
+		return false;
+
+	// The reference holds the RAM of the newest snapshot, undo the
+	// deltas of the newer ones to get back to the target
+	for (uint32_t i = 1; i < count; i++)
+	{
+		const Snapshot &snapshot = mSnapshots.back();
+		const uint8_t *in = snapshot.mPages.data();
+		const uint8_t *end = in + snapshot.mPages.size();
+
+		while (in < end)
+		{
+			uint32_t page = in[0] | (in[1] << 8);
+			uint8_t *reference = page < ram::RAM_PAGES ?
+				mReference.data() + page * PAGE_SIZE :
+				mVramReference.data() + (page - ram::RAM_PAGES) * PAGE_SIZE;
+			in = applyDelta(in + 2, reference);
+		}
+
+		mUsed -= size(snapshot);
+		mSnapshots.pop_back();
+	}
+
+	savestate::restoreRam(mBus, mReference.data());
+	if (!mVramReference.empty())
+		savestate::restoreVram(mBus, mVramReference.data());
+	savestate::loadMachine(mBus, mSnapshots.back().mMachine.data());
+
+	// Back in sync with the references
+	mBus.mRam.clearDirty();
+	if (!mVramReference.empty())
+		mBus.mGpu.mRenderer->vram()->clearDirty();
+	mCountdown = mInterval;
+
+	return true;
+}
+
+} // namespace rewinding
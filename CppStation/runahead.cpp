@@ -0,0 +1,71 @@
+#include <runahead.hpp>
+#include <bus.hpp>
+#include <savestate.hpp>
+#include <chrono>
+
+namespace runahead {
+
+RunAhead::RunAhead(bus::Bus &bus, uint32_t frames) :
+	mSpeculativeFrames(0),
+	mStateSeconds(0),
+	mBus(bus),
+	mFrames(frames),
+	mRam(ram::RAM_SIZE)
+{
+	// The machine section always has the same size, saving it once
+	// gets the buffer to its final capacity
+	savestate::saveMachine(bus, mMachine);
+
+	if (bus.mGpu.mRenderer->vram())
+		mVram.resize(gpu::VRAM_SIZE);
+}
+
+void RunAhead::runFrame()
+{
+	gpu::Gpu &gpu = mBus.mGpu;
+
+	gpu.setRendering(false);
+	mBus.runFrame();
+
+	save();
+
+	for (uint32_t frame = 1; frame <= mFrames; frame++)
+	{
+		// Only the last one is shown
+		gpu.setRendering(frame == mFrames);
+		mBus.runFrame();
+	}
+
+	mSpeculativeFrames += mFrames;
+
+	restore();
+}
+
+void RunAhead::save()
+{
+	auto start = std::chrono::steady_clock::now();
+
+	mMachine.clear();
+	savestate::saveMachine(mBus, mMachine);
+	memcpy(mRam.data(), mBus.mRam.data(), ram::RAM_SIZE);
+	if (!mVram.empty())
+		memcpy(mVram.data(), mBus.mGpu.mRenderer->vram()->data(), gpu::VRAM_SIZE);
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	mStateSeconds += elapsed.count();
+}
+
+void RunAhead::restore()
+{
+	auto start = std::chrono::steady_clock::now();
+
+	savestate::restoreRam(mBus, mRam.data());
+	if (!mVram.empty())
+		savestate::restoreVram(mBus, mVram.data());
+	savestate::loadMachine(mBus, mMachine.data());
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	mStateSeconds += elapsed.count();
+}
+
+} // namespace runahead
@@ -0,0 +1,465 @@
+#include <savestate.hpp>
+#include <bus.hpp>
+#include <cstdio>
+#include <type_traits>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace savestate {
+
+static const char MAGIC[8] = { 'C', 'P', 'P', 'S', 'T', 'A', 'T', 'E' };
+
+enum SectionId
+{
+	Ram = 0,
+	Machine = 1,
+	Vram = 2,
+	SECTION_COUNT = 3,
+};
+
+struct Section
+{
+	uint64_t mOffset;
+	uint64_t mSize;
+};
+
+// Start of the file, padded to a page
+struct Header
+{
+	char mMagic[8];
+	uint32_t mVersion;
+	uint32_t mSectionCount;
+	uint64_t mBiosHash;
+	Section mSections[SECTION_COUNT];
+};
+
+static_assert(sizeof(Header) <= PAGE_SIZE, "The savestate header must fit in a page");
+
+// The machine section is written and read by the same functions, so
+// that both always agree on the layout. Writers append the values,
+// readers assign them.
+class Writer
+{
+public:
+	static const bool LOADING = false;
+
+	Writer(std::vector<uint8_t> &data) :
+		mData(data)
+	{
+	}
+
+	template<typename T>
+	void value(const T &val)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Only plain values can be saved");
+		bytes(&val, sizeof(T));
+	}
+
+	void bytes(const void *data, size_t size)
+	{
+		const uint8_t *p = (const uint8_t *)data;
+		mData.insert(mData.end(), p, p + size);
+	}
+
+private:
+	std::vector<uint8_t> &mData;
+};
+
+class Reader
+{
+public:
+	static const bool LOADING = true;
+
+	Reader(const uint8_t *data) :
+		mData(data)
+	{
+	}
+
+	template<typename T>
+	void value(T &val)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Only plain values can be loaded");
+		bytes(&val, sizeof(T));
+	}
+
+	void bytes(void *data, size_t size)
+	{
+		memcpy(data, mData, size);
+		mData += size;
+	}
+
+private:
+	const uint8_t *mData;
+};
+
+template<typename Stream>
+static void cpuState(Stream &s, cpu::Cpu &cpu)
+{
+	s.value(cpu.mPc);
+	s.value(cpu.mIp);
+	s.value(cpu.mNextPc);
+	s.value(cpu.mCurrentPc);
+	s.value(cpu.mRegs);
+	s.value(cpu.mLoadRegIdx);
+	s.value(cpu.mLoadReg);
+	s.value(cpu.mPendingLoadRegIdx);
+	s.value(cpu.mPendingLoadReg);
+	s.value(cpu.mSr);
+	s.value(cpu.mCause);
+	s.value(cpu.mEpc);
+	s.value(cpu.mHi);
+	s.value(cpu.mLo);
+	s.value(cpu.mBranch);
+	s.value(cpu.mDelaySlot);
+	s.value(cpu.mCycles);
+	s.value(cpu.mMultDivDone);
+	s.value(cpu.mGteDone);
+	s.value(cpu.mIdleLoopsSkipped);
+	s.value(cpu.mIdleCyclesSkipped);
+	s.bytes(cpu.mScratchpad.data(), scratchpad::SCRATCHPAD_SIZE);
+	s.value(cpu.mICache.mControl);
+	s.value(cpu.mICache.mTags);
+}
+
+template<typename Stream>
+static void gteState(Stream &s, cpu::gte::Gte &gte)
+{
+	for (uint32_t reg = 0; reg < 32; reg++)
+	{
+		uint32_t val = gte.data(reg);
+		s.value(val);
+
+		// SXYP, IRGB, ORGB and LZCR are views of the other
+		// registers
+		if (Stream::LOADING && reg != 15 && reg != 28 && reg != 29 && reg != 31)
+			gte.setData(reg, val);
+	}
+
+	for (uint32_t reg = 0; reg < 32; reg++)
+	{
+		uint32_t val = gte.control(reg);
+		s.value(val);
+
+		if (Stream::LOADING)
+			gte.setControl(reg, val);
+	}
+}
+
+template<typename Stream>
+static void dmaState(Stream &s, dma::Dma &dma)
+{
+	s.value(dma.mControl);
+	s.value(dma.mIrqEn);
+	s.value(dma.mChannelIrqEn);
+	s.value(dma.mChannelIrqFlags);
+	s.value(dma.mForceIrq);
+	s.value(dma.mIrqDummy);
+
+	for (dma::Channel *channel : dma.mChannels)
+	{
+		s.value(channel->mEnable);
+		s.value(channel->mDirection);
+		s.value(channel->mStep);
+		s.value(channel->mSync);
+		s.value(channel->mTrigger);
+		s.value(channel->mChop);
+		s.value(channel->mChopDmaSz);
+		s.value(channel->mChopCpuSz);
+		s.value(channel->mBase);
+		s.value(channel->mBlockSize);
+		s.value(channel->mBlockCount);
+		s.value(channel->mDummy);
+	}
+}
+
+template<typename Stream>
+static void gpuState(Stream &s, gpu::Gpu &gpu)
+{
+	s.value(gpu.mPageBaseX);
+	s.value(gpu.mPageBaseY);
+	s.value(gpu.mRectangleTextureXFlip);
+	s.value(gpu.mRectangleTextureYFlip);
+	s.value(gpu.mSemiTransparency);
+	s.value(gpu.mTextureDepth);
+	s.value(gpu.mTextureWindowXMask);
+	s.value(gpu.mTextureWindowYMask);
+	s.value(gpu.mTextureWindowXOffset);
+	s.value(gpu.mTextureWindowYOffset);
+	s.value(gpu.mDithering);
+	s.value(gpu.mDrawToDisplay);
+	s.value(gpu.mForceSetMaskBit);
+	s.value(gpu.mPreserveMaskedPixels);
+	s.value(gpu.mDrawingAreaLeft);
+	s.value(gpu.mDrawingAreaTop);
+	s.value(gpu.mDrawingAreaRight);
+	s.value(gpu.mDrawingAreaBottom);
+	s.value(gpu.mDrawingXOffset);
+	s.value(gpu.mDrawingYOffset);
+	s.value(gpu.mField);
+	s.value(gpu.mTextureDisable);
+	s.value(gpu.mHres.mHr);
+	s.value(gpu.mVres);
+	s.value(gpu.mVmode);
+	s.value(gpu.mDisplayDepth);
+	s.value(gpu.mInterlaced);
+	s.value(gpu.mDisplayDisabled);
+	s.value(gpu.mDisplayVramXStart);
+	s.value(gpu.mDisplayVramYStart);
+	s.value(gpu.mDisplayHorizStart);
+	s.value(gpu.mDisplayHorizEnd);
+	s.value(gpu.mDisplayLineStart);
+	s.value(gpu.mDisplayLineEnd);
+	s.value(gpu.mInterrupt);
+	s.value(gpu.mDmaDirection);
+	s.value(gpu.mFrames);
+	s.value(gpu.mGp0Command.mBuffer);
+	s.value(gpu.mGp0Command.mLen);
+	s.value(gpu.mGp0WordsRemaining);
+	s.value(gpu.mGp0Mode);
+	// Where the rest of an image load goes in the renderer's VRAM
+	gpu::ImageLoad load = gpu.mRenderer->imageLoadState();
+	s.value(load);
+	if (Stream::LOADING)
+		gpu.mRenderer->setImageLoadState(load);
+
+	// The method of a command waiting for its parameters is found
+	// again from its opcode
+	if (Stream::LOADING && gpu.mGp0Mode == gpu::Gp0Mode::Command &&
+		gpu.mGp0WordsRemaining != 0 && gpu.mGp0Command.mLen != 0)
+	{
+		uint32_t remaining = gpu.mGp0WordsRemaining;
+		gpu.gp0SetupCommand(gpu.mGp0Command[0]);
+		gpu.mGp0WordsRemaining = remaining;
+	}
+}
+
+template<typename Stream>
+static void memControlState(Stream &s, memcontrol::MemControl &memControl)
+{
+	// The delay/size registers and the common delay, the base
+	// addresses can't change
+	for (uint32_t offset = 8; offset <= 0x20; offset += 4)
+	{
+		uint32_t val = memControl.load32(offset);
+		s.value(val);
+
+		if (Stream::LOADING)
+			memControl.store32(offset, val);
+	}
+}
+
+template<typename Stream>
+static void schedulerState(Stream &s, scheduler::Scheduler &scheduler)
+{
+	for (scheduler::EventId id = 0; id < scheduler.eventCount(); id++)
+	{
+		bool pending = scheduler.isPending(id);
+		uint64_t deadline = scheduler.deadline(id);
+		s.value(pending);
+		s.value(deadline);
+
+		if (!Stream::LOADING)
+			continue;
+
+		if (pending)
+			scheduler.schedule(id, deadline);
+		else
+			scheduler.cancel(id);
+	}
+}
+
+template<typename Stream>
+static void machineState(Stream &s, bus::Bus &bus)
+{
+	cpuState(s, bus.mCpu);
+	gteState(s, bus.mCpu.mGte);
+	dmaState(s, bus.mDma);
+	gpuState(s, bus.mGpu);
+	memControlState(s, bus.mMemControl);
+	schedulerState(s, bus.mScheduler);
+}
+
+void saveMachine(bus::Bus &bus, std::vector<uint8_t> &data)
+{
+	Writer writer(data);
+	machineState(writer, bus);
+}
+
+void loadMachine(bus::Bus &bus, const uint8_t *data)
+{
+	Reader reader(data);
+	machineState(reader, bus);
+
+	// Derived from the restored state
+	bus.mCpu.mIdleBlock = nullptr;
+	bus.updateLoadDelays();
+	if (bus.mGpu.drawing())
+		bus.mGpu.mRenderer->setDrawing(bus.mGpu.drawingConfig());
+	if (bus.mGpu.mRendering)
+		bus.mGpu.mRenderer->setDisplay(bus.mGpu.displayConfig());
+}
+
+void restoreRam(bus::Bus &bus, const uint8_t *saved)
+{
+	uint8_t *ram = bus.mRam.data();
+	const uint32_t pageSize = 1 << ram::RAM_PAGE_SHIFT;
+
+	for (uint32_t offset = 0; offset < ram::RAM_SIZE; offset += pageSize)
+	{
+		if (memcmp(ram + offset, saved + offset, pageSize) == 0)
+			continue;
+
+		memcpy(ram + offset, saved + offset, pageSize);
+		bus.mCpu.mBlockCache.invalidate(offset);
+		bus.mRam.markDirty(offset, pageSize);
+	}
+}
+
+void restoreVram(bus::Bus &bus, const uint8_t *saved)
+{
+	gpu::Vram *vram = bus.mGpu.mRenderer->vram();
+	if (!vram)
+		return;
+
+	const uint32_t pageSize = 1 << gpu::VRAM_PAGE_SHIFT;
+
+	for (uint32_t page = 0; page < gpu::VRAM_PAGES; page++)
+	{
+		uint8_t *current = vram->data() + page * pageSize;
+
+		if (memcmp(current, saved + page * pageSize, pageSize) == 0)
+			continue;
+
+		memcpy(current, saved + page * pageSize, pageSize);
+		vram->mDirtyPages[page] = 1;
+	}
+}
+
+auto save(bus::Bus &bus, const std::string &path) -> cpp::result<uint64_t, std::string>
+{
+	std::vector<uint8_t> machine;
+	saveMachine(bus, machine);
+
+	// A renderer without VRAM saves a blank one
+	std::vector<uint8_t> blank;
+	const uint8_t *vram;
+	if (gpu::Vram *rendererVram = bus.mGpu.mRenderer->vram())
+	{
+		vram = rendererVram->data();
+	}
+	else
+	{
+		blank.resize(gpu::VRAM_SIZE);
+		vram = blank.data();
+	}
+
+	uint8_t page[PAGE_SIZE] = {};
+	Header *header = (Header *)page;
+	memcpy(header->mMagic, MAGIC, sizeof(MAGIC));
+	header->mVersion = VERSION;
+	header->mSectionCount = SECTION_COUNT;
+	header->mBiosHash = bus.mBios.hash();
+	header->mSections[Ram] = { RAM_OFFSET, ram::RAM_SIZE };
+	header->mSections[Machine] = { MACHINE_OFFSET, machine.size() };
+	header->mSections[Vram] = { VRAM_OFFSET, gpu::VRAM_SIZE };
+
+	FILE *file = fopen(path.c_str(), "wb");
+	if (!file)
+		return cpp::fail(path + ": " + std::string(std::strerror(errno)));
+
+	bool ok = fwrite(page, PAGE_SIZE, 1, file) == 1 &&
+		fwrite(bus.mRam.data(), ram::RAM_SIZE, 1, file) == 1 &&
+		fwrite(vram, gpu::VRAM_SIZE, 1, file) == 1 &&
+		fwrite(machine.data(), machine.size(), 1, file) == 1;
+	ok = (fclose(file) == 0) && ok;
+
+	if (!ok)
+		return cpp::fail(path + ": " + std::string(std::strerror(errno)));
+
+	return MACHINE_OFFSET + machine.size();
+}
+
+static auto restore(bus::Bus &bus, const std::string &path, const uint8_t *data, uint64_t size)
+	-> cpp::result<uint64_t, std::string>
+{
+	if (size < PAGE_SIZE)
+		return cpp::fail(path + " is not a savestate");
+
+	const Header *header = (const Header *)data;
+	if (memcmp(header->mMagic, MAGIC, sizeof(MAGIC)) != 0)
+		return cpp::fail(path + " is not a savestate");
+	if (header->mVersion != VERSION)
+		return cpp::fail(fmt::format("{} is a version {} savestate, only version {} is supported",
+									 path, header->mVersion, VERSION));
+
+	// The size of the machine section only depends on the version
+	// and the emulated devices, check it against ours before
+	// changing anything
+	std::vector<uint8_t> current;
+	saveMachine(bus, current);
+
+	const Section &ram = header->mSections[Ram];
+	const Section &machine = header->mSections[Machine];
+	const Section &vram = header->mSections[Vram];
+	if (header->mSectionCount != SECTION_COUNT ||
+		ram.mOffset != RAM_OFFSET || ram.mSize != ram::RAM_SIZE ||
+		vram.mOffset != VRAM_OFFSET || vram.mSize != gpu::VRAM_SIZE ||
+		machine.mOffset != MACHINE_OFFSET || machine.mSize != current.size() ||
+		size < machine.mOffset + machine.mSize)
+		return cpp::fail(path + " is corrupted");
+
+	if (header->mBiosHash != bus.mBios.hash())
+		return cpp::fail(path + " was saved with another BIOS");
+
+	restoreRam(bus, data + ram.mOffset);
+	restoreVram(bus, data + vram.mOffset);
+	loadMachine(bus, data + machine.mOffset);
+
+	return size;
+}
+
+auto load(bus::Bus &bus, const std::string &path) -> cpp::result<uint64_t, std::string>
+{
+#ifdef __linux__
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1)
+		return cpp::fail(path + ": " + std::string(std::strerror(errno)));
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return cpp::fail(path + " is not a savestate");
+	}
+
+	// Fault the whole file in at once instead of a page at a time
+	// during the copies
+	void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return cpp::fail(path + ": " + std::string(std::strerror(errno)));
+
+	auto res = restore(bus, path, (const uint8_t *)data, st.st_size);
+	munmap(data, st.st_size);
+
+	return res;
+#else
+	std::ifstream ifs(path, std::ifstream::binary | std::ifstream::ate);
+	if (!ifs.is_open())
+		return cpp::fail(path + ": " + std::string(std::strerror(errno)));
+
+	std::vector<uint8_t> data(ifs.tellg());
+	ifs.seekg(0);
+	if (!ifs.read((char *)data.data(), data.size()))
+		return cpp::fail(path + " is truncated");
+
+	return restore(bus, path, data.data(), data.size());
+#endif
+}
+
+} // namespace savestate
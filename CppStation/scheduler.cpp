@@ -0,0 +1,139 @@
+#include <scheduler.hpp>
+
+namespace scheduler {
+
+Scheduler::Scheduler()
+{
+}
+
+Scheduler::~Scheduler()
+{
+}
+
+EventId Scheduler::add(Callback callback)
+{
+	mEvents.push_back({callback, NEVER, NOT_PENDING});
+
+	return mEvents.size() - 1;
+}
+
+void Scheduler::schedule(EventId id, uint64_t deadline)
+{
+	Event &event = mEvents[id];
+
+	if (event.mHeapPos == NOT_PENDING)
+	{
+		event.mDeadline = deadline;
+		mHeap.push_back(id);
+		event.mHeapPos = mHeap.size() - 1;
+		siftUp(event.mHeapPos);
+		return;
+	}
+
+	uint64_t previous = event.mDeadline;
+	event.mDeadline = deadline;
+
+	if (deadline < previous)
+		siftUp(event.mHeapPos);
+	else
+		siftDown(event.mHeapPos);
+}
+
+void Scheduler::cancel(EventId id)
+{
+	if (isPending(id))
+		remove(mEvents[id].mHeapPos);
+}
+
+void Scheduler::runDue(uint64_t now)
+{
+	while (!mHeap.empty())
+	{
+		EventId id = mHeap[0];
+		Event &event = mEvents[id];
+
+		if (event.mDeadline > now)
+			break;
+
+		// Take it out first, the callback is likely to schedule
+		// it again
+		remove(0);
+		event.mCallback(event.mDeadline);
+	}
+}
+
+bool Scheduler::before(EventId a, EventId b) const
+{
+	uint64_t da = mEvents[a].mDeadline;
+	uint64_t db = mEvents[b].mDeadline;
+
+	return da < db || (da == db && a < b);
+}
+
+void Scheduler::place(uint32_t pos, EventId id)
+{
+	mHeap[pos] = id;
+	mEvents[id].mHeapPos = pos;
+}
+
+void Scheduler::siftUp(uint32_t pos)
+{
+	EventId id = mHeap[pos];
+
+	while (pos > 0)
+	{
+		uint32_t parent = (pos - 1) / 2;
+
+		if (!before(id, mHeap[parent]))
+			break;
+
+		place(pos, mHeap[parent]);
+		pos = parent;
+	}
+
+	place(pos, id);
+}
+
+void Scheduler::siftDown(uint32_t pos)
+{
+	EventId id = mHeap[pos];
+	uint32_t size = mHeap.size();
+
+	for (;;)
+	{
+		uint32_t child = 2 * pos + 1;
+
+		if (child >= size)
+			break;
+
+		if (child + 1 < size && before(mHeap[child + 1], mHeap[child]))
+			child++;
+
+		if (!before(mHeap[child], id))
+			break;
+
+		place(pos, mHeap[child]);
+		pos = child;
+	}
+
+	place(pos, id);
+}
+
+void Scheduler::remove(uint32_t pos)
+{
+	EventId id = mHeap[pos];
+	EventId last = mHeap.back();
+
+	mHeap.pop_back();
+	mEvents[id].mHeapPos = NOT_PENDING;
+
+	if (pos == mHeap.size())
+		return;
+
+	// Move the last entry in the hole, it can go either way
+	place(pos, last);
+	siftUp(pos);
+	siftDown(mEvents[last].mHeapPos);
+}
+
+} // namespace scheduler
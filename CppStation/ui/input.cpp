@@ -1,62 +1,76 @@
 #include <ui/input.hpp>
+#include <gpu/opengl/window.hpp>
 
 namespace ui {
 namespace input {
 
-bool keyPressedData[GLFW_KEY_LAST] = {};
-bool mouseButtonPressedData[GLFW_MOUSE_BUTTON_LAST] = {};
-float mouseX = 0.0f;
-float mouseY = 0.0f;
-float mouseScrollX = 0.0f;
-float mouseScrollY = 0.0f;
+Input::Input() :
+	mKeyPressed(),
+	mMouseButtonPressed(),
+	mMouseX(0.0f),
+	mMouseY(0.0f),
+	mMouseScrollX(0.0f),
+	mMouseScrollY(0.0f)
+{
+}
 
-void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+bool Input::isKeyDown(int key) const
 {
 	if (key >= 0 && key < GLFW_KEY_LAST)
 	{
-		keyPressedData[key] = action == GLFW_PRESS;
+		return mKeyPressed[key];
 	}
-}
 
-void mouseCallback(GLFWwindow* window, double xpos, double ypos)
-{
-	mouseX = (float)xpos;
-	mouseY = (float)ypos;
+	return false;
 }
 
-void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+bool Input::isMouseButtonDown(int mouseButton) const
 {
-	if (button >= 0 && button < GLFW_MOUSE_BUTTON_LAST)
+	if (mouseButton >= 0 && mouseButton < GLFW_MOUSE_BUTTON_LAST)
 	{
-		mouseButtonPressedData[button] = action == GLFW_PRESS;
+		return mMouseButtonPressed[mouseButton];
 	}
+
+	return false;
 }
 
-void mouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
+static Input &windowInput(GLFWwindow* window)
 {
-	mouseScrollX = (float)xoffset;
-	mouseScrollY = (float)yoffset;
+	return ((gpu::opengl::window::Window*)glfwGetWindowUserPointer(window))->mInput;
 }
 
-bool isKeyDown(int key)
+void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
 	if (key >= 0 && key < GLFW_KEY_LAST)
 	{
-		return keyPressedData[key];
+		// A held key sends repeats, it stays down until released
+		windowInput(window).mKeyPressed[key] = action != GLFW_RELEASE;
 	}
+}
 
-	return false;
+void mouseCallback(GLFWwindow* window, double xpos, double ypos)
+{
+	Input &input = windowInput(window);
+
+	input.mMouseX = (float)xpos;
+	input.mMouseY = (float)ypos;
 }
 
-bool isMouseButtonDown(int mouseButton)
+void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 {
-	if (mouseButton >= 0 && mouseButton < GLFW_MOUSE_BUTTON_LAST)
+	if (button >= 0 && button < GLFW_MOUSE_BUTTON_LAST)
 	{
-		return mouseButtonPressedData[mouseButton];
+		windowInput(window).mMouseButtonPressed[button] = action == GLFW_PRESS;
 	}
+}
 
-	return false;
+void mouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
+{
+	Input &input = windowInput(window);
+
+	input.mMouseScrollX = (float)xoffset;
+	input.mMouseScrollY = (float)yoffset;
 }
 
 } // namespace input
-} // namespace ui
\ No newline at end of file
+} // namespace ui
@@ -0,0 +1,384 @@
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <bus.hpp>
+#include <gpu/nullRenderer.hpp>
+#include <gpu/software/renderer.hpp>
+
+#include "helpers.hpp"
+
+// Each benchmark runs for at least this long
+static double gMinTime = 0.2;
+// Only the benchmarks whose name contains this run
+static std::string gFilter;
+// Results are added there so that the compiler can't drop the work
+static volatile uint32_t gSink;
+
+struct Result
+{
+	std::string mName;
+	uint64_t mOps;
+	double mSeconds;
+};
+
+static bool selected(const std::string &name)
+{
+	return name.find(gFilter) != std::string::npos;
+}
+
+// Call `body`, which does `batch` operations, until it has run for
+// `gMinTime` seconds, doubling the number of calls each round, and
+// add the result to `results`. Nothing is run if the benchmark isn't
+// selected.
+static void measure(std::vector<Result> &results, const std::string &name, uint64_t batch,
+					const std::function<void()> &body)
+{
+	if (!selected(name))
+		return;
+
+	// Warm up the caches and the branch predictors
+	body();
+
+	for (uint64_t calls = 1;; calls *= 2)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (uint64_t i = 0; i < calls; i++)
+			body();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		if (elapsed.count() >= gMinTime)
+		{
+			results.push_back({name, calls * batch, elapsed.count()});
+			return;
+		}
+	}
+}
+
+// Number of operations in a batch for the cheap benchmarks, enough to
+// hide the cost of the std::function call
+const uint32_t BATCH = 256;
+
+// Registers used by the instructions: r1 = 5, r2 = 7 and r4 points
+// to RAM
+static void setupCpu(bus::Bus &bus)
+{
+	bus.mCpu.mRegs[1] = 5;
+	bus.mCpu.mRegs[2] = 7;
+	bus.mCpu.mRegs[4] = 0x80001000;
+}
+
+// Loop in RAM mixing loads, ALU and stores:
+//   lw $3, 0($4); addu $5, $3, $1; sw $5, 4($4); addiu $6, $6, 1;
+//   b loop; nop
+const uint32_t MIXED_LOOP_BASE = 0x80020000;
+static const uint32_t MIXED_LOOP[] = { 0x8c830000, 0x00612821, 0xac850004, 0x24c60001, 0x1000fffb, 0x00000000 };
+
+static void benchCpu(bus::Bus &bus, std::vector<Result> &results)
+{
+	struct Class
+	{
+		const char *mName;
+		uint32_t mInstruction;
+	};
+
+	static const Class classes[] = {
+		{ "alu", 0x00221821 },			// addu $3, $1, $2
+		{ "shift", 0x00011880 },		// sll $3, $1, 2
+		{ "immediate", 0x24230001 },	// addiu $3, $1, 1
+		{ "load", 0x8c830000 },			// lw $3, 0($4)
+		{ "store", 0xac830000 },		// sw $3, 0($4)
+		{ "branch", 0x10220000 },		// beq $1, $2, 0 (not taken)
+		{ "multdiv", 0x00220018 },		// mult $1, $2
+		{ "cop0", 0x40036000 },			// mfc0 $3, $12
+		{ "gte", 0x4a180001 },			// rtps
+	};
+
+	cpu::Cpu &cpu = bus.mCpu;
+
+	for (const Class &c : classes)
+	{
+		setupCpu(bus);
+		uint32_t instruction = c.mInstruction;
+
+		measure(results, std::string("cpu.decodeAndExecute.") + c.mName, BATCH, [&]() {
+			for (uint32_t i = 0; i < BATCH; i++)
+				cpu.decodeAndExecute(instruction);
+		});
+	}
+
+	// The whole instruction path with the fetch, the register
+	// updates and the load delay slots, which the handlers alone
+	// don't go through
+	for (uint32_t i = 0; i < std::size(MIXED_LOOP); i++)
+		bus.mRam.store<uint32_t>((MIXED_LOOP_BASE & 0x1fffffff) + i * 4, MIXED_LOOP[i]);
+
+	setupCpu(bus);
+	cpu.mPc = MIXED_LOOP_BASE;
+	cpu.mNextPc = MIXED_LOOP_BASE + 4;
+
+	measure(results, "cpu.runNextInstruction.loop", BATCH, [&]() {
+		for (uint32_t i = 0; i < BATCH; i++)
+			cpu.runNextInstruction();
+	});
+}
+
+static void benchBus(bus::Bus &bus, std::vector<Result> &results)
+{
+	struct Region
+	{
+		const char *mName;
+		uint32_t mAddr;
+		bool mStore;
+	};
+
+	static const Region regions[] = {
+		{ "ram", 0x80001000, true },
+		{ "bios", 0xbfc00100, false },
+		{ "irq", 0x1f801074, true },
+		{ "dma", 0x1f8010f0, true },
+		{ "gpu", 0x1f801814, false },
+		{ "timers", 0x1f801100, true },
+	};
+
+	for (const Region &r : regions)
+	{
+		uint32_t addr = r.mAddr;
+
+		measure(results, std::string("bus.load32.") + r.mName, BATCH, [&]() {
+			uint32_t sum = 0;
+			for (uint32_t i = 0; i < BATCH; i++)
+				sum += bus.load<uint32_t>(addr);
+			gSink = sum;
+		});
+
+		if (!r.mStore)
+			continue;
+
+		// Write back what's there, DPCR keeps the same channel
+		// priorities
+		uint32_t val = bus.load<uint32_t>(addr);
+		measure(results, std::string("bus.store32.") + r.mName, BATCH, [&]() {
+			for (uint32_t i = 0; i < BATCH; i++)
+				bus.store<uint32_t>(addr, val);
+		});
+	}
+
+	measure(results, "ram.load32", BATCH, [&]() {
+		uint32_t sum = 0;
+		for (uint32_t i = 0; i < BATCH; i++)
+			sum += bus.mRam.load<uint32_t>(i * 4);
+		gSink = sum;
+	});
+}
+
+// Mono quad, shaded triangle and draw mode
+static const uint32_t GP0_COMMANDS[] = {
+	0x28102030, 0x00100010, 0x00100100, 0x01000010, 0x01000100,
+	0x30ff0000, 0x00200020, 0x0000ff00, 0x00200080, 0x000000ff, 0x00800050,
+	0xe1000208,
+};
+
+static void benchGpu(bus::Bus &bus, std::vector<Result> &results)
+{
+	gpu::Gpu &gpu = bus.mGpu;
+
+	measure(results, "gpu.gp0", 3 * BATCH, [&]() {
+		for (uint32_t i = 0; i < BATCH; i++)
+			for (uint32_t word : GP0_COMMANDS)
+				gpu.gp0(word);
+	});
+
+	gpu::NullRenderer null;
+	gpu::Renderer &renderer = null;
+	gpu::Vertex v = {gpu::Position::fromPacked(0x00100010), gpu::Color::fromPacked(0x102030)};
+
+	measure(results, "renderer.pushQuad.null", BATCH, [&]() {
+		for (uint32_t i = 0; i < BATCH; i++)
+			renderer.pushQuad(v, v, v, v, false);
+	});
+
+	// 64x64 quads, flat and shaded, through the SIMD and the scalar
+	// span loops
+	gpu::software::Renderer software;
+	gpu::DrawingConfig drawing = {};
+	drawing.mRight = gpu::VRAM_WIDTH - 1;
+	drawing.mBottom = gpu::VRAM_HEIGHT - 1;
+	drawing.mDithering = true;
+	software.setDrawing(drawing);
+
+	gpu::Vertex quad[4] = {
+		{gpu::Position::fromPacked(0x00100010), gpu::Color::fromPacked(0x0000ff)},
+		{gpu::Position::fromPacked(0x00100050), gpu::Color::fromPacked(0x00ff00)},
+		{gpu::Position::fromPacked(0x00500010), gpu::Color::fromPacked(0xff0000)},
+		{gpu::Position::fromPacked(0x00500050), gpu::Color::fromPacked(0x808080)},
+	};
+
+	for (bool simd : {false, true})
+	{
+		if (simd && !gpu::software::SIMD_AVAILABLE)
+			continue;
+
+		software.mRasterizer.mSimd = simd;
+		std::string suffix = simd ? ".simd" : ".scalar";
+
+		for (bool shaded : {false, true})
+		{
+			std::string name = std::string("renderer.pushQuad.software.") + (shaded ? "shaded" : "flat") + suffix;
+			measure(results, name, BATCH, [&]() {
+				for (uint32_t i = 0; i < BATCH; i++)
+					software.pushQuad(quad[0], quad[1], quad[2], quad[3], shaded);
+			});
+		}
+	}
+}
+
+// Ordering table of this many entries at OT_BASE in RAM
+const uint32_t OT_ENTRIES = 1024;
+const uint32_t OT_BASE = 0x100000;
+
+static void benchDma(bus::Bus &bus, std::vector<Result> &results)
+{
+	// Linked list of OT_ENTRIES mono quad packets, like a game's
+	// ordering table once filled
+	const uint32_t packetWords = 6;
+	for (uint32_t i = 0; i < OT_ENTRIES; i++)
+	{
+		uint32_t addr = OT_BASE + i * packetWords * 4;
+		uint32_t next = (i == OT_ENTRIES - 1) ? 0xffffff : addr + packetWords * 4;
+
+		bus.mRam.store<uint32_t>(addr, (5 << 24) | next);
+		for (uint32_t w = 0; w < 5; w++)
+			bus.mRam.store<uint32_t>(addr + 4 + w * 4, GP0_COMMANDS[w]);
+	}
+
+	dma::Channel *gpuChannel = bus.mDma.channel(dma::Port::Gpu);
+	gpuChannel->setBase(OT_BASE);
+	// Enabled, linked list, from RAM
+	gpuChannel->setControl(0x01000401);
+
+	measure(results, "bus.doDmaLinkedList.packet", OT_ENTRIES, [&]() {
+		bus.doDmaLinkedList(dma::Port::Gpu);
+	});
+
+	// OTC clear of the same table, starting from its last entry
+	dma::Channel *otc = bus.mDma.channel(dma::Port::Otc);
+	otc->setBase(OT_BASE + (OT_ENTRIES - 1) * 4);
+	otc->setBlockControl(OT_ENTRIES);
+	// Enabled, triggered, manual, decrementing, to RAM
+	otc->setControl(0x11000002);
+
+	measure(results, "bus.doDmaBlock.otc", OT_ENTRIES, [&]() {
+		bus.doDmaBlock(dma::Port::Otc);
+	});
+}
+
+// Busy loop in RAM: addiu $3, $3, 1; addu $5, $3, $1; b loop; nop
+const uint32_t LOOP_BASE = 0x80010000;
+static const uint32_t LOOP[] = { 0x24630001, 0x00612821, 0x1000fffd, 0x00000000 };
+
+// Same number of cycles run by the CPU straight through, and sliced
+// by Bus::runUntil at each scheduler deadline. Reported per guest
+// instruction, the two should be the same: the slicing adds nothing
+// to each instruction.
+static void benchScheduler(bus::Bus &bus, std::vector<Result> &results)
+{
+	struct Mode
+	{
+		const char *mName;
+		cpu::ExecutionMode mMode;
+		bool mAvailable;
+	};
+
+	static const Mode modes[] = {
+		{ "interpreter", cpu::ExecutionMode::Interpreter, true },
+		{ "recompiler", cpu::ExecutionMode::Recompiler, cpu::jit::AVAILABLE },
+	};
+
+	for (uint32_t i = 0; i < std::size(LOOP); i++)
+		bus.mRam.store<uint32_t>((LOOP_BASE & 0x1fffffff) + i * 4, LOOP[i]);
+
+	cpu::Cpu &cpu = bus.mCpu;
+	cpu::ExecutionMode savedMode = cpu.mExecutionMode;
+	// The loop isn't idle but don't let the idle loop detection
+	// have a say
+	bool savedIdleSkipping = cpu.mIdleSkipping;
+	cpu.mIdleSkipping = false;
+	setupCpu(bus);
+	cpu.mPc = LOOP_BASE;
+	cpu.mNextPc = LOOP_BASE + 4;
+
+	for (const Mode &m : modes)
+	{
+		if (!m.mAvailable)
+			continue;
+
+		cpu.mExecutionMode = m.mMode;
+
+		const std::function<void()> bodies[] = {
+			[&]() { bus.runUntil(cpu.mCycles + gpu::NTSC_FRAME_CYCLES); },
+			[&]() { cpu.run(gpu::NTSC_FRAME_CYCLES); },
+		};
+		const char *names[] = { "scheduler.runUntil.", "scheduler.cpuRun." };
+
+		for (uint32_t i = 0; i < std::size(bodies); i++)
+		{
+			// Instructions in a frame worth of cycles, the loop
+			// always takes the same time
+			std::string name = names[i] + std::string(m.mName);
+			if (!selected(name))
+				continue;
+
+			uint32_t ip = cpu.mIp;
+			bodies[i]();
+			measure(results, name, cpu.mIp - ip, bodies[i]);
+		}
+	}
+
+	cpu.mExecutionMode = savedMode;
+	cpu.mIdleSkipping = savedIdleSkipping;
+}
+
+int main(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg(argv[i]);
+
+		if (arg.rfind("--min-time=", 0) == 0)
+			gMinTime = strtod(arg.c_str() + 11, nullptr);
+		else if (arg.rfind("--", 0) == 0)
+			panic("Unknown option '{}'", arg);
+		else
+			gFilter = arg;
+	}
+
+	std::vector<Result> results;
+
+	// The benchmarks only touch RAM, they don't need the BIOS
+	std::unique_ptr<bus::Bus> bus(new bus::Bus(""));
+
+	benchCpu(*bus, results);
+	benchBus(*bus, results);
+	benchGpu(*bus, results);
+	benchDma(*bus, results);
+	benchScheduler(*bus, results);
+
+	logging::flush();
+
+	fmt::print("{{\n  \"benchmarks\": [\n");
+	bool first = true;
+	for (const Result &r : results)
+	{
+		fmt::print("{}    {{\"name\": \"{}\", \"ops\": {}, \"seconds\": {:.6f}, \"ns_per_op\": {:.3f}, \"ops_per_s\": {:.0f}}}",
+				   first ? "" : ",\n", r.mName, r.mOps, r.mSeconds, r.mSeconds * 1e9 / r.mOps, r.mOps / r.mSeconds);
+		first = false;
+	}
+	fmt::print("\n  ]\n}}\n");
+
+	return 0;
+}
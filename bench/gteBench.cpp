@@ -0,0 +1,119 @@
+#include <chrono>
+#include <cstdlib>
+#include <initializer_list>
+#include <vector>
+
+#include <cpu/gte.hpp>
+
+#include "helpers.hpp"
+
+using cpu::gte::Gte;
+
+// Vertices packed the way LWC2 loads them: VXY then VZ
+struct Triangle
+{
+	uint32_t mXy[3];
+	uint32_t mZ[3];
+};
+
+// Typical setup of a 3D game: rotation around Y, object in front of
+// the camera, 320x240 screen
+static void setup(Gte &gte)
+{
+	// cos/sin(30 degrees) in 1.3.12
+	int16_t c = 0x0ddb;
+	int16_t s = 0x0800;
+
+	gte.setControl(0, (uint16_t)c);
+	gte.setControl(1, (uint16_t)s);
+	gte.setControl(2, 0x1000);
+	gte.setControl(3, (uint16_t)-s);
+	gte.setControl(4, (uint16_t)c);
+	gte.setControl(5, 0);
+	gte.setControl(6, 0);
+	gte.setControl(7, 0x1000);
+	gte.setControl(24, 160 << 16);
+	gte.setControl(25, 120 << 16);
+	gte.setControl(26, 0x200);
+	gte.setControl(27, (uint16_t)-0x100);
+	gte.setControl(28, 0x1400000);
+}
+
+// Run RTPT on every triangle `rounds` times, like a game would: load
+// the vertices, transform them and store the screen coordinates.
+// Returns a checksum of the results.
+static uint64_t run(Gte &gte, const std::vector<Triangle> &triangles, uint32_t rounds)
+{
+	uint64_t checksum = 0;
+
+	for (uint32_t round = 0; round < rounds; round++)
+	{
+		for (const Triangle &t : triangles)
+		{
+			for (uint32_t v = 0; v < 3; v++)
+			{
+				gte.setData(2 * v, t.mXy[v]);
+				gte.setData(2 * v + 1, t.mZ[v]);
+			}
+
+			gte.command(0x80030);
+
+			for (uint32_t reg = 12; reg < 15; reg++)
+				checksum = checksum * 31 + gte.data(reg);
+			checksum = checksum * 31 + gte.control(31);
+		}
+	}
+
+	return checksum;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t rounds = argc > 1 ? strtoul(argv[1], nullptr, 0) : 1000;
+
+	// Model around the origin, some vertices far enough to saturate
+	std::vector<Triangle> triangles(4096);
+	srand(1);
+	for (Triangle &t : triangles)
+	{
+		for (uint32_t v = 0; v < 3; v++)
+		{
+			int16_t x = rand() % 0x1000 - 0x800;
+			int16_t y = rand() % 0x1000 - 0x800;
+			int16_t z = rand() % 0x1000 - 0x800;
+
+			t.mXy[v] = (uint16_t)x | ((uint32_t)(uint16_t)y << 16);
+			t.mZ[v] = (uint16_t)z;
+		}
+	}
+
+	uint64_t reference = 0;
+
+	for (bool simd : {false, true})
+	{
+		if (simd && !cpu::gte::SIMD_AVAILABLE)
+		{
+			println("simd: not available in this build");
+			continue;
+		}
+
+		Gte gte;
+		setup(gte);
+		gte.mSimd = simd;
+
+		auto start = std::chrono::steady_clock::now();
+		uint64_t checksum = run(gte, triangles, rounds);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		double count = (double)rounds * triangles.size();
+		println("{}: {:.2f} M RTPT/s, {:.1f} ns/RTPT, checksum {:016x}", simd ? "simd" : "scalar",
+				count / elapsed.count() / 1e6, elapsed.count() * 1e9 / count, checksum);
+
+		if (!simd)
+			reference = checksum;
+		else if (checksum != reference)
+			panic("SIMD results differ from the scalar reference");
+	}
+
+	return 0;
+}